@@ -10,9 +10,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <inttypes.h>
+
+#include <time.h>
 
 #include <libwebsockets.h>
 
+#include "control.h"
 #include "display.h"
 
 #include "cmd/cmd.h"
@@ -21,32 +25,370 @@
 
 #include "util/log.h"
 #include "util/util.h"
+#include "util/time.h"
+#include "util/timer.h"
 #include "util/buffer.h"
+#include "util/script.h"
+#include "util/locate.h"
+
+/** Kinds of DevTools websocket connection. */
+enum cdt_conn_type {
+	CDT_CONN_SESSION, /**< Connection to a page, for one session. */
+	CDT_CONN_BROWSER, /**< Connection to the browser, for many sessions. */
+};
 
-struct cdt_ctx {
+/** A DevTools websocket connection. */
+struct cdt_conn {
+	enum cdt_conn_type type;
 	struct lws *web_socket;
-	bool interrupted;
-	void *cmd_pw;
+	struct msg_ctx *msg;
+	const char *host; /* Host it was last connected to, or NULL. */
 
 	struct cdt_buffer multipart_msg;
+
+	/** Message part way through being streamed, or NULL. Nothing else
+	 *  can be sent on the connection until it is finished. */
+	char *stream;
+	struct msg_ctx *stream_ctx; /* Context it was sent from, or NULL. */
+};
+
+struct cdt_browser;
+
+/** A DevTools page session, running its own command instance. */
+struct cdt_session {
+	/** The session's own connection. When the session is reached through
+	 *  the browser, only the message context is used. */
+	struct cdt_conn conn;
+
+	struct cdt_browser *browser; /* Browser connection, or NULL. */
+	char *session_id;  /* Flattened session ID, once attached. */
+	size_t session_id_len;
+
+	void *cmd_pw;
+	char *path;
+
+	/* What the path was found from. */
+	const char *display;
+	const char *host;
+	int port;
+	bool path_cached; /* Whether the path came from the display cache. */
+
+	/* Reconnection after losing the connection. */
+	unsigned reconnect_max;      /* Attempts allowed, after each loss. */
+	unsigned reconnects;         /* Attempts since last connected. */
+	unsigned reconnect_delay_ms; /* Delay before the next attempt. */
+	bool reconnecting;           /* Waiting for the next attempt. */
+	bool resubscribe;            /* Command must resubscribe to events. */
+	struct timespec time_lost;   /* Time of the next attempt's delay. */
+
+	bool active;   /* Whether the command is still running. */
+	bool complete; /* Whether the command ran to completion. */
+
+	struct timespec time_start;     /* Time connection was started. */
+	struct timespec time_connected; /* Time session was established. */
+	struct timespec time_response;  /* Time first message arrived. */
+	struct timespec time_end;       /* Time command finished. */
+};
+
+/** A connection to the browser, shared by flattened page sessions. */
+struct cdt_browser {
+	struct cdt_conn conn;
+	char *path;
+
+	struct cdt_session *sessions;
+	unsigned count;
+	unsigned next; /* Index of the next session to send from. */
+
+	/** Hash table of attached sessions, keyed by session ID. */
+	struct cdt_session **route;
+	unsigned route_size;
+};
+
+/** Top level fields of a received message. */
+struct cdt_msg_info {
+	bool browser; /* Whether to look for a session ID. */
+
+	bool has_id;
+	int id;
+	const char *method;
+	size_t method_len;
+	const char *session_id;
+	size_t session_id_len;
 };
 
-static struct cdt_ctx cdt_g;
+/** Delay before the first attempt to reconnect a lost connection. */
+#define CDT_RECONNECT_DELAY_MIN_MS 250
+
+/** Longest delay between attempts to reconnect a lost connection. */
+#define CDT_RECONNECT_DELAY_MAX_MS 8000
+
+/** Time to wait for lws events, while the daemon waits for clients. */
+#define CDT_DAEMON_POLL_MS 20
+
+static struct cdt_ctx {
+	bool interrupted;
+	struct lws_context *context;
+	struct timer_wheel *timers;
+
+	/** Time the process started, or the daemon's request arrived. */
+	struct timespec time_start;
+} cdt_g;
+
+static bool cdt_time_set(const struct timespec *t)
+{
+	return t->tv_sec != 0 || t->tv_nsec != 0;
+}
+
+static uint32_t cdt_route__hash(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static bool cdt_route_init(struct cdt_browser *browser)
+{
+	unsigned size = 4;
+
+	/* Keep the table at most half full. */
+	while (size < browser->count * 2) {
+		size *= 2;
+	}
+
+	browser->route = calloc(size, sizeof(*browser->route));
+	if (browser->route == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	browser->route_size = size;
+	return true;
+}
+
+static void cdt_route_add(struct cdt_browser *browser,
+		struct cdt_session *session)
+{
+	unsigned mask = browser->route_size - 1;
+	unsigned i = cdt_route__hash(session->session_id,
+			session->session_id_len) & mask;
+
+	while (browser->route[i] != NULL) {
+		i = (i + 1) & mask;
+	}
+
+	browser->route[i] = session;
+}
+
+/**
+ * Find an attached session by its session ID.
+ *
+ * \param[in] browser     The browser connection.
+ * \param[in] session_id  The session ID to look up.
+ * \param[in] len         Length of session_id in bytes.
+ * \return the session, or NULL if there is none with the given ID.
+ */
+static struct cdt_session *cdt_route_find(const struct cdt_browser *browser,
+		const char *session_id, size_t len)
+{
+	unsigned mask = browser->route_size - 1;
+	unsigned i = cdt_route__hash(session_id, len) & mask;
+
+	while (browser->route[i] != NULL) {
+		struct cdt_session *session = browser->route[i];
 
-static bool cdt_send_msg(struct lws *wsi)
+		if (session->session_id_len == len &&
+		    memcmp(session->session_id, session_id, len) == 0) {
+			return session;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * Write the next message waiting in a message context.
+ *
+ * \param[in] conn     The connection to write on.
+ * \param[in] wsi      The websocket to write to.
+ * \param[in] msg_ctx  The message context to send from.
+ * \return true if a message was written, false otherwise.
+ */
+static bool cdt_write_msg(struct cdt_conn *conn, struct lws *wsi,
+		struct msg_ctx *msg_ctx)
 {
-	char *msg = msg_queue_pop(msg_queue_get_send());
+	char *msg = msg_queue_pop_send(msg_ctx);
 	size_t len;
 
 	if (msg == NULL) {
-		return true;
+		return false;
 	}
 
 	len = msg_get_len(msg);
 
+	if (msg_is_streamed(msg)) {
+		/* Only the start; the rest follows in fragments. */
+		cdt_log(CDT_LOG_INFO, "Streaming: %s...", msg);
+		lws_write(wsi, (unsigned char *)msg, len,
+				LWS_WRITE_TEXT | LWS_WRITE_NO_FIN);
+		conn->stream = msg;
+		conn->stream_ctx = msg_ctx;
+		return true;
+	}
+
 	cdt_log(CDT_LOG_INFO, "Sending: %s", msg);
 	lws_write(wsi, (unsigned char *)msg, len, LWS_WRITE_TEXT);
-	msg_queue_push(msg_queue_get_sent(), msg);
+	msg_queue_push_sent(msg_ctx, msg);
+
+	return true;
+}
+
+/**
+ * Write the next fragment of the message being streamed on a connection.
+ *
+ * If the message can't be finished, it is abandoned, and the connection
+ * must be closed, since it is part way through the message.
+ *
+ * \param[in] conn  The connection to write on.
+ * \param[in] wsi   The websocket to write to.
+ * \return true on success, false if the connection must be closed.
+ */
+static bool cdt_write_stream(struct cdt_conn *conn, struct lws *wsi)
+{
+	enum msg_stream_state state;
+	size_t len;
+	char *data;
+
+	state = msg_stream_next(conn->stream, &data, &len);
+	if (state == MSG_STREAM_ERROR) {
+		cdt_log(CDT_LOG_ERROR, "Abandoned partly sent message");
+		if (conn->stream_ctx != NULL) {
+			msg_abort(conn->stream_ctx, conn->stream);
+		} else {
+			msg_destroy(conn->stream);
+		}
+		conn->stream = NULL;
+		conn->stream_ctx = NULL;
+		return false;
+	}
+
+	lws_write(wsi, (unsigned char *)data, len,
+			(state == MSG_STREAM_LAST) ?
+			LWS_WRITE_CONTINUATION :
+			LWS_WRITE_CONTINUATION | LWS_WRITE_NO_FIN);
+	if (state != MSG_STREAM_LAST) {
+		return true;
+	}
+
+	if (conn->stream_ctx != NULL) {
+		msg_queue_push_sent(conn->stream_ctx, conn->stream);
+	} else {
+		/* Its context has gone, so nothing wants the response. */
+		msg_destroy(conn->stream);
+	}
+
+	conn->stream = NULL;
+	conn->stream_ctx = NULL;
+	return true;
+}
+
+/**
+ * Drop a message that was part way through being streamed.
+ *
+ * It can't be sent again, so it is abandoned like a dropped message that
+ * was fully sent, and the command hears that no response is coming.
+ *
+ * \param[in] conn  The connection the message was being sent on.
+ */
+static void cdt_conn_drop_stream(struct cdt_conn *conn)
+{
+	if (conn->stream != NULL) {
+		char *stream = conn->stream;
+		struct msg_ctx *stream_ctx = conn->stream_ctx;
+
+		cdt_log(CDT_LOG_NOTICE, "Dropped partly sent message");
+		conn->stream = NULL;
+		conn->stream_ctx = NULL;
+
+		if (stream_ctx != NULL) {
+			msg_abort(stream_ctx, stream);
+		} else {
+			/* Its context has gone, so nothing wants to know. */
+			msg_destroy(stream);
+		}
+	}
+}
+
+static bool cdt_browser_send_pending(const struct cdt_browser *browser)
+{
+	if (browser->conn.stream != NULL ||
+	    msg_queue_can_send(browser->conn.msg)) {
+		return true;
+	}
+
+	for (unsigned i = 0; i < browser->count; i++) {
+		const struct cdt_session *session = &browser->sessions[i];
+
+		if (session->session_id != NULL &&
+		    msg_queue_can_send(session->conn.msg)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool cdt_send_msg(struct cdt_conn *conn, struct lws *wsi)
+{
+	struct cdt_browser *browser;
+	bool pending;
+
+	if (conn->stream != NULL) {
+		if (!cdt_write_stream(conn, wsi)) {
+			return false;
+		}
+		pending = true;
+
+	} else if (conn->type == CDT_CONN_SESSION) {
+		cdt_write_msg(conn, wsi, conn->msg);
+		pending = conn->stream != NULL ||
+				msg_queue_can_send(conn->msg);
+
+	} else {
+		browser = (struct cdt_browser *)conn;
+
+		/* Browser level messages go first, then the attached
+		 * sessions take turns. */
+		if (!cdt_write_msg(conn, wsi, browser->conn.msg)) {
+			for (unsigned i = 0; i < browser->count; i++) {
+				unsigned n = (browser->next + i) %
+						browser->count;
+				struct cdt_session *session =
+						&browser->sessions[n];
+
+				if (session->session_id == NULL) {
+					continue;
+				}
+
+				if (cdt_write_msg(conn, wsi,
+						session->conn.msg)) {
+					browser->next = n + 1;
+					break;
+				}
+			}
+		}
+		pending = cdt_browser_send_pending(browser);
+	}
+
+	if (pending) {
+		lws_callback_on_writable(wsi);
+	}
 
 	return true;
 }
@@ -56,48 +398,264 @@ static bool cdt_msg_scan_cb(
 		const struct msg_scan_spec *key,
 		const union  msg_scan_data *value)
 {
+	struct cdt_msg_info *info = pw;
+
 	assert(key != NULL);
 	assert(value != NULL);
 
-	CDT_UNUSED(pw);
-
 	if (key->type == MSG_SCAN_TYPE_INTEGER &&
 			strcmp(key->key, "id") == 0) {
-		int id = (int)value->integer;
+		info->has_id = true;
+		info->id = (int)value->integer;
+
+	} else if (key->type == MSG_SCAN_TYPE_STRING &&
+			strcmp(key->key, "method") == 0) {
+		info->method = value->string.str;
+		info->method_len = value->string.len;
+
+	} else if (key->type == MSG_SCAN_TYPE_STRING &&
+			strcmp(key->key, "sessionId") == 0) {
+		info->session_id = value->string.str;
+		info->session_id_len = value->string.len;
+		return true;
+	}
+
+	/* Messages on a page connection have no session ID to wait for. */
+	return !info->browser;
+}
+
+static bool cdt_session__node_id_scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	CDT_UNUSED(key);
+
+	*(int64_t *)pw = value->integer;
+	return true;
+}
+
+/**
+ * Update a session's located elements from a DOM event.
+ *
+ * \param[in] session  The session the event is for.
+ * \param[in] info     The event's top level fields.
+ * \param[in] data     The event.
+ * \param[in] len      Length of the event in bytes.
+ */
+static void cdt_session__locate_evt(struct cdt_session *session,
+		const struct cdt_msg_info *info,
+		const char *data, size_t len)
+{
+	static const struct msg_scan_spec spec = {
+		.key = "nodeId",
+		.type = MSG_SCAN_TYPE_INTEGER,
+		.depth = 2,
+	};
+	struct locate_cache *cache;
+	int64_t node_id = 0;
+
+	cache = msg_ctx_get_locate(session->conn.msg);
+	if (cache == NULL) {
+		return;
+	}
+
+	if (strncmp(info->method, "DOM.documentUpdated",
+			info->method_len) == 0) {
+		locate_cache_clear(cache);
+
+	} else if (strncmp(info->method, "DOM.childNodeRemoved",
+			info->method_len) == 0) {
+		msg_str_scan(data, len, &spec, 1,
+				cdt_session__node_id_scan_cb, &node_id);
+		if (node_id > 0 && node_id <= INT32_MAX) {
+			locate_cache_remove_node(cache, (int)node_id);
+		}
+
+	} else if (strncmp(info->method, "DOM.childNodeInserted",
+			info->method_len) == 0 ||
+		    strncmp(info->method, "DOM.attributeModified",
+			info->method_len) == 0 ||
+		    strncmp(info->method, "DOM.attributeRemoved",
+			info->method_len) == 0) {
+		/* The new node, or changed attribute, may match any of the
+		 * selectors, or stop a node matching. */
+		locate_cache_forget_matches(cache);
+	}
+}
+
+/**
+ * Let a session handle a received message.
+ *
+ * \param[in] session  The session the message is for.
+ * \param[in] info     The message's top level fields.
+ * \param[in] data     The message.
+ * \param[in] len      Length of the message in bytes.
+ */
+static void cdt_session_dispatch(struct cdt_session *session,
+		const struct cdt_msg_info *info,
+		const char *data, size_t len)
+{
+	if (session->active && !cdt_time_set(&session->time_response)) {
+		clock_gettime(CLOCK_MONOTONIC, &session->time_response);
+	}
+
+	if (info->has_id) {
 		char *msg_sent;
 
-		msg_sent = msg_queue_find_by_id(msg_queue_get_sent(), id);
+		msg_sent = msg_queue_take_sent(session->conn.msg, info->id);
 		if (msg_sent == NULL) {
 			cdt_log(CDT_LOG_ERROR,
 					"%s: Failed to find sent message: %i",
-					__func__, id);
-		} else {
-			msg_queue_remove(msg_queue_get_sent(), msg_sent);
-			msg_destroy(msg_sent);
+					__func__, info->id);
 		}
 
-		cmd_msg(cdt_g.cmd_pw, id,
-				cdt_g.multipart_msg.data,
-				cdt_g.multipart_msg.len);
+		if (session->active && !msg_complete(msg_sent, data, len)) {
+			cmd_msg(session->cmd_pw, info->id, data, len);
+		}
+		msg_destroy(msg_sent);
 
-		return true;
+	} else if (info->method != NULL) {
+		/* Keep located elements up to date between commands, too. */
+		cdt_session__locate_evt(session, info, data, len);
 
-	} else if (key->type == MSG_SCAN_TYPE_STRING &&
-			strcmp(key->key, "method") == 0) {
-		cmd_evt(cdt_g.cmd_pw,
-				value->string.str,
-				value->string.len,
-				cdt_g.multipart_msg.data,
-				cdt_g.multipart_msg.len);
-		return true;
+		if (session->active) {
+			cmd_evt(session->cmd_pw,
+					info->method,
+					info->method_len,
+					data, len);
+		}
 	}
+}
 
-	return false;
+static bool cdt_session_id_scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	struct cdt_msg_info *info = pw;
+
+	CDT_UNUSED(key);
+
+	info->session_id = value->string.str;
+	info->session_id_len = value->string.len;
+	return true;
+}
+
+/**
+ * Get the session ID from a browser level message's parameters or result.
+ *
+ * \param[in]  data  The message.
+ * \param[in]  len   Length of the message in bytes.
+ * \param[out] info  Returns the session ID, if found.
+ */
+static void cdt_browser__scan_session_id(const char *data, size_t len,
+		struct cdt_msg_info *info)
+{
+	static const struct msg_scan_spec spec[] = {
+		{
+			.key = "sessionId",
+			.type = MSG_SCAN_TYPE_STRING,
+			.depth = 2,
+		},
+	};
+
+	info->session_id = NULL;
+	msg_str_scan(data, len, spec, CDT_ARRAY_COUNT(spec),
+			cdt_session_id_scan_cb, info);
 }
 
-static bool cdt_rec_msg(const char *msg_rec, size_t len)
+static void cdt_session_end(struct cdt_session *session, bool complete);
+
+/**
+ * Handle the response to attaching a session to its page's target.
+ *
+ * \param[in] pw    The session.
+ * \param[in] id    Id of the Target.attachToTarget message.
+ * \param[in] data  The response.
+ * \param[in] len   Length of the response in bytes.
+ */
+static void cdt_browser_attached(void *pw, int id,
+		const char *data, size_t len)
+{
+	struct cdt_session *session = pw;
+	struct cdt_msg_info info;
+
+	CDT_UNUSED(id);
+
+	if (data == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: No response to attach",
+				session->path);
+		cdt_session_end(session, false);
+		return;
+	}
+
+	cdt_browser__scan_session_id(data, len, &info);
+	if (info.session_id == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Failed to attach: %.*s",
+				session->path, (int)len, data);
+		cdt_session_end(session, false);
+		return;
+	}
+
+	session->session_id = strndup(info.session_id, info.session_id_len);
+	if (session->session_id == NULL ||
+	    !msg_ctx_set_session(session->conn.msg,
+			info.session_id, info.session_id_len)) {
+		cdt_log(CDT_LOG_ERROR, "%s: Failed to set up session",
+				session->path);
+		cdt_session_end(session, false);
+		return;
+	}
+	session->session_id_len = info.session_id_len;
+
+	cdt_route_add(session->browser, session);
+	clock_gettime(CLOCK_MONOTONIC, &session->time_connected);
+
+	cdt_log(CDT_LOG_NOTICE, "%s: Attached as session %s",
+			session->path, session->session_id);
+}
+
+/**
+ * Handle a message on the browser connection that isn't for a session.
+ *
+ * \param[in] browser  The browser connection.
+ * \param[in] info     The message's top level fields.
+ * \param[in] data     The message.
+ * \param[in] len      Length of the message in bytes.
+ */
+static void cdt_browser_dispatch(struct cdt_browser *browser,
+		const struct cdt_msg_info *info,
+		const char *data, size_t len)
+{
+	if (info->has_id) {
+		char *msg_sent;
+
+		msg_sent = msg_queue_take_sent(browser->conn.msg, info->id);
+		msg_complete(msg_sent, data, len);
+		msg_destroy(msg_sent);
+
+	} else if (info->method != NULL && strncmp(info->method,
+			"Target.detachedFromTarget", info->method_len) == 0) {
+		struct cdt_session *session;
+		struct cdt_msg_info detached;
+
+		cdt_browser__scan_session_id(data, len, &detached);
+		if (detached.session_id == NULL) {
+			return;
+		}
+
+		session = cdt_route_find(browser, detached.session_id,
+				detached.session_id_len);
+		if (session != NULL) {
+			cdt_log(CDT_LOG_NOTICE, "%s: Detached", session->path);
+			cdt_session_end(session, false);
+		}
+	}
+}
+
+static void cdt_handle_msg(struct cdt_conn *conn, const char *data, size_t len)
 {
-	enum msg_scan scan;
 	static const struct msg_scan_spec spec[] = {
 		{
 			.key = "id",
@@ -109,37 +667,77 @@ static bool cdt_rec_msg(const char *msg_rec, size_t len)
 			.type = MSG_SCAN_TYPE_STRING,
 			.depth = 1,
 		},
+		{
+			.key = "sessionId",
+			.type = MSG_SCAN_TYPE_STRING,
+			.depth = 1,
+		},
 	};
+	struct cdt_msg_info info = {
+		.browser = (conn->type == CDT_CONN_BROWSER),
+	};
+	struct cdt_browser *browser;
+	struct cdt_session *session;
+
+	if (!msg_str_scan(data, len, spec, CDT_ARRAY_COUNT(spec),
+			cdt_msg_scan_cb, &info)) {
+		cdt_log(CDT_LOG_ERROR, "%s: Failed to scan message: %*s",
+				__func__, (int)len, data);
+		return;
+	}
+
+	if (conn->type == CDT_CONN_SESSION) {
+		cdt_session_dispatch((struct cdt_session *)conn,
+				&info, data, len);
+		return;
+	}
 
-	scan = msg_str_chunk_scan(msg_rec, len);
+	browser = (struct cdt_browser *)conn;
+	if (info.session_id == NULL) {
+		cdt_browser_dispatch(browser, &info, data, len);
+		return;
+	}
+
+	session = cdt_route_find(browser, info.session_id,
+			info.session_id_len);
+	if (session == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Unknown session: %.*s",
+				__func__, (int)info.session_id_len,
+				info.session_id);
+		return;
+	}
+
+	cdt_session_dispatch(session, &info, data, len);
+}
+
+static bool cdt_rec_msg(struct cdt_conn *conn,
+		const char *msg_rec, size_t len)
+{
+	enum msg_scan scan;
+
+	scan = msg_str_chunk_scan(conn->msg, msg_rec, len);
 
 	switch (scan) {
 	case MSG_SCAN_ERROR:
 		cdt_log(CDT_LOG_ERROR, "%s: Failed to scan message: %*s",
 				__func__, (int)len, msg_rec);
-		cdt_buffer_clear(&cdt_g.multipart_msg);
+		cdt_buffer_clear(&conn->multipart_msg);
 		return false;
 
 	case MSG_SCAN_COMPLETE:
-		if (!cdt_buffer_append(&cdt_g.multipart_msg, msg_rec, len)) {
+		if (!cdt_buffer_append(&conn->multipart_msg, msg_rec, len)) {
 			return false;
 		}
 
-		if (!msg_str_scan(
-				cdt_g.multipart_msg.data,
-				cdt_g.multipart_msg.len,
-				spec, CDT_ARRAY_COUNT(spec),
-				cdt_msg_scan_cb, NULL)) {
-			cdt_log(CDT_LOG_ERROR,
-					"%s: Failed to scan message: %*s",
-					__func__, (int)len, msg_rec);
-		}
+		cdt_handle_msg(conn,
+				conn->multipart_msg.data,
+				conn->multipart_msg.len);
 
-		cdt_buffer_clear(&cdt_g.multipart_msg);
+		cdt_buffer_clear(&conn->multipart_msg);
 		break;
 
 	case MSG_SCAN_CONTINUE:
-		if (!cdt_buffer_append(&cdt_g.multipart_msg, msg_rec, len)) {
+		if (!cdt_buffer_append(&conn->multipart_msg, msg_rec, len)) {
 			return false;
 		}
 		break;
@@ -151,28 +749,56 @@ static bool cdt_rec_msg(const char *msg_rec, size_t len)
 static int devtools_cb(struct lws *wsi, enum lws_callback_reasons reason,
 		void *user, void *in, size_t len)
 {
-	(void)(user);
+	struct cdt_conn *conn = user;
 
 	switch (reason) {
 	case LWS_CALLBACK_CLIENT_ESTABLISHED:
 		cdt_log(CDT_LOG_NOTICE, "Connected");
+		if (conn->type == CDT_CONN_SESSION) {
+			struct cdt_session *session = user;
+
+			if (!cdt_time_set(&session->time_connected)) {
+				clock_gettime(CLOCK_MONOTONIC,
+						&session->time_connected);
+			}
+
+			session->reconnects = 0;
+			if (session->resubscribe) {
+				session->resubscribe = false;
+				if (session->active) {
+					cmd_reconnect(session->cmd_pw);
+				}
+			}
+		}
 		lws_callback_on_writable(wsi);
 		break;
 
 	case LWS_CALLBACK_CLIENT_RECEIVE:
-		cdt_rec_msg(in, len);
+		cdt_rec_msg(conn, in, len);
 		break;
 
 	case LWS_CALLBACK_CLIENT_WRITEABLE:
-		cdt_send_msg(wsi);
+		if (!cdt_send_msg(conn, wsi)) {
+			/* Close the connection, rather than leave it part
+			 * way through a message. */
+			return -1;
+		}
 		break;
 
 	case LWS_CALLBACK_CLOSED:
 	case LWS_CALLBACK_CLIENT_CLOSED:
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 		cdt_log(CDT_LOG_NOTICE, "Disconnected");
-		cdt_g.web_socket = NULL;
-		break;
+		if (conn != NULL) {
+			conn->web_socket = NULL;
+			cdt_conn_drop_stream(conn);
+
+			/* Reconnect to the host's next address, if any. */
+			if (conn->host != NULL) {
+				display_address_failed(conn->host);
+			}
+		}
+		break;
 
 	default:
 		break;
@@ -184,6 +810,7 @@ static int devtools_cb(struct lws *wsi, enum lws_callback_reasons reason,
 enum protocols
 {
 	PROTOCOL_DEVTOOLS,
+	PROTOCOL_HTTP,
 	PROTOCOL_NULL,
 	PROTOCOL_COUNT
 };
@@ -194,6 +821,10 @@ static struct lws_protocols protocols[PROTOCOL_COUNT] =
 		.name = "devtools",
 		.callback = devtools_cb,
 	},
+	{
+		.name = DISPLAY_PROTOCOL_NAME,
+		.callback = display_http_cb,
+	},
 };
 
 static void sigint_handler(int sig)
@@ -202,16 +833,249 @@ static void sigint_handler(int sig)
 	cdt_g.interrupted = true;
 }
 
-static bool cdt_tick_cmd(void *cmd_pw)
+static bool cdt_tick_cmd(struct cdt_session *session)
 {
-	if (msg_queue_get_send()->head != NULL) {
-		return true;
+	return cmd_tick(session->cmd_pw,
+			msg_queue_backpressure(session->conn.msg));
+}
+
+static void cdt_log_queue_stats(const struct cdt_session *session)
+{
+	static const char *const prio_name[] = {
+		[MSG_PRIO_INPUT]   = "input",
+		[MSG_PRIO_CONTROL] = "control",
+		[MSG_PRIO_BULK]    = "bulk",
+	};
+
+	const struct msg_window_stats *window;
+
+	window = msg_queue_get_window_stats(session->conn.msg);
+	cdt_log(CDT_LOG_INFO, "%s: Send window: peak %u in flight, "
+			"peak %u queued, %u stalls, stalled %" PRIi64 " us, "
+			"max %" PRIi64 " us",
+			session->path, window->sent_max, window->queued_max,
+			window->stalls, window->stall_total_us,
+			window->stall_max_us);
+
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		const struct msg_queue_stats *stats;
+
+		stats = msg_queue_get_send_stats(session->conn.msg, i);
+		if (stats->sent == 0) {
+			continue;
+		}
+
+		cdt_log(CDT_LOG_INFO, "%s: Send queue %s: %u sent, "
+				"wait avg %" PRIi64 " us, max %" PRIi64 " us",
+				session->path, prio_name[i], stats->sent,
+				stats->wait_total_us / stats->sent,
+				stats->wait_max_us);
 	}
+}
 
-	return cmd_tick(cmd_pw);
+/**
+ * Log how long the session took to get going.
+ *
+ * Times are from the process start, or the daemon request, to discovery
+ * being done, the websocket handshake, and the first message received.
+ *
+ * \param[in] session  The session to log timing for.
+ */
+static void cdt_log_timing(const struct cdt_session *session)
+{
+	if (!cdt_time_set(&session->time_response)) {
+		return;
+	}
+
+	cdt_log(CDT_LOG_INFO, "%s: Discovery %" PRIi64 " ms, "
+			"handshake %" PRIi64 " ms, "
+			"first response %" PRIi64 " ms",
+			session->path,
+			time_diff_ms(&cdt_g.time_start, &session->time_start),
+			time_diff_ms(&cdt_g.time_start,
+					&session->time_connected),
+			time_diff_ms(&cdt_g.time_start,
+					&session->time_response));
 }
 
-static void cdt_run(struct lws_context *context,
+/**
+ * Handle a session's message getting no response in time.
+ *
+ * \param[in] pw  The session.
+ * \param[in] id  Id of the message.
+ */
+static void cdt_session_timeout(void *pw, int id)
+{
+	struct cdt_session *session = pw;
+
+	if (!session->active) {
+		return;
+	}
+
+	cdt_log(CDT_LOG_WARNING, "%s: No response to message %i",
+			session->path, id);
+
+	if (!cmd_timeout(session->cmd_pw, id)) {
+		cdt_log(CDT_LOG_ERROR, "%s: Timed out", session->path);
+		cdt_session_end(session, false);
+	}
+}
+
+/**
+ * Create a session's message context and command instance.
+ *
+ * \param[in] session  The session to initialise.
+ * \param[in] argc     Number of command line arguments.
+ * \param[in] argv     String vector containing command line arguments.
+ * \param[in] options  Common command options.
+ * \return true on success, false otherwise.
+ */
+static bool cdt_session_init(struct cdt_session *session,
+		int argc, const char **argv,
+		struct cmd_options *options)
+{
+	session->conn.type = CDT_CONN_SESSION;
+	session->conn.msg = msg_ctx_create();
+	if (session->conn.msg == NULL) {
+		return false;
+	}
+
+	if (!cmd_init(argc, argv, options,
+			session->conn.msg, &session->cmd_pw)) {
+		msg_ctx_destroy(session->conn.msg);
+		session->conn.msg = NULL;
+		return false;
+	}
+
+	session->reconnect_max = (unsigned)options->reconnect;
+	msg_queue_set_window(session->conn.msg, (unsigned)options->window);
+	msg_ctx_set_timeout(session->conn.msg, cdt_g.timers,
+			(unsigned)options->timeout,
+			cdt_session_timeout, session);
+	session->active = true;
+	return true;
+}
+
+/**
+ * Finish a session's command.
+ *
+ * \param[in] session   The session to finish.
+ * \param[in] complete  Whether the command ran to completion.
+ */
+static void cdt_session_end(struct cdt_session *session, bool complete)
+{
+	if (!session->active) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &session->time_end);
+	session->active = false;
+	session->complete = complete;
+
+	cmd_fini(session->cmd_pw);
+	session->cmd_pw = NULL;
+}
+
+/**
+ * Release a session's resources.
+ *
+ * \param[in] session  The session to finalise.
+ */
+static void cdt_session_fini(struct cdt_session *session)
+{
+	cdt_session_end(session, false);
+	msg_ctx_destroy(session->conn.msg);
+	cdt_buffer_delete(&session->conn.multipart_msg);
+	msg_destroy(session->conn.stream);
+	free(session->session_id);
+	free(session->path);
+}
+
+static void cdt_sessions_destroy(struct cdt_session *sessions, unsigned count)
+{
+	if (sessions == NULL) {
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		cdt_session_fini(&sessions[i]);
+	}
+
+	free(sessions);
+}
+
+/**
+ * Set up a browser connection for sessions to be reached through.
+ *
+ * \param[in] browser     The browser connection to initialise.
+ * \param[in] sessions    Array of sessions to attach.
+ * \param[in] count       Number of sessions.
+ * \param[in] host        Hostname for Chrome DevTools.
+ * \param[in] port        Port for Chrome DevTools.
+ * \param[in] timeout_ms  Time to wait for each response, or 0 for ever.
+ * \return true on success, false otherwise.
+ */
+static bool cdt_browser_init(struct cdt_browser *browser,
+		struct cdt_session *sessions, unsigned count,
+		const char *host, int port, int64_t timeout_ms)
+{
+	browser->conn.type = CDT_CONN_BROWSER;
+	browser->sessions = sessions;
+	browser->count = count;
+
+	browser->path = display_get_browser_path(host, port);
+	if (browser->path == NULL) {
+		cdt_log(CDT_LOG_ERROR, "Failed to get browser path");
+		return false;
+	}
+
+	browser->conn.msg = msg_ctx_create();
+	if (browser->conn.msg == NULL) {
+		return false;
+	}
+
+	/* An attach that times out is failed by its response callback. */
+	msg_ctx_set_timeout(browser->conn.msg, cdt_g.timers,
+			(unsigned)timeout_ms, NULL, NULL);
+
+	if (!cdt_route_init(browser)) {
+		return false;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		struct cdt_session *session = &sessions[i];
+
+		session->browser = browser;
+		if (!msg_queue_for_send(browser->conn.msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_ATTACH_TO_TARGET,
+				.response = cdt_browser_attached,
+				.pw = session,
+				.data = {
+					.attach_to_target = {
+						.target_id = str_get_leaf(
+							session->path),
+					},
+				},
+			}, NULL)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void cdt_browser_fini(struct cdt_browser *browser)
+{
+	msg_ctx_destroy(browser->conn.msg);
+	cdt_buffer_delete(&browser->conn.multipart_msg);
+	msg_destroy(browser->conn.stream);
+	free(browser->route);
+	free(browser->path);
+}
+
+static void cdt_connect(struct lws_context *context,
+		struct cdt_conn *conn,
 		const char *path,
 		const char *host,
 		int port)
@@ -219,61 +1083,826 @@ static void cdt_run(struct lws_context *context,
 	struct lws_client_connect_info ccinfo = {
 		.port = port,
 		.path = path,
-		.address = host,
+		.address = display_get_address(host),
 		.origin = "origin",
 		.context = context,
 		.host = lws_canonical_hostname(context),
 		.protocol = protocols[PROTOCOL_DEVTOOLS].name,
+		.userdata = conn,
 	};
 
-	cdt_g.web_socket = lws_client_connect_via_info(&ccinfo);
+	cdt_log(CDT_LOG_NOTICE, "Using %s as display path", path);
+
+	conn->host = host;
+	conn->web_socket = lws_client_connect_via_info(&ccinfo);
+}
+
+/**
+ * Find a session's page again, for a new connection.
+ *
+ * \param[in] session  The session to find the page for.
+ * \return true on success, false otherwise.
+ */
+static bool cdt_session__find_page(struct cdt_session *session)
+{
+	char *path;
+
+	if (session->display == NULL || session->display[0] == '/') {
+		/* Given a path rather than a title; nothing to find. */
+		return true;
+	}
+
+	display_forget_path(session->display, session->host, session->port);
+	path = display_get_path(session->display, session->host,
+			session->port, &session->path_cached);
+	if (path == NULL) {
+		cdt_log(CDT_LOG_ERROR, "Failed to find display: %s",
+				session->display);
+		return false;
+	}
+
+	free(session->path);
+	session->path = path;
+	return true;
+}
+
+/**
+ * Try to get a session connected again, after losing its connection.
+ *
+ * If a cached path fails to connect at all, the page is found again
+ * straight away. Otherwise reconnection is attempted with exponential
+ * backoff, finding the page again before each attempt.
+ *
+ * \param[in] session  The session to reconnect.
+ * \return true if the session is reconnecting, false to give up.
+ */
+static bool cdt_session_reconnect(struct cdt_session *session)
+{
+	struct timespec now;
+
+	if (session->browser != NULL) {
+		return false;
+	}
+
+	if (session->path_cached && !cdt_time_set(&session->time_connected)) {
+		cdt_log(CDT_LOG_NOTICE, "Cached path %s failed, "
+				"rediscovering %s",
+				session->path, session->display);
+		if (!cdt_session__find_page(session)) {
+			return false;
+		}
+
+		session->path_cached = false;
+		cdt_connect(cdt_g.context, &session->conn, session->path,
+				session->host, session->port);
+		return session->conn.web_socket != NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!session->reconnecting) {
+		if (session->reconnects >= session->reconnect_max) {
+			return false;
+		}
+
+		/* Double the delay for each attempt, stopping at the maximum
+		 * rather than shifting by an unbounded attempt count. */
+		session->reconnect_delay_ms = CDT_RECONNECT_DELAY_MIN_MS;
+		for (unsigned i = 0; i < session->reconnects &&
+				session->reconnect_delay_ms <
+				CDT_RECONNECT_DELAY_MAX_MS; i++) {
+			session->reconnect_delay_ms *= 2;
+		}
+		if (session->reconnect_delay_ms > CDT_RECONNECT_DELAY_MAX_MS) {
+			session->reconnect_delay_ms =
+					CDT_RECONNECT_DELAY_MAX_MS;
+		}
 
-	while (cdt_g.interrupted == false && cdt_g.web_socket != NULL) {
+		cdt_log(CDT_LOG_NOTICE, "%s: Reconnecting in %u ms "
+				"(attempt %u of %u)",
+				session->path, session->reconnect_delay_ms,
+				session->reconnects + 1,
+				session->reconnect_max);
+
+		session->time_lost = now;
+		session->reconnecting = true;
+		return true;
+	}
+
+	if (time_diff_ms(&session->time_lost, &now) <
+			session->reconnect_delay_ms) {
+		return true;
+	}
+
+	session->reconnecting = false;
+	session->reconnects++;
+
+	if (!cdt_session__find_page(session)) {
+		/* Try again later, if there are attempts left. */
+		return true;
+	}
+
+	/* Dropped messages go to the command's timeout handler, which may
+	 * end the session if it can't do without their responses. */
+	if (msg_ctx_reconnect(session->conn.msg) > 0 && !session->active) {
+		return false;
+	}
+	cdt_buffer_clear(&session->conn.multipart_msg);
+	session->resubscribe = true;
+
+	cdt_connect(cdt_g.context, &session->conn, session->path,
+			session->host, session->port);
+	return true;
+}
+
+/**
+ * Get whether a session's message is part way through being streamed.
+ *
+ * \param[in] session  The session to check.
+ * \return true if the session's connection is streaming its message.
+ */
+static bool cdt_session__streaming(const struct cdt_session *session)
+{
+	const struct cdt_conn *conn = &session->conn;
+
+	if (session->browser != NULL) {
+		conn = &session->browser->conn;
+	}
+
+	return conn->stream != NULL && conn->stream_ctx == session->conn.msg;
+}
+
+/**
+ * Tick a session.
+ *
+ * \param[in] session  The session to tick.
+ * \return true if the session is still active, false otherwise.
+ */
+static bool cdt_session_tick(struct cdt_session *session)
+{
+	struct lws *wsi = session->conn.web_socket;
+	bool cmd_continue;
+	bool need_send;
+	bool need_resp;
+
+	if (!session->active) {
+		return false;
+	}
+
+	if (session->browser != NULL) {
+		wsi = session->browser->conn.web_socket;
+	}
+
+	if (wsi == NULL) {
+		if (cdt_session_reconnect(session)) {
+			return true;
+		}
+		cdt_session_end(session, false);
+		return false;
+	}
+
+	if (session->browser != NULL && session->session_id == NULL) {
+		/* Not attached yet. */
+		return true;
+	}
+
+	cmd_continue = cdt_tick_cmd(session);
+	need_send = msg_queue_send_count(session->conn.msg) > 0 ||
+			cdt_session__streaming(session);
+	need_resp = msg_queue_get_sent(session->conn.msg)->head != NULL;
+
+	if (!cmd_continue && !need_send && !need_resp) {
+		cdt_session_end(session, true);
+		return false;
+	}
+
+	/* Only wake for writing when there is something to write, so the
+	 * loop can sleep until a response, event or timer is due. */
+	if (msg_queue_can_send(session->conn.msg) ||
+	    cdt_session__streaming(session)) {
+		lws_callback_on_writable(wsi);
+	}
+	return true;
+}
+
+/**
+ * Service the connections until none of the sessions are active.
+ *
+ * \param[in] context   The lws context.
+ * \param[in] browser   Browser connection the sessions use, or NULL.
+ * \param[in] sessions  Array of sessions.
+ * \param[in] count     Number of sessions.
+ */
+static void cdt_service(struct lws_context *context,
+		struct cdt_browser *browser,
+		struct cdt_session *sessions,
+		unsigned count)
+{
+	while (cdt_g.interrupted == false) {
+		unsigned active = 0;
 		int ret;
-		bool cmd_continue = cdt_tick_cmd(cdt_g.cmd_pw);
-		bool need_send = msg_queue_get_send()->head != NULL;
-		bool need_resp = msg_queue_get_sent()->head != NULL;
 
-		if (!cmd_continue && !need_send && !need_resp) {
+		timer_wheel_run(cdt_g.timers);
+
+		for (unsigned i = 0; i < count; i++) {
+			if (cdt_session_tick(&sessions[i])) {
+				active++;
+			}
+		}
+
+		if (active == 0) {
 			break;
 		}
 
-		lws_callback_on_writable(cdt_g.web_socket);
-		ret = lws_service(context, 250);
+		if (browser != NULL && browser->conn.web_socket != NULL &&
+		    cdt_browser_send_pending(browser)) {
+			lws_callback_on_writable(browser->conn.web_socket);
+		}
+
+		ret = lws_service(context,
+				timer_wheel_next_ms(cdt_g.timers, 250));
 		if (ret < 0) {
 			break;
 		}
 	}
+}
+
+static void cdt_run(struct lws_context *context,
+		struct cdt_browser *browser,
+		struct cdt_session *sessions,
+		unsigned count,
+		const char *host,
+		int port)
+{
+	if (browser != NULL) {
+		cdt_connect(context, &browser->conn, browser->path,
+				host, port);
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &sessions[i].time_start);
+		if (browser == NULL) {
+			cdt_connect(context, &sessions[i].conn,
+					sessions[i].path, host, port);
+		}
+	}
+
+	cdt_service(context, browser, sessions, count);
+
+	for (unsigned i = 0; i < count; i++) {
+		cdt_session_end(&sessions[i], false);
+		cdt_log_timing(&sessions[i]);
+		cdt_log_queue_stats(&sessions[i]);
+	}
+}
+
+/** A page connection kept open by the daemon, between requests. */
+struct cdt_daemon_conn {
+	struct cdt_session session;
+
+	/** Scripts compiled in the page, for commands to run again. */
+	struct script_cache *scripts;
+
+	/** Elements located in the page, for commands to find again. */
+	struct locate_cache *locate;
+
+	/* What the connection was found from. */
+	char *display;
+	char *host;
+	int port;
+};
+
+static struct cdt_daemon_ctx {
+	struct cdt_daemon_conn **conn;
+	unsigned conn_count;
+
+	/** Copy of the last request's command line, which commands keep
+	 *  pointers into. Freed when the next request arrives. */
+	char **argv;
+	int argc;
+} cdt_daemon_g;
+
+/** State for a request, while its command is being set up. */
+struct cdt_daemon_request_ctx {
+	struct lws_context *context;
+	struct msg_ctx *msg;
+
+	/** The connection the command is to run on, once known. */
+	struct cdt_daemon_conn *conn;
+};
+
+static void cdt_daemon_conn_destroy(struct cdt_daemon_conn *conn)
+{
+	cdt_session_fini(&conn->session);
+	script_cache_destroy(conn->scripts);
+	locate_cache_destroy(conn->locate);
+	free(conn->display);
+	free(conn->host);
+	free(conn);
+}
+
+/**
+ * Find an open connection for a display.
+ *
+ * Connections that have been closed are dropped.
+ *
+ * \param[in] display  The display the command is for.
+ * \param[in] host     Hostname for Chrome DevTools.
+ * \param[in] port     Port for Chrome DevTools.
+ * \return the connection, or NULL if there isn't one.
+ */
+static struct cdt_daemon_conn *cdt_daemon_find(const char *display,
+		const char *host, int port)
+{
+	struct cdt_daemon_conn *found = NULL;
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < cdt_daemon_g.conn_count; i++) {
+		struct cdt_daemon_conn *conn = cdt_daemon_g.conn[i];
+
+		if (conn->session.conn.web_socket == NULL) {
+			cdt_daemon_conn_destroy(conn);
+			continue;
+		}
+
+		if (found == NULL && conn->port == port &&
+		    strcmp(conn->host, host) == 0 &&
+		    strcmp(conn->display, display) == 0) {
+			found = conn;
+		}
+
+		cdt_daemon_g.conn[count++] = conn;
+	}
+
+	cdt_daemon_g.conn_count = count;
+	return found;
+}
+
+/**
+ * Open a new connection for a display.
+ *
+ * \param[in] context  The lws context.
+ * \param[in] display  The display the command is for.
+ * \param[in] host     Hostname for Chrome DevTools.
+ * \param[in] port     Port for Chrome DevTools.
+ * \return the connection, or NULL on error.
+ */
+static struct cdt_daemon_conn *cdt_daemon_connect(
+		struct lws_context *context,
+		const char *display, const char *host, int port)
+{
+	struct cdt_daemon_conn **conns;
+	struct cdt_daemon_conn *conn;
+
+	conns = realloc(cdt_daemon_g.conn, (cdt_daemon_g.conn_count + 1) *
+			sizeof(*cdt_daemon_g.conn));
+	if (conns == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+	cdt_daemon_g.conn = conns;
+
+	conn = calloc(1, sizeof(*conn));
+	if (conn == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	conn->port = port;
+	conn->host = strdup(host);
+	conn->display = strdup(display);
+	conn->scripts = script_cache_create();
+	conn->locate = locate_cache_create();
+	conn->session.conn.type = CDT_CONN_SESSION;
+	/* Each command brings its own message context, but the connection
+	 * needs one until then, in case the command fails to set up. */
+	conn->session.conn.msg = msg_ctx_create();
+	conn->session.display = conn->display;
+	conn->session.host = conn->host;
+	conn->session.port = port;
+	conn->session.path = display_get_path(display, host, port,
+			&conn->session.path_cached);
+	if (conn->host == NULL || conn->display == NULL ||
+	    conn->scripts == NULL || conn->locate == NULL ||
+	    conn->session.conn.msg == NULL || conn->session.path == NULL) {
+		cdt_log(CDT_LOG_ERROR, "Invalid display: %s", display);
+		cdt_daemon_conn_destroy(conn);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &conn->session.time_start);
+	cdt_connect(context, &conn->session.conn,
+			conn->session.path, host, port);
+	if (conn->session.conn.web_socket == NULL) {
+		cdt_daemon_conn_destroy(conn);
+		return NULL;
+	}
+
+	cdt_daemon_g.conn[cdt_daemon_g.conn_count++] = conn;
+	return conn;
+}
+
+/**
+ * Free the copy of the last request's command line.
+ */
+static void cdt_daemon__free_argv(void)
+{
+	for (int i = 0; i < cdt_daemon_g.argc; i++) {
+		free(cdt_daemon_g.argv[i]);
+	}
+	free(cdt_daemon_g.argv);
+
+	cdt_daemon_g.argv = NULL;
+	cdt_daemon_g.argc = 0;
+}
+
+/**
+ * Copy a request's command line, so it outlives the request.
+ *
+ * \param[in] req  The client's request.
+ * \return true on success, false otherwise.
+ */
+static bool cdt_daemon__copy_argv(const struct control_request *req)
+{
+	cdt_daemon__free_argv();
+
+	cdt_daemon_g.argv = calloc((size_t)req->argc + 1,
+			sizeof(*cdt_daemon_g.argv));
+	if (cdt_daemon_g.argv == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	for (int i = 0; i < req->argc; i++) {
+		cdt_daemon_g.argv[i] = strdup(req->argv[i]);
+		cdt_daemon_g.argc++;
+		if (cdt_daemon_g.argv[i] == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Find or open the connection for a request, once its command line has
+ * been parsed.
+ *
+ * This runs before the command is set up, so that anything the command
+ * sends from its init goes on a message context that continues the
+ * connection's message ids, and uses the connection's caches.
+ *
+ * \param[in] pw       The request's \ref cdt_daemon_request_ctx.
+ * \param[in] options  Common command options parsed from arguments.
+ * \return true on success, false otherwise.
+ */
+static bool cdt_daemon__parsed(void *pw, const struct cmd_options *options)
+{
+	struct cdt_daemon_request_ctx *ctx = pw;
+	struct cdt_daemon_conn *conn;
+
+	cdt_log_set_level(options->log_level);
+	cdt_log_set_target(options->log_target);
+
+	if (options->all || options->browser) {
+		cdt_log(CDT_LOG_ERROR, "Daemon supports single pages only");
+		return false;
+	}
+
+	conn = cdt_daemon_find(options->display,
+			options->host, (int)options->port);
+	if (conn == NULL) {
+		conn = cdt_daemon_connect(ctx->context, options->display,
+				options->host, (int)options->port);
+	} else {
+		cdt_log(CDT_LOG_INFO, "Reusing connection to %s",
+				conn->session.path);
+
+		/* No discovery or handshake needed. */
+		clock_gettime(CLOCK_MONOTONIC, &conn->session.time_start);
+		conn->session.time_connected = conn->session.time_start;
+	}
+
+	if (conn == NULL) {
+		return false;
+	}
+
+	msg_ctx_continue(ctx->msg, conn->session.conn.msg);
+	msg_ctx_set_scripts(ctx->msg, conn->scripts);
+	msg_ctx_set_locate(ctx->msg, conn->locate);
+	ctx->conn = conn;
+	return true;
+}
+
+/**
+ * Run a client's command line on a kept open connection.
+ *
+ * \param[in] context  The lws context.
+ * \param[in] req      The client's request.
+ * \return the command's exit status.
+ */
+static int cdt_daemon_request(struct lws_context *context,
+		const struct control_request *req)
+{
+	struct cdt_daemon_request_ctx ctx = {
+		.context = context,
+	};
+	struct cmd_options options = {
+		.port = 9222,
+		.host = "localhost",
+		.reconnect = 5,
+		.window = 32,
+		.timeout = 10000,
+		.timers = cdt_g.timers,
+		.log_level = cdt_log_get_level(),
+		.log_target = CDT_LOG_STDERR,
+		.parsed = cdt_daemon__parsed,
+		.parsed_pw = &ctx,
+	};
+	struct cdt_session *session;
+	void *cmd_pw;
+
+	clock_gettime(CLOCK_MONOTONIC, &cdt_g.time_start);
+
+	if (!cdt_daemon__copy_argv(req)) {
+		return EXIT_FAILURE;
+	}
+
+	ctx.msg = msg_ctx_create();
+	if (ctx.msg == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if (!cmd_init(cdt_daemon_g.argc, (const char **)cdt_daemon_g.argv,
+			&options, ctx.msg, &cmd_pw)) {
+		msg_ctx_destroy(ctx.msg);
+		return EXIT_FAILURE;
+	}
+
+	/* Every command parses its command line, but make sure. */
+	if (ctx.conn == NULL && !cdt_daemon__parsed(&ctx, &options)) {
+		cmd_fini(cmd_pw);
+		msg_ctx_destroy(ctx.msg);
+		return EXIT_FAILURE;
+	}
+
+	/* The command gets a fresh message context on the connection. A
+	 * message still being streamed from the last one is finished, but
+	 * its response is ignored. */
+	session = &ctx.conn->session;
+	session->conn.stream_ctx = NULL;
+	msg_ctx_destroy(session->conn.msg);
+	session->conn.msg = ctx.msg;
+	session->cmd_pw = cmd_pw;
+	session->reconnect_max = (unsigned)options.reconnect;
+	session->reconnects = 0;
+	msg_queue_set_window(ctx.msg, (unsigned)options.window);
+	msg_ctx_set_timeout(ctx.msg, cdt_g.timers, (unsigned)options.timeout,
+			cdt_session_timeout, session);
+	session->active = true;
+	session->complete = false;
+	session->time_response = (struct timespec) { 0 };
+
+	cdt_service(context, NULL, session, 1);
+
+	cdt_session_end(session, false);
+	cdt_log_timing(session);
+	cdt_log_queue_stats(session);
+
+	return session->complete ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Run as a daemon, serving command lines from clients.
+ *
+ * \return the exit status.
+ */
+static int cdt_daemon(void)
+{
+	struct lws_context *context;
+	struct lws_context_creation_info info = {
+		.port = CONTEXT_PORT_NO_LISTEN,
+		.protocols = protocols,
+	};
+	enum cdt_log_level log_level = cdt_log_get_level();
+	const char *path = control_socket_path();
+	int fd;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	cdt_g.timers = timer_wheel_create();
+	if (cdt_g.timers == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	fd = control_listen(path);
+	if (fd == -1) {
+		timer_wheel_destroy(cdt_g.timers);
+		return EXIT_FAILURE;
+	}
+
+	context = lws_create_context(&info);
+	if (context == NULL) {
+		cdt_log(CDT_LOG_ERROR, "lws_create_context failed");
+		control_close(fd, path);
+		timer_wheel_destroy(cdt_g.timers);
+		return EXIT_FAILURE;
+	}
+
+	cdt_g.context = context;
+	display_set_context(context);
+
+	while (cdt_g.interrupted == false) {
+		struct control_request req;
+		int status = EXIT_FAILURE;
+
+		timer_wheel_run(cdt_g.timers);
+
+		if (!control_accept(fd, &req)) {
+			/* Keep the open connections serviced. */
+			int timeout_ms = timer_wheel_next_ms(cdt_g.timers,
+					CDT_DAEMON_POLL_MS);
+
+			if (lws_service(context, timeout_ms) < 0) {
+				break;
+			}
+			continue;
+		}
+
+		if (control_redirect(&req)) {
+			status = cdt_daemon_request(context, &req);
+		}
+
+		cdt_log_set_level(log_level);
+		cdt_log_set_target(CDT_LOG_STDERR);
+		control_reply(&req, status);
+	}
+
+	lws_context_destroy(context);
+
+	for (unsigned i = 0; i < cdt_daemon_g.conn_count; i++) {
+		cdt_daemon_conn_destroy(cdt_daemon_g.conn[i]);
+	}
+	free(cdt_daemon_g.conn);
+	cdt_daemon__free_argv();
+	display_free_addresses();
 
-	cmd_fini(cdt_g.cmd_pw);
-	msg_queue_drain(msg_queue_get_send());
-	msg_queue_drain(msg_queue_get_sent());
-	cdt_buffer_delete(&cdt_g.multipart_msg);
+	control_close(fd, path);
+	timer_wheel_destroy(cdt_g.timers);
+	return EXIT_SUCCESS;
 }
 
+/**
+ * Log the outcome of each session, when running on several pages.
+ *
+ * \param[in] sessions  Array of sessions.
+ * \param[in] count     Number of sessions.
+ * \return true if every session's command ran to completion.
+ */
+static bool cdt_report(const struct cdt_session *sessions, unsigned count)
+{
+	unsigned complete = 0;
+
+	for (unsigned i = 0; i < count; i++) {
+		const struct cdt_session *session = &sessions[i];
+
+		if (session->complete) {
+			complete++;
+		}
+
+		if (!cdt_time_set(&session->time_connected)) {
+			cdt_log(CDT_LOG_NOTICE, "%s: %s, not connected",
+					session->path, session->complete ?
+					"complete" : "incomplete");
+			continue;
+		}
+
+		cdt_log(CDT_LOG_NOTICE, "%s: %s, connected in %" PRIi64
+				" ms, finished in %" PRIi64 " ms",
+				session->path, session->complete ?
+				"complete" : "incomplete",
+				time_diff_ms(&session->time_start,
+						&session->time_connected),
+				time_diff_ms(&session->time_start,
+						&session->time_end));
+	}
+
+	cdt_log(CDT_LOG_NOTICE, "%u of %u sessions complete", complete, count);
+	return complete == count;
+}
+
+/**
+ * Create a session for every page the command should run on.
+ *
+ * \param[in]  argc          Number of command line arguments.
+ * \param[in]  argv          String vector of command line arguments.
+ * \param[out] sessions_out  Returns array of sessions on success.
+ * \param[out] count_out     Returns number of sessions on success.
+ * \param[out] options_out   Returns the common command options.
+ * \return true on success, false otherwise.
+ */
 static bool setup(int argc, const char **argv,
-		const char **display,
-		const char **host,
-		int *port)
+		struct cdt_session **sessions_out,
+		unsigned *count_out,
+		struct cmd_options *options_out)
 {
 	struct cmd_options options = {
 		.port = 9222,
 		.host = "localhost",
+		.reconnect = 5,
+		.window = 32,
+		.timeout = 10000,
+		.timers = cdt_g.timers,
 		.log_level = CDT_LOG_NOTICE,
 		.log_target = CDT_LOG_STDERR,
 	};
+	struct cdt_session *sessions;
+	unsigned count;
+	char **paths;
+
+	sessions = calloc(1, sizeof(*sessions));
+	if (sessions == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
 
-	if (!cmd_init(argc, argv, &options, &cdt_g.cmd_pw)) {
+	if (!cdt_session_init(&sessions[0], argc, argv, &options)) {
 		cdt_log(CDT_LOG_ERROR, "Setup failed");
+		free(sessions);
 		return false;
 	}
 
 	cdt_log_set_level(options.log_level);
 	cdt_log_set_target(options.log_target);
 
-	*display = options.display;
-	*port = (int)options.port;
-	*host = options.host;
+	*options_out = options;
+
+	if (!options.all) {
+		sessions[0].display = options.display;
+		sessions[0].host = options.host;
+		sessions[0].port = (int)options.port;
+		sessions[0].path = display_get_path(options.display,
+				options.host, (int)options.port,
+				&sessions[0].path_cached);
+		if (sessions[0].path == NULL) {
+			cdt_log(CDT_LOG_ERROR, "Invalid display: %s",
+					options.display);
+			cdt_sessions_destroy(sessions, 1);
+			return false;
+		}
+
+		*sessions_out = sessions;
+		*count_out = 1;
+		return true;
+	}
+
+	/* The first command instance only served to parse the options;
+	 * each matching page gets its own. */
+	cdt_sessions_destroy(sessions, 1);
+
+	if (!display_get_paths(options.display,
+			options.host, (int)options.port,
+			&paths, &count)) {
+		cdt_log(CDT_LOG_ERROR, "Failed to get paths for display: %s",
+				options.display);
+		return false;
+	}
+
+	if (count == 0) {
+		cdt_log(CDT_LOG_ERROR, "No pages match display: %s",
+				options.display);
+		display_free_paths(paths, count);
+		return false;
+	}
+
+	sessions = calloc(count, sizeof(*sessions));
+	if (sessions == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		display_free_paths(paths, count);
+		return false;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		sessions[i].path = paths[i];
+		sessions[i].display = sessions[i].path;
+		paths[i] = NULL;
+
+		options.session = sessions[i].path;
+		if (!cdt_session_init(&sessions[i], argc, argv, &options)) {
+			cdt_log(CDT_LOG_ERROR, "Setup failed for %s",
+					sessions[i].path);
+			display_free_paths(paths, count);
+			cdt_sessions_destroy(sessions, count);
+			return false;
+		}
+	}
+
+	display_free_paths(paths, count);
+
+	*sessions_out = sessions;
+	*count_out = count;
 	return true;
 }
 
@@ -284,37 +1913,74 @@ int main(int argc, const char *argv[])
 		.port = CONTEXT_PORT_NO_LISTEN,
 		.protocols = protocols,
 	};
-	const char *display;
-	const char *host;
-	char *path;
-	int port;
+	struct cdt_browser browser = { 0 };
+	struct cdt_session *sessions;
+	struct cmd_options options;
+	unsigned count;
+	int ret = EXIT_FAILURE;
 
+	clock_gettime(CLOCK_MONOTONIC, &cdt_g.time_start);
 	signal(SIGINT, sigint_handler);
 
 	lws_set_log_level(LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE,
 			lwsl_emit_syslog);
 
-	if (!setup(argc, argv, &display, &host, &port)) {
-		return EXIT_FAILURE;
+	if (argc > 1 && strcmp(argv[1], "daemon") == 0) {
+		return cdt_daemon();
+
+	} else if (argc > 1 && strcmp(argv[1], "client") == 0) {
+		/* Send the command line without the "client" argument. */
+		argv[1] = argv[0];
+		return control_client(control_socket_path(),
+				argc - 1, argv + 1);
 	}
 
-	path = display_get_path(display, host, port);
-	if (path == NULL) {
-		cdt_log(CDT_LOG_ERROR, "Invalid display: %s", display);
+	cdt_g.timers = timer_wheel_create();
+	if (cdt_g.timers == NULL) {
 		return EXIT_FAILURE;
 	}
 
-	cdt_log(CDT_LOG_NOTICE, "Using %s as display path", path);
-
+	/* Display discovery shares the websocket's context. */
 	context = lws_create_context(&info);
 	if (context == NULL) {
 		cdt_log(CDT_LOG_ERROR, "lws_create_context failed");
+		timer_wheel_destroy(cdt_g.timers);
 		return EXIT_FAILURE;
 	}
+	cdt_g.context = context;
+	display_set_context(context);
 
-	cdt_run(context, path, host, port);
-	lws_context_destroy(context);
-	free(path);
+	if (!setup(argc, argv, &sessions, &count, &options)) {
+		lws_context_destroy(context);
+		display_free_addresses();
+		timer_wheel_destroy(cdt_g.timers);
+		return EXIT_FAILURE;
+	}
 
-	return EXIT_SUCCESS;
+	if (options.browser && !cdt_browser_init(&browser, sessions, count,
+			options.host, (int)options.port, options.timeout)) {
+		goto out;
+	}
+
+	cdt_run(context, options.browser ? &browser : NULL,
+			sessions, count, options.host, (int)options.port);
+
+	ret = EXIT_SUCCESS;
+	if (options.all) {
+		if (!cdt_report(sessions, count)) {
+			ret = EXIT_FAILURE;
+		}
+	} else if (!sessions[0].complete) {
+		/* Timed out, or ran out of reconnects, as the daemon
+		 * reports too. */
+		ret = EXIT_FAILURE;
+	}
+
+out:
+	lws_context_destroy(context);
+	cdt_sessions_destroy(sessions, count);
+	cdt_browser_fini(&browser);
+	display_free_addresses();
+	timer_wheel_destroy(cdt_g.timers);
+	return ret;
 }
@@ -18,6 +18,7 @@
 
 static struct {
 	const struct cmd_table *cmd;
+	unsigned instances; /* Number of initialised command instances. */
 } cmd_g;
 
 extern const struct cmd_table cmd_help_table;
@@ -27,9 +28,13 @@ extern const struct cmd_table cmd_tap;
 extern const struct cmd_table cmd_drag;
 extern const struct cmd_table cmd_swipe;
 extern const struct cmd_table cmd_tap_id;
+extern const struct cmd_table cmd_tap_css;
+extern const struct cmd_table cmd_tap_all;
 extern const struct cmd_table cmd_run_log;
 extern const struct cmd_table cmd_screencast;
 extern const struct cmd_table cmd_screenshot;
+extern const struct cmd_table cmd_wait_signal;
+extern const struct cmd_table cmd_bench_eval;
 
 const struct cmd_table *cmd_table[] = {
 	&cmd_help_table,
@@ -39,9 +44,13 @@ const struct cmd_table *cmd_table[] = {
 	&cmd_drag,
 	&cmd_swipe,
 	&cmd_tap_id,
+	&cmd_tap_css,
+	&cmd_tap_all,
 	&cmd_run_log,
 	&cmd_screencast,
 	&cmd_screenshot,
+	&cmd_wait_signal,
+	&cmd_bench_eval,
 };
 
 void cmd_print_command_list(void)
@@ -55,7 +64,8 @@ void cmd_print_command_list(void)
 }
 
 bool cmd_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
 	enum {
 		ARG_CDT,
@@ -76,10 +86,12 @@ bool cmd_init(int argc, const char **argv,
 		if (cmd_table[i] != NULL) {
 			if (strcmp(argv[ARG_CMD], cmd_table[i]->cmd) == 0) {
 				cmd_g.cmd = cmd_table[i];
-				if (cmd_table[i]->init != NULL) {
-					return cmd_table[i]->init(argc, argv,
-							options, pw_out);
+				if (cmd_table[i]->init != NULL &&
+				    !cmd_table[i]->init(argc, argv,
+						options, msg, pw_out)) {
+					return false;
 				}
+				cmd_g.instances++;
 				return true;
 			}
 		}
@@ -159,7 +171,7 @@ void cmd_evt(void *pw, const char *method, size_t method_len,
 	}
 }
 
-bool cmd_tick(void *pw)
+bool cmd_tick(void *pw, bool backpressure)
 {
 	if (cmd_g.cmd == NULL) {
 		cdt_log(CDT_LOG_ERROR, "%s: cmd uninitialised!", __func__);
@@ -167,7 +179,33 @@ bool cmd_tick(void *pw)
 	}
 
 	if (cmd_g.cmd->tick != NULL) {
-		return cmd_g.cmd->tick(pw);
+		return cmd_g.cmd->tick(pw, backpressure);
+	}
+
+	return false;
+}
+
+void cmd_reconnect(void *pw)
+{
+	if (cmd_g.cmd == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: cmd uninitialised!", __func__);
+		return;
+	}
+
+	if (cmd_g.cmd->reconnect != NULL) {
+		cmd_g.cmd->reconnect(pw);
+	}
+}
+
+bool cmd_timeout(void *pw, int id)
+{
+	if (cmd_g.cmd == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: cmd uninitialised!", __func__);
+		return false;
+	}
+
+	if (cmd_g.cmd->timeout != NULL) {
+		return cmd_g.cmd->timeout(pw, id);
 	}
 
 	return false;
@@ -184,5 +222,11 @@ void cmd_fini(void *pw)
 		cmd_g.cmd->fini(pw);
 	}
 
-	cmd_g.cmd = NULL;
+	if (cmd_g.instances > 0) {
+		cmd_g.instances--;
+	}
+
+	if (cmd_g.instances == 0) {
+		cmd_g.cmd = NULL;
+	}
 }
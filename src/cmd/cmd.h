@@ -7,6 +7,9 @@
 #ifndef CDT_CMD_H
 #define CDT_CMD_H
 
+struct msg_ctx;
+struct timer_wheel;
+
 /**
  * \file
  * \brief Command interface.
@@ -23,6 +26,36 @@ struct cmd_options {
 	int64_t port;
 	int64_t log_level;
 	int64_t log_target;
+
+	/** Whether to run on every page matching the display. */
+	bool all;
+
+	/** Whether to reach pages through one connection to the browser. */
+	bool browser;
+
+	/** Name of the session, when running on several pages, or NULL. */
+	const char *session;
+
+	/** Number of attempts to reconnect after losing the connection. */
+	int64_t reconnect;
+
+	/** Maximum requests in flight, or 0 for no limit. */
+	int64_t window;
+
+	/** Time to wait for each response in ms, or 0 for no limit. */
+	int64_t timeout;
+
+	/** Timer wheel run by the main loop, for command timers. */
+	struct timer_wheel *timers;
+
+	/**
+	 * Called once the command line has been parsed, before the command
+	 * is set up, or NULL. Returns false to fail the command.
+	 */
+	bool (*parsed)(void *pw, const struct cmd_options *options);
+
+	/** Client data to pass to `parsed`. */
+	void *parsed_pw;
 };
 
 /**
@@ -43,11 +76,13 @@ void cmd_help(int argc, const char **argv, const char *cmd);
  * \param[in]  argc     Number of command line arguments.
  * \param[in]  argv     String vector containing command line arguments.
  * \param[in]  options  Common command options parsed from arguments.
+ * \param[in]  msg      Message context for the connection to send on.
  * \param[out] pw_out   Returns private cmd data to be passed to other calls.
  * \return true on success, false otherwise.
  */
 bool cmd_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out);
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out);
 
 /**
  * Let the command handle a received message.
@@ -74,11 +109,37 @@ void cmd_evt(void *pw, const char *method, size_t method_len,
 /**
  * .Tick the command.
  *
- * \param[in] pw  The command's private context.
+ * Under backpressure, messages are already waiting to be sent or the
+ * in-flight window is full, so the command should hold off queueing more.
+ *
+ * \param[in] pw            The command's private context.
+ * \param[in] backpressure  Whether the command should slow down.
  * \return true if the mainloop should continue even when message queues are
  *         empty, or false to allow termination of the program.
  */
-bool cmd_tick(void *pw);
+bool cmd_tick(void *pw, bool backpressure);
+
+/**
+ * Let the command know its connection was lost and re-established.
+ *
+ * The new connection starts without any of the old one's subscriptions,
+ * so commands that enabled events must enable them again.
+ *
+ * \param[in] pw  The command's private context.
+ */
+void cmd_reconnect(void *pw);
+
+/**
+ * Let the command know a request got no response in time.
+ *
+ * The request is forgotten, so a late response is not matched to it.
+ *
+ * \param[in] pw  The command's private context.
+ * \param[in] id  Id of the request that timed out.
+ * \return true if the command can carry on without the response, or false
+ *         if the command has failed.
+ */
+bool cmd_timeout(void *pw, int id);
 
 /**
  * .Finalise the command.
@@ -0,0 +1,389 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "cmd/cmd.h"
+#include "cmd/private.h"
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+
+#include "util/cli.h"
+#include "util/log.h"
+#include "util/time.h"
+#include "util/util.h"
+
+/**
+ * Script wrapper, timing the script in the page.
+ *
+ * The script's statements run in a block, so `let` and `const` declarations
+ * are scoped to one run rather than redeclared by the next, and the
+ * completion value is replaced by the time they took, in ms. Evaluations
+ * run one at a time in the page, so a global start time is safe.
+ */
+#define BENCH_EVAL_SCRIPT_FMT \
+	"globalThis.__cdtBenchStart = performance.now();\\n" \
+	"{\\n%s\\n}\\n" \
+	";performance.now() - globalThis.__cdtBenchStart"
+
+/**
+ * Script wrapper for an expression whose promise result is awaited.
+ *
+ * The time taken includes waiting for the promise to settle.
+ */
+#define BENCH_EVAL_AWAIT_SCRIPT_FMT \
+	"(async () => {" \
+		"const start = performance.now();" \
+		"await (%s\\n);" \
+		"return performance.now() - start;" \
+	"})()"
+
+struct bench_eval_ctx;
+
+/** One timed evaluation. */
+struct bench_eval_sample {
+	struct bench_eval_ctx *ctx;
+	struct timespec sent; /**< Time the evaluation was sent. */
+};
+
+static struct bench_eval_ctx {
+	const char *script;
+	uint64_t count;
+	bool await_promise;
+
+	char *expression; /**< The script, wrapped to time it. */
+
+	uint64_t queued;   /**< Evaluations queued so far. */
+	uint64_t received; /**< Responses received so far. */
+	uint64_t failed;   /**< Evaluations that threw, or gave no time. */
+
+	struct bench_eval_sample *samples;
+	double *rtt_ms;   /**< Round trip times of completed evaluations. */
+	double *page_ms;  /**< In-page times of completed evaluations. */
+	uint64_t completed;
+
+	struct msg_ctx *msg;
+} bench_eval_g;
+
+static const struct bench_eval_ctx bench_eval_defaults = {
+	.count = 100,
+};
+
+static const struct cli_table_entry cli_entries[] = {
+	CMD_CLI_COMMON("bench-eval"),
+	{
+		.p = true,
+		.l = "SCRIPT",
+		.t = CLI_STRING,
+		.v.s = &bench_eval_g.script,
+		.d = "JSON-escaped JavaScript to time."
+	},
+	{
+		.s = 'n',
+		.l = "count",
+		.t = CLI_UINT,
+		.v.u = &bench_eval_g.count,
+		.d = "Number of times to run the script. The default is 100."
+	},
+	{
+		.s = 'P',
+		.l = "await-promise",
+		.t = CLI_BOOL,
+		.v.b = &bench_eval_g.await_promise,
+		.d = "Treat SCRIPT as an expression, and include the time "
+		     "for its promise to settle."
+	},
+};
+static const struct cli_table cli = {
+	.entries = cli_entries,
+	.count = (sizeof(cli_entries))/(sizeof(*cli_entries)),
+	.min_positional = 3,
+};
+
+static int cmd_bench_eval__cmp(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+/**
+ * Get the index of a percentile in a sorted set of samples.
+ *
+ * \param[in] count       Number of samples, which must be non-zero.
+ * \param[in] percentile  The percentile, from 0 to 100.
+ * \return the index of the nearest ranked sample.
+ */
+static uint64_t cmd_bench_eval__rank(uint64_t count, unsigned percentile)
+{
+	uint64_t rank = (count * percentile + 99) / 100;
+
+	return (rank > 0) ? rank - 1 : 0;
+}
+
+/**
+ * Print the statistics for a set of times.
+ *
+ * \param[in] name   Name of the times.
+ * \param[in] times  The times, in ms. These are sorted in place.
+ * \param[in] count  Number of times, which must be non-zero.
+ */
+static void cmd_bench_eval__print(const char *name,
+		double *times, uint64_t count)
+{
+	static const unsigned percentiles[] = { 50, 95, 99 };
+
+	qsort(times, count, sizeof(*times), cmd_bench_eval__cmp);
+
+	printf("%-16s min %.3f", name, times[0]);
+	for (unsigned i = 0; i < CDT_ARRAY_COUNT(percentiles); i++) {
+		uint64_t r = cmd_bench_eval__rank(count, percentiles[i]);
+
+		printf(" p%u %.3f", percentiles[i], times[r]);
+	}
+	printf(" max %.3f\n", times[count - 1]);
+}
+
+/**
+ * Print the latency statistics.
+ *
+ * \param[in] ctx  The bench-eval context.
+ */
+static void cmd_bench_eval__report(struct bench_eval_ctx *ctx)
+{
+	printf("%" PRIu64 " evaluations, %" PRIu64 " failed\n",
+			ctx->received, ctx->failed);
+	if (ctx->completed == 0) {
+		return;
+	}
+
+	cmd_bench_eval__print("round trip (ms):", ctx->rtt_ms, ctx->completed);
+	cmd_bench_eval__print("in page (ms):", ctx->page_ms, ctx->completed);
+}
+
+/** Result of an evaluation. */
+struct bench_eval_result {
+	bool threw;     /**< Whether the script threw an exception. */
+	double page_ms; /**< Time in the page, or negative if not given. */
+};
+
+static bool cmd_bench_eval__scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	struct bench_eval_result *result = pw;
+
+	if (key->type == MSG_SCAN_TYPE_INTEGER) {
+		result->threw = true;
+		return true;
+	}
+
+	result->page_ms = value->floating_point;
+	return false;
+}
+
+static void cmd_bench_eval__queue(struct bench_eval_ctx *ctx);
+
+/**
+ * Handle the response to an evaluation.
+ *
+ * \param[in] pw   The evaluation's sample.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void cmd_bench_eval__response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	static const struct msg_scan_spec spec[] = {
+		{
+			.key = "value",
+			.type = MSG_SCAN_TYPE_FLOATING_POINT,
+			.depth = 3,
+		},
+		{
+			.key = "exceptionId",
+			.type = MSG_SCAN_TYPE_INTEGER,
+			.depth = 3,
+		},
+	};
+	struct bench_eval_sample *sample = pw;
+	struct bench_eval_ctx *ctx = sample->ctx;
+	struct bench_eval_result result = {
+		.page_ms = -1,
+	};
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ctx->received++;
+
+	msg_str_scan(msg, len, spec, CDT_ARRAY_COUNT(spec),
+			cmd_bench_eval__scan_cb, &result);
+	if (msg == NULL) {
+		cdt_log(CDT_LOG_WARNING, "Evaluation %i got no response", id);
+		ctx->failed++;
+	} else if (result.threw || result.page_ms < 0) {
+		cdt_log(CDT_LOG_WARNING, "Evaluation %i failed: %.*s",
+				id, (int)len, msg);
+		ctx->failed++;
+	} else {
+		ctx->rtt_ms[ctx->completed] = (double)time_diff_us(
+				&sample->sent, &now) / 1000;
+		ctx->page_ms[ctx->completed] = result.page_ms;
+		ctx->completed++;
+	}
+
+	if (ctx->received == ctx->count) {
+		cmd_bench_eval__report(ctx);
+		return;
+	}
+
+	/* Keep the pipeline full without waiting for the next tick. */
+	if (!msg_queue_backpressure(ctx->msg)) {
+		cmd_bench_eval__queue(ctx);
+	}
+}
+
+/**
+ * Queue the next evaluation, if there are any left.
+ *
+ * Evaluations are only queued when nothing is waiting to be sent, to keep
+ * them from waiting behind each other in the send queue. The round trip
+ * is timed from when the evaluation is written to the connection.
+ *
+ * \param[in] ctx  The bench-eval context.
+ */
+static void cmd_bench_eval__queue(struct bench_eval_ctx *ctx)
+{
+	struct bench_eval_sample *sample;
+
+	if (ctx->queued == ctx->count) {
+		return;
+	}
+
+	sample = &ctx->samples[ctx->queued++];
+	sample->ctx = ctx;
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_EVALUATE,
+			.response = cmd_bench_eval__response,
+			.pw = sample,
+			.sent_time = &sample->sent,
+			.data = {
+				.evaluate = {
+					.expression = ctx->expression,
+					.await_promise = ctx->await_promise,
+				},
+			},
+		}, NULL);
+}
+
+static void cmd_bench_eval_fini(void *pw);
+
+static bool cmd_bench_eval_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct bench_eval_ctx *ctx;
+	const char *fmt;
+	int len;
+
+	bench_eval_g = bench_eval_defaults;
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	if (bench_eval_g.count == 0) {
+		cdt_log(CDT_LOG_ERROR, "Count must be at least 1");
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = bench_eval_g;
+	ctx->msg = msg;
+
+	fmt = ctx->await_promise ?
+			BENCH_EVAL_AWAIT_SCRIPT_FMT :
+			BENCH_EVAL_SCRIPT_FMT;
+	len = snprintf(NULL, 0, fmt, ctx->script);
+
+	ctx->expression = (len < 0) ? NULL : malloc((size_t)len + 1);
+	ctx->samples = calloc(ctx->count, sizeof(*ctx->samples));
+	ctx->rtt_ms = calloc(ctx->count, sizeof(*ctx->rtt_ms));
+	ctx->page_ms = calloc(ctx->count, sizeof(*ctx->page_ms));
+	if (ctx->expression == NULL || ctx->samples == NULL ||
+	    ctx->rtt_ms == NULL || ctx->page_ms == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		cmd_bench_eval_fini(ctx);
+		return false;
+	}
+	snprintf(ctx->expression, (size_t)len + 1, fmt, ctx->script);
+
+	*pw_out = ctx;
+	return true;
+}
+
+static void cmd_bench_eval_msg(void *pw, int id, const char *msg, size_t len)
+{
+	CDT_UNUSED(pw);
+
+	cdt_log(CDT_LOG_INFO, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
+
+static bool cmd_bench_eval_tick(void *pw, bool backpressure)
+{
+	struct bench_eval_ctx *ctx = pw;
+
+	if (!backpressure) {
+		cmd_bench_eval__queue(ctx);
+	}
+
+	return ctx->queued < ctx->count;
+}
+
+static void cmd_bench_eval_fini(void *pw)
+{
+	struct bench_eval_ctx *ctx = pw;
+
+	free(ctx->expression);
+	free(ctx->samples);
+	free(ctx->rtt_ms);
+	free(ctx->page_ms);
+	free(ctx);
+}
+
+static void cmd_bench_eval_help(int argc, const char **argv);
+
+const struct cmd_table cmd_bench_eval = {
+	.cmd  = "bench-eval",
+	.init = cmd_bench_eval_init,
+	.help = cmd_bench_eval_help,
+	.msg  = cmd_bench_eval_msg,
+	.tick = cmd_bench_eval_tick,
+	.fini = cmd_bench_eval_fini,
+};
+
+static void cmd_bench_eval_help(int argc, const char **argv)
+{
+	cli_help(&cli, (argc > 0) ? argv[0] : "cdt");
+}
@@ -6,12 +6,11 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
-#include <unistd.h>
-
 #include "cmd/cmd.h"
 #include "cmd/private.h"
 
@@ -21,6 +20,7 @@
 #include "util/log.h"
 #include "util/time.h"
 #include "util/util.h"
+#include "util/timer.h"
 
 static struct drag_ctx {
 	int64_t x0;
@@ -33,7 +33,14 @@ static struct drag_ctx {
 
 	int64_t step;
 	struct timespec time_start;
-} drag_ctx = {
+
+	struct timer timer; /**< Fires when the next step is due. */
+	struct timer_wheel *timers;
+
+	struct msg_ctx *msg;
+} drag_ctx;
+
+static const struct drag_ctx drag_defaults = {
 	.steps = 10,
 	.duration = 500,
 };
@@ -89,42 +96,123 @@ static const struct cli_table cli = {
 	.min_positional = 6,
 };
 
-static int lerp(int64_t a, int64_t b)
+static int lerp(const struct drag_ctx *ctx, int64_t a, int64_t b)
 {
-	return (int)(a + (b - a) * drag_ctx.step / drag_ctx.steps);
+	return (int)(a + (b - a) * ctx->step / ctx->steps);
+}
+
+/**
+ * Schedule the next drag step, at its share of the drag's duration.
+ *
+ * \param[in] ctx  The drag context.
+ */
+static void cmd_drag__schedule(struct drag_ctx *ctx)
+{
+	struct timespec time_now;
+	int64_t time_passed;
+	int64_t time_step;
+	int ret;
+
+	time_step = ctx->duration * (ctx->step + 1) / ctx->steps;
+	if (time_step > ctx->duration) {
+		time_step = ctx->duration;
+	}
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &time_now);
+	if (ret == -1) {
+		time_passed = time_step;
+	} else {
+		time_passed = time_diff_ms(&ctx->time_start, &time_now);
+	}
+
+	timer_schedule(ctx->timers, &ctx->timer, (time_passed < time_step) ?
+			(uint64_t)(time_step - time_passed) : 0);
+}
+
+/**
+ * Send the next drag step.
+ *
+ * Moves that can't be sent straight away are coalesced in the send queue,
+ * so the drag keeps to time even when the connection is slow.
+ *
+ * \param[in] pw  The drag context.
+ */
+static void cmd_drag__step(void *pw)
+{
+	struct drag_ctx *ctx = pw;
+	int id;
+
+	ctx->step++;
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_MOVE,
+			.data = {
+				.touch_event = {
+					.x = lerp(ctx, ctx->x0, ctx->x1),
+					.y = lerp(ctx, ctx->y0, ctx->y1),
+				},
+			},
+		}, &id);
+
+	if (ctx->step < ctx->steps) {
+		cmd_drag__schedule(ctx);
+		return;
+	}
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_END,
+		}, &id);
 }
 
 static bool cmd_drag_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
+	struct drag_ctx *ctx;
 	int ret;
 	int id;
 
+	drag_ctx = drag_defaults;
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
-	if (drag_ctx.steps == 0) {
-		drag_ctx.steps++;
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
 	}
 
-	ret = clock_gettime(CLOCK_MONOTONIC, &drag_ctx.time_start);
+	*ctx = drag_ctx;
+	if (ctx->steps == 0) {
+		ctx->steps++;
+	}
+	ctx->msg = msg;
+	ctx->timers = options->timers;
+	timer_init(&ctx->timer, cmd_drag__step, ctx);
+
+	ret = clock_gettime(CLOCK_MONOTONIC, &ctx->time_start);
 	if (ret == -1) {
+		free(ctx);
 		return false;
 	}
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_TOUCH_EVENT_START,
 			.data = {
 				.touch_event = {
-					.x = lerp(drag_ctx.x0, drag_ctx.x1),
-					.y = lerp(drag_ctx.y0, drag_ctx.y1),
+					.x = lerp(ctx, ctx->x0, ctx->x1),
+					.y = lerp(ctx, ctx->y0, ctx->y1),
 				},
 			},
 		}, &id);
 
-	*pw_out = &drag_ctx;
+	cmd_drag__schedule(ctx);
+
+	*pw_out = ctx;
 	return true;
 }
 
@@ -136,58 +224,22 @@ static void cmd_drag_msg(void *pw, int id, const char *msg, size_t len)
 			id, (int)len, msg);
 }
 
-static bool cmd_drag_tick(void *pw)
+static bool cmd_drag_tick(void *pw, bool backpressure)
 {
-	struct drag_ctx *ctx = pw;
-	struct timespec time_now;
-	int64_t time_passed;
-	int64_t time_step;
-	int ret;
-	int id;
+	const struct drag_ctx *ctx = pw;
 
-	time_step = ctx->duration * (ctx->step + 1) / ctx->steps;
-	if (time_step > ctx->duration) {
-		time_step = ctx->duration;
-	}
-
-	ret = clock_gettime(CLOCK_MONOTONIC, &time_now);
-	if (ret == -1) {
-		time_passed = time_step;
-	} else {
-		time_passed = time_diff_ms(&ctx->time_start, &time_now);
-	}
+	/* Steps are sent from the timer, and coalesced under backpressure. */
+	CDT_UNUSED(backpressure);
 
-	if (time_passed >= time_step) {
-		ctx->step++;
-		if (ctx->step <= ctx->steps) {
-			msg_queue_for_send(&(const struct msg)
-				{
-					.type = MSG_TYPE_TOUCH_EVENT_MOVE,
-					.data = {
-						.touch_event = {
-							.x = lerp(ctx->x0,
-							          ctx->x1),
-							.y = lerp(ctx->y0,
-							          ctx->y1),
-						},
-					},
-				}, &id);
-		}
-
-		if (ctx->step == ctx->steps) {
-			msg_queue_for_send(&(const struct msg)
-				{
-					.type = MSG_TYPE_TOUCH_EVENT_END,
-				}, &id);
-		}
-	} else {
-		int64_t sleep_ms = 10 < time_step - time_passed ?
-		                   10 : time_step - time_passed;
+	return ctx->step < ctx->steps;
+}
 
-		usleep((useconds_t)(1000 * sleep_ms));
-	}
+static void cmd_drag_fini(void *pw)
+{
+	struct drag_ctx *ctx = pw;
 
-	return ctx->step <= ctx->steps;
+	timer_cancel(&ctx->timer);
+	free(ctx);
 }
 
 static void cmd_drag_help(int argc, const char **argv);
@@ -198,6 +250,7 @@ const struct cmd_table cmd_drag = {
 	.help = cmd_drag_help,
 	.msg  = cmd_drag_msg,
 	.tick = cmd_drag_tick,
+	.fini = cmd_drag_fini,
 };
 
 static void cmd_drag_help(int argc, const char **argv)
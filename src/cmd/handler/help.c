@@ -40,9 +40,11 @@ static const struct cli_table cli = {
 };
 
 static bool cmd_help_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
 	CDT_UNUSED(options);
+	CDT_UNUSED(msg);
 
 	if (!cli_parse(&cli, argc, argv)) {
 		cdt_log(CDT_LOG_ERROR, "Failed to parse command line");
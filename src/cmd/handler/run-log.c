@@ -7,10 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-#include <unistd.h>
-
 #include <cyaml/cyaml.h>
 
 #include "cmd/cmd.h"
@@ -21,24 +20,45 @@
 #include "util/cli.h"
 #include "util/log.h"
 #include "util/util.h"
+#include "util/timer.h"
 #include "util/decode.h"
 
-/* The log messages arrive as an array of arrays as a JSON string.
- * These are the schema to decode that to a `char ***` type. */
+/** Time between fetches of the captured log (ms). */
+#define CMD_RUN_LOG_POLL_INTERVAL 1000
+
+/** FNV-1a 32-bit offset basis, the log hash of an empty log. */
+#define CMD_RUN_LOG_HASH_INIT 2166136261u
+
+/** FNV-1a 32-bit prime. */
+#define CMD_RUN_LOG_HASH_PRIME 16777619u
+
+/* The new log messages arrive as a JSON string of an object, with the
+ * total number of messages, the hash of the whole log, and an array of the
+ * messages after the cursor. */
+struct log_fetch {
+	unsigned seq;
+	uint32_t hash;
+	char **logs;
+	unsigned logs_count;
+};
 
-static const struct cyaml_schema_value value_entry_schema = {
+static const struct cyaml_schema_value log_entry_schema = {
 	CYAML_VALUE_STRING(CYAML_FLAG_POINTER, char *, 0, CYAML_UNLIMITED),
 };
 
-static const struct cyaml_schema_value value_inner_schema = {
-	CYAML_VALUE_SEQUENCE_FIXED(CYAML_FLAG_POINTER, char *,
-			&value_entry_schema, 1),
+static const struct cyaml_schema_field log_fetch_fields_schema[] = {
+	CYAML_FIELD_UINT("seq", CYAML_FLAG_DEFAULT, struct log_fetch, seq),
+	CYAML_FIELD_UINT("hash", CYAML_FLAG_DEFAULT, struct log_fetch, hash),
+	CYAML_FIELD_SEQUENCE("logs", CYAML_FLAG_POINTER,
+			struct log_fetch, logs,
+			&log_entry_schema, 0, CYAML_UNLIMITED),
+	CYAML_FIELD_END
 };
 
-/* Schema to decode log message response JSON. */
-static const struct cyaml_schema_value value_schema = {
-	CYAML_VALUE_SEQUENCE(CYAML_FLAG_POINTER, char *,
-			&value_inner_schema, 0, CYAML_UNLIMITED),
+/* Schema to decode log fetch response JSON. */
+static const struct cyaml_schema_value log_fetch_schema = {
+	CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct log_fetch,
+			log_fetch_fields_schema),
 };
 
 /* Data structure for the log message response data. */
@@ -59,6 +79,10 @@ struct message_response {
  * `console.stdlog`, and replaces `console.log` with a function that
  * appends the log message to an array, before calling `console.stdlog`.
  *
+ * Each message's first argument is logged as a string, and is added to an
+ * FNV-1a hash of the log's UTF-8 bytes, with each message followed by an
+ * 0xff byte, so the log can be checked without fetching it all again.
+ *
  * If the log message array already exists, it clears the array.
  */
 static const char *log_capture_script =
@@ -66,18 +90,32 @@ static const char *log_capture_script =
 		"    console.stdlog = console.log.bind(console);"
 		"    console.logs = [];"
 		"    console.log = function() {"
-		"        console.logs.push(Array.from(arguments));"
+		"        var s = String(arguments.length ? arguments[0] : '');"
+		"        var b = new TextEncoder().encode(s);"
+		"        var h = console.logHash;"
+		"        for (var i = 0; i < b.length; i++) {"
+		"            h = Math.imul(h ^ b[i], 16777619);"
+		"        }"
+		"        console.logHash = Math.imul(h ^ 255, 16777619) >>> 0;"
+		"        console.logs.push(s);"
 		"        console.stdlog.apply(console, arguments);"
 		"    }"
 		"} else {"
 		"    console.logs.length = 0;"
-		"}";
+		"}"
+		"console.logHash = 2166136261;";
 
 /**
- * JavaScript log fetch script.
+ * JavaScript log fetch script format.
+ *
+ * Takes the cursor: the number of messages already fetched.
  */
-static const char *log_fetch_script =
-		"JSON.stringify(console.logs)";
+static const char *log_fetch_script_fmt =
+		"JSON.stringify({"
+		"    seq: console.logs.length,"
+		"    hash: console.logHash,"
+		"    logs: console.logs.slice(%u)"
+		"})";
 
 /**
  * JavaScript log reset script.
@@ -94,14 +132,22 @@ static const char *log_reset_script =
 static struct run_log_ctx {
 	int id_capture;
 	int id_expression;
-	int id_fetch;
-	int id_reset;
 
-	char ***log;
-	unsigned log_count;
+	unsigned cursor; /**< Number of log messages fetched. */
+	uint32_t hash;   /**< Hash of the log messages fetched. */
 
 	const char *script;
 	const char *end_marker;
+
+	/** Whether to stream console API calls, rather than poll. */
+	bool stream;
+	bool enabled;  /**< Whether the Runtime domain is enabled. */
+	bool complete; /**< Whether the end marker has been seen. */
+
+	struct timer poll; /**< Fires when the log is due to be fetched. */
+	struct timer_wheel *timers;
+
+	struct msg_ctx *msg;
 } run_log_g;
 
 static const struct cli_table_entry cli_entries[] = {
@@ -120,6 +166,14 @@ static const struct cli_table_entry cli_entries[] = {
 		.v.s = &run_log_g.end_marker,
 		.d = "String indicating end of log."
 	},
+	{
+		.s = 's',
+		.l = "stream",
+		.t = CLI_BOOL,
+		.v.b = &run_log_g.stream,
+		.d = "Stream console API calls as they happen, rather than "
+		     "polling a log captured in the page."
+	},
 };
 static const struct cli_table cli = {
 	.entries = cli_entries,
@@ -127,15 +181,107 @@ static const struct cli_table cli = {
 	.min_positional = 3,
 };
 
+static void cmd_run_log__fetch_response(void *pw, int id,
+		const char *msg, size_t len);
+
+/**
+ * Queue the log fetch script.
+ *
+ * \param[in] pw  The run-log context.
+ */
+static void cmd_run_log__fetch(void *pw)
+{
+	struct run_log_ctx *ctx = pw;
+	char script[160];
+
+	snprintf(script, sizeof(script), log_fetch_script_fmt, ctx->cursor);
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_EVALUATE,
+			.idempotent = true,
+			.response = cmd_run_log__fetch_response,
+			.pw = ctx,
+			.data = {
+				.evaluate = {
+					.expression = script,
+				},
+			},
+		}, NULL);
+}
+
+static void cmd_run_log__enable_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	struct run_log_ctx *ctx = pw;
+
+	CDT_UNUSED(id);
+	CDT_UNUSED(len);
+
+	ctx->enabled = (msg != NULL);
+}
+
+/**
+ * Enable the Runtime domain, to get console API call events.
+ *
+ * \param[in] ctx  The run-log context.
+ */
+static void cmd_run_log__enable(struct run_log_ctx *ctx)
+{
+	ctx->enabled = false;
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_RUNTIME_ENABLE,
+			.response = cmd_run_log__enable_response,
+			.pw = ctx,
+		}, NULL);
+}
+
 static bool cmd_run_log_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
+	struct run_log_ctx *ctx;
+
+	run_log_g = (struct run_log_ctx) { 0 };
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = run_log_g;
+	ctx->msg = msg;
+	ctx->hash = CMD_RUN_LOG_HASH_INIT;
+	ctx->timers = options->timers;
+	timer_init(&ctx->poll, cmd_run_log__fetch, ctx);
+
+	if (ctx->stream) {
+		cmd_run_log__enable(ctx);
+
+		/* Send expression from command line */
+		msg_queue_for_send(msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_EVALUATE,
+				.data = {
+					.evaluate = {
+						.expression = ctx->script,
+					},
+				},
+			}, &ctx->id_expression);
+
+		*pw_out = ctx;
+		return true;
+	}
+
 	/* Send log capture script. */
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_EVALUATE,
 			.data = {
@@ -143,31 +289,22 @@ static bool cmd_run_log_init(int argc, const char **argv,
 					.expression = log_capture_script,
 				},
 			},
-		}, &run_log_g.id_capture);
+		}, &ctx->id_capture);
 
 	/* Send expression from command line */
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_EVALUATE,
 			.data = {
 				.evaluate = {
-					.expression = run_log_g.script,
+					.expression = ctx->script,
 				},
 			},
-		}, &run_log_g.id_expression);
+		}, &ctx->id_expression);
 
-	/* Send log fetch script. */
-	msg_queue_for_send(&(const struct msg)
-		{
-			.type = MSG_TYPE_EVALUATE,
-			.data = {
-				.evaluate = {
-					.expression = log_fetch_script,
-				},
-			},
-		}, &run_log_g.id_fetch);
+	cmd_run_log__fetch(ctx);
 
-	*pw_out = &run_log_g;
+	*pw_out = ctx;
 	return true;
 }
 
@@ -178,121 +315,201 @@ static const cyaml_config_t config = {
 		.log_fn = cyaml_log,
 };
 
+/**
+ * Add a log message to a log hash.
+ *
+ * \param[in] hash  The hash of the log before the message.
+ * \param[in] str   The log message.
+ * \return the hash of the log including the message.
+ */
+static uint32_t cmd_run_log__hash(uint32_t hash, const char *str)
+{
+	for (const uint8_t *b = (const uint8_t *)str; *b != '\0'; b++) {
+		hash = (hash ^ *b) * CMD_RUN_LOG_HASH_PRIME;
+	}
+
+	return (hash ^ 0xff) * CMD_RUN_LOG_HASH_PRIME;
+}
+
 static bool cmd_run_log__handle_raw(struct run_log_ctx *ctx, const char *raw)
 {
-	char ***log;
-	bool complete;
-	size_t raw_len;
+	struct log_fetch *fetch;
+	bool complete = false;
 	cyaml_err_t res;
-	unsigned log_count;
+	uint32_t hash;
 
 	if (raw == NULL) {
 		return false;
 	}
 
-	raw_len = strlen(raw);
-
-	res = cyaml_load_data((const uint8_t *)raw, raw_len,
-			&config,
-			&value_schema,
-			(void **)&log, &log_count);
+	res = cyaml_load_data((const uint8_t *)raw, strlen(raw),
+			&config, &log_fetch_schema,
+			(void **)&fetch, NULL);
 	if (res != CYAML_OK) {
 		cdt_log(CDT_LOG_NOTICE, "Failed to parse log lines: %s",
 				cyaml_strerror(res));
 		return true;
 	}
 
-	if (ctx->log_count > log_count) {
+	hash = ctx->hash;
+	for (unsigned i = 0; i < fetch->logs_count; i++) {
+		hash = cmd_run_log__hash(hash, fetch->logs[i]);
+	}
+
+	/* The messages already fetched must still be the start of the log,
+	 * so the new messages follow on from them. */
+	if (fetch->seq != ctx->cursor + fetch->logs_count ||
+	    fetch->hash != hash) {
 		cdt_log(CDT_LOG_WARNING, "Log tamper detected! Got %u, had %u",
-				log_count, ctx->log_count);
-		cyaml_free(&config, &value_schema, log, log_count);
+				fetch->seq, ctx->cursor);
+		cyaml_free(&config, &log_fetch_schema, fetch, 0);
 		return true;
 	}
 
-	for (unsigned i = 0; i < ctx->log_count; i++) {
-		if (log[i][0] != NULL && ctx->log[i][0] != NULL) {
-			if (strcmp(log[i][0], ctx->log[i][0]) != 0) {
-				cdt_log(CDT_LOG_WARNING,
-						"Log tamper detected!");
-				cyaml_free(&config, &value_schema,
-						log, log_count);
-				return true;
-			}
+	for (unsigned i = 0; i < fetch->logs_count; i++) {
+		printf("%s\n", fetch->logs[i]);
+
+		if (ctx->end_marker != NULL &&
+		    strstr(fetch->logs[i], ctx->end_marker) != NULL) {
+			complete = true;
 		}
 	}
 
-	for (unsigned i = ctx->log_count; i < log_count; i++) {
-		if (log[i][0] != NULL) {
-			printf("%s\n", log[i][0]);
-		}
+	ctx->cursor = fetch->seq;
+	ctx->hash = hash;
+
+	cyaml_free(&config, &log_fetch_schema, fetch, 0);
+	return complete;
+}
+
+static void cmd_run_log__fetch_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	struct run_log_ctx *ctx = pw;
+	bool complete;
+	char *raw;
+
+	CDT_UNUSED(id);
+
+	if (msg == NULL) {
+		/* The session's timeout handling reports the failure. */
+		return;
 	}
 
-	complete = false;
-	if (log_count > 0 && log[log_count - 1][0] != NULL) {
-		if (ctx->end_marker != NULL) {
-			if (strstr(log[log_count - 1][0],
-					ctx->end_marker) != NULL) {
-				complete = true;
-			}
-		}
+	raw = decode_extract_response_value(msg, len);
+	if (raw == NULL) {
+		return;
 	}
 
-	cyaml_free(&config, &value_schema, ctx->log, ctx->log_count);
+	complete = cmd_run_log__handle_raw(ctx, raw);
+	free(raw);
 
-	ctx->log = log;
-	ctx->log_count = log_count;
+	if (!complete) {
+		timer_schedule(ctx->timers, &ctx->poll,
+				CMD_RUN_LOG_POLL_INTERVAL);
+		return;
+	}
 
-	return complete;
+	/* Send log reset script. */
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_EVALUATE,
+			.data = {
+				.evaluate = {
+					.expression = log_reset_script,
+				},
+			},
+		}, NULL);
 }
 
 static void cmd_run_log_msg(void *pw, int id, const char *msg, size_t len)
 {
-	struct run_log_ctx *ctx = pw;
+	(void)(pw);
 
-	if (id != ctx->id_fetch) {
-		cdt_log(CDT_LOG_NOTICE, "Received message with id %i: %*s",
-				id, (int)len, msg);
-		return;
+	cdt_log(CDT_LOG_NOTICE, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
 
-	} else if (id == ctx->id_fetch) {
-		char *raw;
-		bool complete;
+/**
+ * Handle a console API call event, when streaming.
+ *
+ * \param[in] ctx  The run-log context.
+ * \param[in] msg  The event message.
+ * \param[in] len  Length of the event message in bytes.
+ */
+static void cmd_run_log__console_api_called(struct run_log_ctx *ctx,
+		const char *msg, size_t len)
+{
+	char *value;
+	char *type;
 
-		raw = decode_extract_response_value(msg, len);
-		if (raw == NULL) {
-			return;
+	if (!decode_extract_console_api_call(msg, len, &type, &value)) {
+		return;
+	}
+
+	/* Like the captured log, only console.log() calls are output. */
+	if (strcmp(type, "log") == 0 && value != NULL) {
+		printf("%s\n", value);
+
+		if (ctx->end_marker != NULL &&
+		    strstr(value, ctx->end_marker) != NULL) {
+			ctx->complete = true;
+			msg_queue_for_send(ctx->msg, &(const struct msg)
+				{
+					.type = MSG_TYPE_RUNTIME_DISABLE,
+				}, NULL);
 		}
+	}
 
-		complete = cmd_run_log__handle_raw(ctx, raw);
-		free(raw);
+	free(value);
+	free(type);
+}
 
-		/* Send log fetch script. */
-		msg_queue_for_send(&(const struct msg)
-			{
-				.type = MSG_TYPE_EVALUATE,
-				.data = {
-					.evaluate = {
-						.expression = complete ?
-							log_reset_script :
-							log_fetch_script,
-					},
-				},
-			}, complete ?
-				&run_log_g.id_reset :
-				&run_log_g.id_fetch);
+static void cmd_run_log_evt(void *pw, const char *method, size_t method_len,
+		const char *msg, size_t len)
+{
+	struct run_log_ctx *ctx = pw;
 
-		if (!complete) {
-			sleep(1);
-		}
+	/* Calls from before the domain was enabled are replayed before
+	 * the response, and are ignored, as the captured log would be. */
+	if (!ctx->stream || !ctx->enabled || ctx->complete) {
 		return;
 	}
+
+	if (strncmp(method, "Runtime.consoleAPICalled", method_len) == 0) {
+		cmd_run_log__console_api_called(ctx, msg, len);
+	}
+}
+
+static bool cmd_run_log_tick(void *pw, bool backpressure)
+{
+	const struct run_log_ctx *ctx = pw;
+
+	CDT_UNUSED(backpressure);
+
+	if (ctx->stream) {
+		return !ctx->complete;
+	}
+
+	return timer_pending(&ctx->poll);
+}
+
+static void cmd_run_log_reconnect(void *pw)
+{
+	struct run_log_ctx *ctx = pw;
+
+	if (ctx->stream && !ctx->complete) {
+		cdt_log(CDT_LOG_NOTICE, "Re-enabling console events");
+		cmd_run_log__enable(ctx);
+	}
 }
 
 static void cmd_run_log_fini(void *pw)
 {
 	struct run_log_ctx *ctx = pw;
 
-	cyaml_free(&config, &value_schema, ctx->log, ctx->log_count);
+	timer_cancel(&ctx->poll);
+	free(ctx);
 }
 
 static void cmd_run_log_help(int argc, const char **argv);
@@ -302,6 +519,9 @@ const struct cmd_table cmd_run_log = {
 	.init = cmd_run_log_init,
 	.help = cmd_run_log_help,
 	.msg  = cmd_run_log_msg,
+	.evt  = cmd_run_log_evt,
+	.tick = cmd_run_log_tick,
+	.reconnect = cmd_run_log_reconnect,
 	.fini = cmd_run_log_fini,
 };
 
@@ -4,9 +4,11 @@
  * Copyright (c) 2022 Codethink
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <stdbool.h>
 
 #include "cmd/cmd.h"
@@ -17,10 +19,16 @@
 #include "util/cli.h"
 #include "util/log.h"
 #include "util/util.h"
+#include "util/script.h"
 
 static struct run_ctx {
 	const char *script;
-} run_ctx;
+	const char *file;
+
+	bool retried;  /**< Whether a stale cached script id was replaced. */
+
+	struct msg_ctx *msg;
+} run_g;
 
 static const struct cli_table_entry cli_entries[] = {
 	CMD_CLI_COMMON("run"),
@@ -28,45 +36,284 @@ static const struct cli_table_entry cli_entries[] = {
 		.p = true,
 		.l = "SCRIPT",
 		.t = CLI_STRING,
-		.v.s = &run_ctx.script,
+		.v.s = &run_g.script,
 		.d = "JSON-escaped JavaScript."
 	},
+	{
+		.s = 'f',
+		.l = "file",
+		.t = CLI_STRING,
+		.v.s = &run_g.file,
+		.d = "File of JavaScript to run instead of SCRIPT. "
+		     "It is escaped and streamed as it is sent."
+	},
 };
 static const struct cli_table cli = {
 	.entries = cli_entries,
 	.count = (sizeof(cli_entries))/(sizeof(*cli_entries)),
-	.min_positional = 3,
+	.min_positional = 2,
 };
 
-static bool cmd_run_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+/**
+ * Log the result of running the script.
+ *
+ * \param[in] id   Id of the message that ran the script.
+ * \param[in] msg  The response, or NULL if none came.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void cmd_run__result(int id, const char *msg, size_t len)
 {
-	int id;
+	if (msg == NULL) {
+		cdt_log(CDT_LOG_ERROR, "No result from message %i", id);
+		return;
+	}
 
-	if (!cmd_cli_parse(argc, argv, &cli, options)) {
-		return false;
+	cdt_log(CDT_LOG_NOTICE, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
+
+static bool cmd_run__scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	CDT_UNUSED(key);
+
+	*(union msg_scan_data *)pw = *value;
+	return true;
+}
+
+/**
+ * Find a value in the top level object of a response.
+ *
+ * \param[in]  msg    The response.
+ * \param[in]  len    Length of msg in bytes.
+ * \param[in]  spec   The value to find.
+ * \param[out] value  Returns the value, if found.
+ * \return true if the value was found, false otherwise.
+ */
+static bool cmd_run__scan(const char *msg, size_t len,
+		const struct msg_scan_spec *spec, union msg_scan_data *value)
+{
+	value->string.str = NULL;
+
+	return msg_str_scan(msg, len, spec, 1, cmd_run__scan_cb, value) &&
+			value->string.str != NULL;
+}
+
+static void cmd_run__compile(struct run_ctx *ctx);
+
+/**
+ * Handle the response to running a compiled script.
+ *
+ * \param[in] pw   The run context.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void cmd_run__run_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	static const struct msg_scan_spec spec = {
+		.key = "message",
+		.type = MSG_SCAN_TYPE_STRING,
+		.depth = 2,
+	};
+	struct run_ctx *ctx = pw;
+	union msg_scan_data error;
+
+	/* A script compiled in a page that has since been replaced is
+	 * unknown to the new page. Compile it there instead, once. */
+	if (!ctx->retried && cmd_run__scan(msg, len, &spec, &error)) {
+		cdt_log(CDT_LOG_INFO, "Cached script failed (%.*s), "
+				"compiling again",
+				(int)error.string.len, error.string.str);
+		script_cache_remove(msg_ctx_get_scripts(ctx->msg),
+				ctx->script);
+		ctx->retried = true;
+		cmd_run__compile(ctx);
+		return;
 	}
 
-	msg_queue_for_send(&(const struct msg)
+	cmd_run__result(id, msg, len);
+}
+
+/**
+ * Run a compiled script.
+ *
+ * \param[in] ctx        The run context.
+ * \param[in] script_id  The script's id.
+ */
+static void cmd_run__run(struct run_ctx *ctx, const char *script_id)
+{
+	msg_queue_for_send(ctx->msg, &(const struct msg)
 		{
-			.type = MSG_TYPE_EVALUATE,
+			.type = MSG_TYPE_RUN_SCRIPT,
+			.response = cmd_run__run_response,
+			.pw = ctx,
 			.data = {
-				.evaluate = {
-					.expression = run_ctx.script,
+				.run_script = {
+					.script_id = script_id,
 				},
 			},
-		}, &id);
+		}, NULL);
+}
+
+/**
+ * Handle the response to compiling the script.
+ *
+ * \param[in] pw   The run context.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void cmd_run__compile_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	static const struct msg_scan_spec spec = {
+		.key = "scriptId",
+		.type = MSG_SCAN_TYPE_STRING,
+		.depth = 2,
+	};
+	struct script_cache *scripts;
+	struct run_ctx *ctx = pw;
+	union msg_scan_data script_id;
+
+	if (!cmd_run__scan(msg, len, &spec, &script_id)) {
+		/* The script didn't compile; the response says why. */
+		cmd_run__result(id, msg, len);
+		return;
+	}
+
+	scripts = msg_ctx_get_scripts(ctx->msg);
+	if (!script_cache_set(scripts, ctx->script,
+			script_id.string.str, script_id.string.len)) {
+		return;
+	}
 
-	*pw_out = NULL;
+	cmd_run__run(ctx, script_cache_get(scripts, ctx->script));
+}
+
+/**
+ * Compile the script, to be kept in the page for running again.
+ *
+ * \param[in] ctx  The run context.
+ */
+static void cmd_run__compile(struct run_ctx *ctx)
+{
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_COMPILE_SCRIPT,
+			.response = cmd_run__compile_response,
+			.pw = ctx,
+			.data = {
+				.compile_script = {
+					.expression = ctx->script,
+				},
+			},
+		}, NULL);
+}
+
+/**
+ * Send the script.
+ *
+ * When the connection is kept open between commands, the script is
+ * compiled once and run by id after that, so repeats neither upload nor
+ * parse it again. Otherwise it is simply evaluated.
+ *
+ * A script file is always evaluated, streaming it from the file, so it is
+ * never held in memory.
+ *
+ * \param[in] ctx  The run context.
+ */
+static void cmd_run__start(struct run_ctx *ctx)
+{
+	const struct script_cache *scripts = msg_ctx_get_scripts(ctx->msg);
+	const char *script_id;
+
+	if (ctx->file != NULL) {
+		msg_queue_for_send(ctx->msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_EVALUATE_FILE,
+				.data = {
+					.evaluate_file = {
+						.path = ctx->file,
+					},
+				},
+			}, NULL);
+		return;
+	}
+
+	if (scripts == NULL) {
+		msg_queue_for_send(ctx->msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_EVALUATE,
+				.data = {
+					.evaluate = {
+						.expression = ctx->script,
+					},
+				},
+			}, NULL);
+		return;
+	}
+
+	script_id = script_cache_get(scripts, ctx->script);
+	if (script_id != NULL) {
+		cdt_log(CDT_LOG_INFO, "Running cached script %s", script_id);
+		cmd_run__run(ctx, script_id);
+	} else {
+		cmd_run__compile(ctx);
+	}
+}
+
+static bool cmd_run_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct run_ctx *ctx;
+
+	run_g = (struct run_ctx) { 0 };
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	if ((run_g.script == NULL) == (run_g.file == NULL)) {
+		cdt_log(CDT_LOG_ERROR, "Give either SCRIPT or --file");
+		return false;
+	}
+
+	if (run_g.file != NULL && access(run_g.file, R_OK) != 0) {
+		cdt_log(CDT_LOG_ERROR, "Can't read '%s': %s",
+				run_g.file, strerror(errno));
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = run_g;
+	ctx->msg = msg;
+
+	cmd_run__start(ctx);
+
+	*pw_out = ctx;
 	return true;
 }
 
 static void cmd_run_msg(void *pw, int id, const char *msg, size_t len)
 {
-	(void)(pw);
+	CDT_UNUSED(pw);
 
-	cdt_log(CDT_LOG_NOTICE, "Received message with id %i: %*s",
-			id, (int)len, msg);
+	cmd_run__result(id, msg, len);
+}
+
+static void cmd_run_fini(void *pw)
+{
+	free(pw);
 }
 
 static void cmd_run_help(int argc, const char **argv);
@@ -76,6 +323,7 @@ const struct cmd_table cmd_run = {
 	.init = cmd_run_init,
 	.help = cmd_run_help,
 	.msg  = cmd_run_msg,
+	.fini = cmd_run_fini,
 };
 
 static void cmd_run_help(int argc, const char **argv)
@@ -11,8 +11,6 @@
 #include <string.h>
 #include <stdbool.h>
 
-#include <unistd.h>
-
 #include "cmd/cmd.h"
 #include "msg/msg.h"
 #include "cmd/private.h"
@@ -27,7 +25,11 @@ static struct cmd_screencast_ctx {
 	const char *display;
 	const char *format;
 	uint64_t max_size;
-} cmd_screencast_g = {
+
+	struct msg_ctx *msg;
+} cmd_screencast_g;
+
+static const struct cmd_screencast_ctx cmd_screencast_defaults = {
 	.format = "jpeg",
 };
 
@@ -47,30 +49,49 @@ static const struct cli_table cli = {
 	.min_positional = 2,
 };
 
-static bool cmd_screencast_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+static void cmd_screencast__start(struct cmd_screencast_ctx *ctx)
 {
 	int id;
 
-	if (!cmd_cli_parse(argc, argv, &cli, options)) {
-		return false;
-	}
-
-	cmd_screencast_g.display = options->display;
-
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(ctx->msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_START_SCREENCAST,
 			.data = {
 				.start_screencast = {
-					.max_width = (int)cmd_screencast_g.max_size,
-					.max_height = (int)cmd_screencast_g.max_size,
-					.format = cmd_screencast_g.format,
+					.max_width = (int)ctx->max_size,
+					.max_height = (int)ctx->max_size,
+					.format = ctx->format,
 				},
 			},
 		}, &id);
+}
+
+static bool cmd_screencast_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct cmd_screencast_ctx *ctx;
+
+	cmd_screencast_g = cmd_screencast_defaults;
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = cmd_screencast_g;
+	ctx->display = (options->session != NULL) ?
+			options->session : options->display;
+	ctx->msg = msg;
 
-	*pw_out = &cmd_screencast_g;
+	cmd_screencast__start(ctx);
+
+	*pw_out = ctx;
 	return true;
 }
 
@@ -172,7 +193,7 @@ static void cmd_screencast_evt(void *pw, const char *method, size_t method_len,
 			return;
 		}
 
-		msg_queue_for_send(&(const struct msg)
+		msg_queue_for_send(ctx->msg, &(const struct msg)
 			{
 				.type = MSG_TYPE_SCREENCAST_FRAME_ACK,
 				.data = {
@@ -200,13 +221,37 @@ static void cmd_screencast_evt(void *pw, const char *method, size_t method_len,
 	}
 }
 
-static bool cmd_screencast_tick(void *pw)
+static bool cmd_screencast_tick(void *pw, bool backpressure)
 {
 	(void)(pw);
-	usleep(1000 * 10);
+	(void)(backpressure);
+
 	return true;
 }
 
+static bool cmd_screencast_timeout(void *pw, int id)
+{
+	(void)(pw);
+
+	/* Frames keep coming without the response; the screencast runs
+	 * until it is interrupted. */
+	cdt_log(CDT_LOG_WARNING, "Carrying on without response to %i", id);
+	return true;
+}
+
+static void cmd_screencast_reconnect(void *pw)
+{
+	struct cmd_screencast_ctx *ctx = pw;
+
+	cdt_log(CDT_LOG_NOTICE, "Restarting screencast");
+	cmd_screencast__start(ctx);
+}
+
+static void cmd_screencast_fini(void *pw)
+{
+	free(pw);
+}
+
 static void cmd_screencast_help(int argc, const char **argv);
 
 const struct cmd_table cmd_screencast = {
@@ -216,6 +261,9 @@ const struct cmd_table cmd_screencast = {
 	.msg  = cmd_screencast_msg,
 	.evt  = cmd_screencast_evt,
 	.tick = cmd_screencast_tick,
+	.reconnect = cmd_screencast_reconnect,
+	.timeout = cmd_screencast_timeout,
+	.fini = cmd_screencast_fini,
 };
 
 static void cmd_screencast_help(int argc, const char **argv)
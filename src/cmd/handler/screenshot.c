@@ -25,7 +25,9 @@ static struct cmd_screenshot_ctx {
 	const char *display;
 	const char *format;
 	bool finished;
-} cmd_screenshot_g = {
+} cmd_screenshot_g;
+
+static const struct cmd_screenshot_ctx cmd_screenshot_defaults = {
 	.format = "png",
 };
 
@@ -46,28 +48,40 @@ static const struct cli_table cli = {
 };
 
 static bool cmd_screenshot_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
+	struct cmd_screenshot_ctx *ctx;
 	int id;
 
+	cmd_screenshot_g = cmd_screenshot_defaults;
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
-	cmd_screenshot_g.display = options->display;
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = cmd_screenshot_g;
+	ctx->display = (options->session != NULL) ?
+			options->session : options->display;
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_CAPTURE_SCREENSHOT,
 			.data = {
 				.capture_screenshot = {
-					.format = cmd_screenshot_g.format,
+					.format = ctx->format,
 				},
 			},
 		}, &id);
 
-	cmd_screenshot_g.finished = false;
-	*pw_out = &cmd_screenshot_g;
+	ctx->finished = false;
+	*pw_out = ctx;
 	return true;
 }
 
@@ -135,12 +149,20 @@ static void cmd_screenshot_msg(void *pw, int id, const char *msg, size_t len)
 	ctx->finished = true;
 }
 
-static bool cmd_screenshot_tick(void *pw)
+static bool cmd_screenshot_tick(void *pw, bool backpressure)
 {
 	struct cmd_screenshot_ctx *ctx = pw;
+
+	CDT_UNUSED(backpressure);
+
 	return !ctx->finished;
 }
 
+static void cmd_screenshot_fini(void *pw)
+{
+	free(pw);
+}
+
 static void cmd_screenshot_help(int argc, const char **argv);
 
 const struct cmd_table cmd_screenshot = {
@@ -149,6 +171,7 @@ const struct cmd_table cmd_screenshot = {
 	.help = cmd_screenshot_help,
 	.msg  = cmd_screenshot_msg,
 	.tick = cmd_screenshot_tick,
+	.fini = cmd_screenshot_fini,
 };
 
 static void cmd_screenshot_help(int argc, const char **argv)
@@ -4,10 +4,12 @@
  * Copyright (c) 2022 Codethink
  */
 
+#include <time.h>
 #include <stdio.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -16,16 +18,49 @@
 
 #include "cmd/cmd.h"
 #include "msg/msg.h"
+#include "msg/queue.h"
 #include "cmd/private.h"
 
 #include "util/cli.h"
 #include "util/log.h"
 #include "util/file.h"
+#include "util/font.h"
+#include "util/time.h"
 #include "util/util.h"
+#include "util/timer.h"
 #include "util/base64.h"
 
 #define FP_SCALE (1 << 10)
 
+/** Time to wait for window resizing to settle before renegotiating (ms). */
+#define CMD_SDL_RESIZE_DEBOUNCE 250
+
+/** Minimum interval between touch move events (ms). */
+#define CMD_SDL_MOVE_INTERVAL_MIN 8
+
+/** Maximum interval between touch move events (ms). */
+#define CMD_SDL_MOVE_INTERVAL_MAX 100
+
+/** Period over which performance counters are averaged (ms). */
+#define CMD_SDL_STATS_PERIOD 1000
+
+/** Size of HUD font pixels, in window coordinates. */
+#define CMD_SDL_HUD_SCALE 2
+
+/** Maximum number of HUD rectangles to batch per draw call. */
+#define CMD_SDL_HUD_RECT_MAX 512
+
+/** Longest time to go without handling input and redrawing (ms). */
+#define CMD_SDL_WAKE_INTERVAL 10
+
+/** Round trip time tracking for one outstanding message at a time. */
+struct cmd_sdl_rtt {
+	bool waiting; /* Whether a response to `id` is awaited. */
+	int id; /* Id of the message being timed. */
+	struct timespec sent; /* Time the message was queued. */
+	int64_t rtt_us; /* Most recent round trip time. */
+};
+
 static struct cmd_sdl_ctx {
 	SDL_Window   *win;
 	SDL_Renderer *ren;
@@ -33,34 +68,96 @@ static struct cmd_sdl_ctx {
 	int window_w;
 	int window_h;
 
+	int output_w; /* Window width in physical pixels. */
+	int output_h; /* Window height in physical pixels. */
+
 	SDL_Texture *frame;
 	int frame_w;
 	int frame_h;
 
+	/* Newest frame received, still base64 encoded, or NULL. It is only
+	 * decoded when the window is drawn, so any frame that arrives first
+	 * supersedes it, and it is dropped without being decoded. */
+	char *frame_data;
+	size_t frame_data_len;
+
 	SDL_Rect frame_rect;
 
 	int device_w;
 	int device_h;
 	int device_scale;
 
+	struct {
+		int max_w; /* Requested screencast maximum width. */
+		int max_h; /* Requested screencast maximum height. */
+		int start_id; /* Id of the latest start message. */
+		bool started; /* Whether the latest start got a response. */
+		bool pending; /* Whether a resize is waiting to settle. */
+		struct timespec resized; /* Time of the last resize. */
+	} screencast;
+
 	struct {
 		bool pressed; /* Whether touch/mouse is pressed. */
-		int x_sent;
+		int x_sent; /* Last position queued for sending. */
 		int y_sent;
-		int x_last;
+		int x_last; /* Latest pointer position. */
 		int y_last;
-		int count;
+
+		bool move_outstanding; /* Whether a move awaits a response. */
+		int move_id; /* Id of the outstanding move. */
+		struct timespec move_time; /* Time the move was queued. */
+		int64_t move_srtt_us; /* Smoothed move round trip time. */
 	} mouse;
 
+	struct {
+		/* Counters accumulated over the current period. */
+		struct timespec period_start;
+		unsigned frames;
+		unsigned decoded; /* Frames decoded, rather than dropped. */
+		uint64_t bytes;
+		int64_t base64_us;
+		int64_t image_us;
+
+		/* Rates from the last complete period. */
+		unsigned fps;
+		uint64_t bytes_per_s;
+		int64_t base64_avg_us;
+		int64_t image_avg_us;
+
+		struct cmd_sdl_rtt ack;
+		struct cmd_sdl_rtt touch;
+	} stats;
+
+	struct {
+		bool show; /* Whether the performance HUD is shown. */
+		int rect_count;
+		SDL_Rect rect[CMD_SDL_HUD_RECT_MAX];
+	} hud;
+
+	struct msg_ctx *msg;
+
+	/* Wakes the main loop when there are no messages, to handle input. */
+	struct timer wake;
+	struct timer_wheel *timers;
+
 	bool quit;
 
-} cmd_sdl_g = {
+} cmd_sdl_g;
+
+static const struct cmd_sdl_ctx cmd_sdl_defaults = {
 	.window_w = 800,
 	.window_h = 600,
 };
 
 static const struct cli_table_entry cli_entries[] = {
 	CMD_CLI_COMMON("sdl"),
+	{
+		.s = 'H',
+		.l = "hud",
+		.t = CLI_BOOL,
+		.v.b = &cmd_sdl_g.hud.show,
+		.d = "Show performance overlay. Toggle with F1."
+	},
 };
 static const struct cli_table cli = {
 	.entries = cli_entries,
@@ -72,6 +169,11 @@ static void cmd_sdl_fini(void *pw)
 {
 	struct cmd_sdl_ctx *ctx = pw;
 
+	timer_cancel(&ctx->wake);
+
+	free(ctx->frame_data);
+	ctx->frame_data = NULL;
+
 	if (ctx->frame != NULL) {
 		SDL_DestroyTexture(ctx->frame);
 		ctx->frame = NULL;
@@ -88,15 +190,150 @@ static void cmd_sdl_fini(void *pw)
 	}
 }
 
-static bool cmd_sdl_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+/**
+ * Start timing the round trip for a message, unless one is outstanding.
+ *
+ * \param[in] rtt  Round trip tracking to update.
+ * \param[in] id   Id of the message that was queued.
+ */
+static void cmd_sdl__rtt_start(struct cmd_sdl_rtt *rtt, int id)
+{
+	if (rtt->waiting) {
+		return;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &rtt->sent) == 0) {
+		rtt->waiting = true;
+		rtt->id = id;
+	}
+}
+
+/**
+ * Complete round trip timing, if the response is for the timed message.
+ *
+ * \param[in] rtt  Round trip tracking to update.
+ * \param[in] id   Id of message that a response was received for.
+ */
+static void cmd_sdl__rtt_check(struct cmd_sdl_rtt *rtt, int id)
+{
+	struct timespec time_now;
+
+	if (!rtt->waiting || rtt->id != id) {
+		return;
+	}
+
+	rtt->waiting = false;
+	if (clock_gettime(CLOCK_MONOTONIC, &time_now) == 0) {
+		rtt->rtt_us = time_diff_us(&rtt->sent, &time_now);
+	}
+}
+
+/**
+ * Update the size of the window in physical pixels.
+ *
+ * On high DPI displays the renderer output is larger than the window size
+ * reported by SDL. Drawing continues in window coordinates, with the
+ * renderer scaled so that frames are presented at full resolution.
+ *
+ * \param[in] ctx  The SDL command context.
+ */
+static void cmd_sdl__update_output_size(struct cmd_sdl_ctx *ctx)
+{
+	int w;
+	int h;
+
+	if (SDL_GetRendererOutputSize(ctx->ren, &w, &h) != 0 ||
+	    w <= 0 || h <= 0) {
+		w = ctx->window_w;
+		h = ctx->window_h;
+	}
+
+	if (ctx->window_w > 0 && ctx->window_h > 0) {
+		SDL_RenderSetScale(ctx->ren,
+				(float)w / (float)ctx->window_w,
+				(float)h / (float)ctx->window_h);
+	}
+
+	ctx->output_w = w;
+	ctx->output_h = h;
+}
+
+/**
+ * (Re)start the screencast at a resolution that suits the window.
+ *
+ * Does nothing if the screencast already has the right resolution.
+ *
+ * \param[in] ctx  The SDL command context.
+ */
+static void cmd_sdl__update_screencast(struct cmd_sdl_ctx *ctx)
 {
 	int id;
+	int w = ctx->output_w;
+	int h = ctx->output_h;
+
+	ctx->screencast.pending = false;
+
+	if (w == ctx->screencast.max_w && h == ctx->screencast.max_h) {
+		return;
+	}
+
+	/* If the previous start is still unanswered, the new start can
+	 * simply supersede it. */
+	if (ctx->screencast.started) {
+		msg_queue_for_send(ctx->msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_STOP_SCREENCAST,
+			}, &id);
+	}
+
+	cdt_log(CDT_LOG_INFO, "Requesting screencast at up to %ix%i",
+			w, h);
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_START_SCREENCAST,
+			.data = {
+				.start_screencast = {
+					.format = "jpeg",
+					.max_width = w,
+					.max_height = h,
+				},
+			},
+		}, &id);
+
+	ctx->screencast.start_id = id;
+	ctx->screencast.started = false;
+	ctx->screencast.max_w = w;
+	ctx->screencast.max_h = h;
+}
+
+static void cmd_sdl__wake(void *pw)
+{
+	struct cmd_sdl_ctx *ctx = pw;
+
+	/* Just waking the main loop to tick is enough. */
+	timer_schedule(ctx->timers, &ctx->wake, CMD_SDL_WAKE_INTERVAL);
+}
+
+static bool cmd_sdl_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	cmd_sdl_g = cmd_sdl_defaults;
 
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
+	if (options->all) {
+		cdt_log(CDT_LOG_ERROR, "sdl: Only one page is supported");
+		return false;
+	}
+
+	cmd_sdl_g.msg = msg;
+	cmd_sdl_g.timers = options->timers;
+	timer_init(&cmd_sdl_g.wake, cmd_sdl__wake, &cmd_sdl_g);
+
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		cdt_log(CDT_LOG_ERROR, "SDL_Init Error: %s", SDL_GetError());
 		goto error;
@@ -106,7 +343,8 @@ static bool cmd_sdl_init(int argc, const char **argv,
 			SDL_WINDOWPOS_CENTERED,
 			SDL_WINDOWPOS_CENTERED,
 			cmd_sdl_g.window_w, cmd_sdl_g.window_h,
-			SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+			SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE |
+			SDL_WINDOW_ALLOW_HIGHDPI);
 	if (cmd_sdl_g.win == NULL) {
 		cdt_log(CDT_LOG_ERROR, "SDL_CreateWindow Error: %s",
 				SDL_GetError());
@@ -133,18 +371,13 @@ static bool cmd_sdl_init(int argc, const char **argv,
 	}
 
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+	SDL_SetRenderDrawBlendMode(cmd_sdl_g.ren, SDL_BLENDMODE_BLEND);
 
-	msg_queue_for_send(&(const struct msg)
-		{
-			.type = MSG_TYPE_START_SCREENCAST,
-			.data = {
-				.start_screencast = {
-					.format = "jpeg",
-					.max_width = 512,
-					.max_height = 512,
-				},
-			},
-		}, &id);
+	clock_gettime(CLOCK_MONOTONIC, &cmd_sdl_g.stats.period_start);
+
+	cmd_sdl__update_output_size(&cmd_sdl_g);
+	cmd_sdl__update_screencast(&cmd_sdl_g);
+	cmd_sdl__wake(&cmd_sdl_g);
 
 	*pw_out = &cmd_sdl_g;
 	return true;
@@ -154,12 +387,48 @@ error:
 	return false;
 }
 
+/**
+ * Handle a response, in case it completes the outstanding touch move.
+ *
+ * \param[in] ctx  The SDL command context.
+ * \param[in] id   Id of message that a response was received for.
+ */
+static void cmd_sdl__touch_move_response(struct cmd_sdl_ctx *ctx, int id)
+{
+	struct timespec time_now;
+	int64_t rtt;
+
+	if (!ctx->mouse.move_outstanding || ctx->mouse.move_id != id) {
+		return;
+	}
+
+	ctx->mouse.move_outstanding = false;
+	if (clock_gettime(CLOCK_MONOTONIC, &time_now) == -1) {
+		return;
+	}
+
+	rtt = time_diff_us(&ctx->mouse.move_time, &time_now);
+	if (ctx->mouse.move_srtt_us == 0) {
+		ctx->mouse.move_srtt_us = rtt;
+	} else {
+		ctx->mouse.move_srtt_us += (rtt - ctx->mouse.move_srtt_us) / 8;
+	}
+}
+
 static void cmd_sdl_msg(void *pw, int id, const char *msg, size_t len)
 {
-	CDT_UNUSED(pw);
-	CDT_UNUSED(id);
+	struct cmd_sdl_ctx *ctx = pw;
+
 	CDT_UNUSED(msg);
 	CDT_UNUSED(len);
+
+	if (id == ctx->screencast.start_id) {
+		ctx->screencast.started = true;
+	}
+
+	cmd_sdl__rtt_check(&ctx->stats.ack, id);
+	cmd_sdl__rtt_check(&ctx->stats.touch, id);
+	cmd_sdl__touch_move_response(ctx, id);
 }
 
 struct scan_ctx {
@@ -224,6 +493,8 @@ static void cmd_sdl__update_frame_rect(struct cmd_sdl_ctx *ctx)
 static void cmd_sdl__handle_frame(struct cmd_sdl_ctx *ctx,
 		uint8_t *data, size_t len)
 {
+	struct timespec time_start;
+	struct timespec time_end;
 	SDL_Surface *surface;
 	SDL_Texture *texture;
 	SDL_RWops *ops;
@@ -237,8 +508,11 @@ static void cmd_sdl__handle_frame(struct cmd_sdl_ctx *ctx,
 		return;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
 	surface = IMG_Load_RW(ops, 0);
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
 	SDL_RWclose(ops);
+	ctx->stats.image_us += time_diff_us(&time_start, &time_end);
 	if (surface == NULL) {
 		cdt_log(CDT_LOG_ERROR, "IMG_Load_RW Error: %s", IMG_GetError());
 		return;
@@ -307,10 +581,12 @@ static void cmd_sdl_evt(void *pw, const char *method, size_t method_len,
 			.spec = spec,
 			.found = 0,
 		};
-		size_t scr_len;
-		uint8_t *scr;
+		char *data;
 		int id;
 
+		ctx->stats.frames++;
+		ctx->stats.bytes += len;
+
 		if (!msg_str_scan(msg, len,
 				spec, CDT_ARRAY_COUNT(spec),
 				cmd_sdl_msg_scan_cb, &scan)) {
@@ -327,7 +603,7 @@ static void cmd_sdl_evt(void *pw, const char *method, size_t method_len,
 			return;
 		}
 
-		msg_queue_for_send(&(const struct msg)
+		if (msg_queue_for_send(ctx->msg, &(const struct msg)
 			{
 				.type = MSG_TYPE_SCREENCAST_FRAME_ACK,
 				.data = {
@@ -335,90 +611,244 @@ static void cmd_sdl_evt(void *pw, const char *method, size_t method_len,
 						.session_id = scan.session_id,
 					},
 				},
-			}, &id);
+			}, &id)) {
+			cmd_sdl__rtt_start(&ctx->stats.ack, id);
+		}
 
-		if (!base64_decode(
-				scan.data,
-				scan.data_len,
-				&scr, &scr_len)) {
-			cdt_log(CDT_LOG_ERROR, "%s: Base64 decode failed",
+		/* Keep the frame to decode when the window is next drawn,
+		 * replacing any older frame that is still waiting. */
+		data = strndup(scan.data, scan.data_len);
+		if (data == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
 					__func__);
 			return;
 		}
 
-		cmd_sdl__handle_frame(ctx, scr, scr_len);
-		free(scr);
+		free(ctx->frame_data);
+		ctx->frame_data = data;
+		ctx->frame_data_len = scan.data_len;
+	}
+}
+
+/**
+ * Decode the newest frame received, if there is one waiting.
+ *
+ * \param[in] ctx  The SDL command context.
+ */
+static void cmd_sdl__decode_frame(struct cmd_sdl_ctx *ctx)
+{
+	struct timespec time_start;
+	struct timespec time_end;
+	size_t scr_len;
+	uint8_t *scr;
+	bool decoded;
+
+	if (ctx->frame_data == NULL) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+	decoded = base64_decode(ctx->frame_data, ctx->frame_data_len,
+			&scr, &scr_len);
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+	ctx->stats.base64_us += time_diff_us(&time_start, &time_end);
+
+	free(ctx->frame_data);
+	ctx->frame_data = NULL;
+
+	if (!decoded) {
+		cdt_log(CDT_LOG_ERROR, "%s: Base64 decode failed", __func__);
+		return;
 	}
+
+	ctx->stats.decoded++;
+	cmd_sdl__handle_frame(ctx, scr, scr_len);
+	free(scr);
 }
 
 static void cmd_sdl__resize(struct cmd_sdl_ctx *ctx, int w, int h)
 {
 	ctx->window_w = w;
 	ctx->window_h = h;
-	cmd_sdl__update_frame_rect(ctx);
+	cmd_sdl__update_output_size(ctx);
+	if (ctx->frame != NULL) {
+		cmd_sdl__update_frame_rect(ctx);
+	}
+
+	/* Renegotiate the screencast resolution once resizing settles. */
+	if (clock_gettime(CLOCK_MONOTONIC, &ctx->screencast.resized) == 0) {
+		ctx->screencast.pending = true;
+	}
 }
 
-#define CMD_SDL_MOTION_RATE_LIMIT 4
+static void cmd_sdl__check_resize(struct cmd_sdl_ctx *ctx)
+{
+	struct timespec time_now;
 
-static void cmd_sdl__tap(struct cmd_sdl_ctx *ctx, int x, int y)
+	if (!ctx->screencast.pending) {
+		return;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &time_now) == -1) {
+		return;
+	}
+
+	if (time_diff_ms(&ctx->screencast.resized, &time_now) >=
+			CMD_SDL_RESIZE_DEBOUNCE) {
+		cmd_sdl__update_screencast(ctx);
+	}
+}
+
+/**
+ * Create a touch event message for a position in the window.
+ *
+ * \param[in] ctx   The SDL command context.
+ * \param[in] type  The touch event message type.
+ * \param[in] x     X coordinate in window coordinates.
+ * \param[in] y     Y coordinate in window coordinates.
+ * \return the touch event message.
+ */
+static struct msg cmd_sdl__touch_msg(const struct cmd_sdl_ctx *ctx,
+		enum msg_type type, int x, int y)
 {
-	int id;
 	int scale = ctx->device_scale;
 	int frame_x = ctx->frame_rect.x;
 	int frame_y = ctx->frame_rect.y;
 
-	if (ctx->mouse.pressed) {
-		if (ctx->mouse.x_sent == x &&
-		    ctx->mouse.y_sent == y) {
+	return (struct msg) {
+		.type = type,
+		.data = {
+			.touch_event = {
+				.x = (x - frame_x) * scale / FP_SCALE,
+				.y = (y - frame_y) * scale / FP_SCALE,
+			},
+		},
+	};
+}
+
+static void cmd_sdl__touch_start(struct cmd_sdl_ctx *ctx, int x, int y)
+{
+	struct msg msg = cmd_sdl__touch_msg(ctx,
+			MSG_TYPE_TOUCH_EVENT_START, x, y);
+	int id;
+
+	cdt_log(CDT_LOG_NOTICE, "Pressed at (%i, %i)",
+			msg.data.touch_event.x,
+			msg.data.touch_event.y);
+
+	if (msg_queue_for_send(ctx->msg, &msg, &id)) {
+		cmd_sdl__rtt_start(&ctx->stats.touch, id);
+	}
+
+	ctx->mouse.pressed = true;
+	ctx->mouse.x_sent = ctx->mouse.x_last = x;
+	ctx->mouse.y_sent = ctx->mouse.y_last = y;
+}
+
+/**
+ * Get the minimum interval between touch moves.
+ *
+ * Follows the round trip time, so that slow links get fewer, larger moves.
+ *
+ * \param[in] ctx  The SDL command context.
+ * \return the interval in ms.
+ */
+static int64_t cmd_sdl__move_interval(const struct cmd_sdl_ctx *ctx)
+{
+	int64_t interval = ctx->mouse.move_srtt_us / 2000;
+
+	if (interval < CMD_SDL_MOVE_INTERVAL_MIN) {
+		return CMD_SDL_MOVE_INTERVAL_MIN;
+	} else if (interval > CMD_SDL_MOVE_INTERVAL_MAX) {
+		return CMD_SDL_MOVE_INTERVAL_MAX;
+	}
+
+	return interval;
+}
+
+/**
+ * Send the latest pointer position as a touch move, if appropriate.
+ *
+ * At most one move is outstanding at a time. While the outstanding move is
+ * still waiting in the send queue it is updated in place with the latest
+ * position. Otherwise new moves wait for the response to the outstanding
+ * one, and for the minimum move interval to pass.
+ *
+ * \param[in] ctx    The SDL command context.
+ * \param[in] flush  Whether to send the latest position regardless.
+ */
+static void cmd_sdl__touch_move(struct cmd_sdl_ctx *ctx, bool flush)
+{
+	struct timespec time_now = { 0 };
+	struct msg msg;
+	int id;
+
+	if (ctx->mouse.x_last == ctx->mouse.x_sent &&
+	    ctx->mouse.y_last == ctx->mouse.y_sent) {
+		return;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &time_now) == -1) {
+		flush = true;
+	}
+
+	msg = cmd_sdl__touch_msg(ctx, MSG_TYPE_TOUCH_EVENT_MOVE,
+			ctx->mouse.x_last, ctx->mouse.y_last);
+
+	if (ctx->mouse.move_outstanding) {
+		int id_old = ctx->mouse.move_id;
+
+		if (msg_queue_for_send_replace(ctx->msg, &msg,
+				id_old, &id)) {
+			if (ctx->stats.touch.waiting &&
+			    ctx->stats.touch.id == id_old) {
+				ctx->stats.touch.id = id;
+			}
+			ctx->mouse.move_id = id;
+			ctx->mouse.x_sent = ctx->mouse.x_last;
+			ctx->mouse.y_sent = ctx->mouse.y_last;
 			return;
 		}
 
-		/* Rate limit move events. */
-		if (ctx->mouse.count++ < CMD_SDL_MOTION_RATE_LIMIT) {
-			ctx->mouse.x_last = x;
-			ctx->mouse.y_last = y;
+		if (!flush) {
 			return;
-		} else {
-			ctx->mouse.count = 0;
 		}
-	} else {
-		cdt_log(CDT_LOG_NOTICE, "Pressed at (%i, %i)",
-				(x - frame_x) * scale / FP_SCALE,
-				(y - frame_y) * scale / FP_SCALE);
+	} else if (!flush && time_diff_ms(&ctx->mouse.move_time, &time_now) <
+			cmd_sdl__move_interval(ctx)) {
+		return;
 	}
 
-	msg_queue_for_send(&(const struct msg)
-		{
-			.type = ctx->mouse.pressed ?
-					MSG_TYPE_TOUCH_EVENT_MOVE :
-					MSG_TYPE_TOUCH_EVENT_START,
-			.data = {
-				.touch_event = {
-					.x = (x - frame_x) * scale / FP_SCALE,
-					.y = (y - frame_y) * scale / FP_SCALE,
-				},
-			},
-		}, &id);
+	if (!msg_queue_for_send(ctx->msg, &msg, &id)) {
+		return;
+	}
+	cmd_sdl__rtt_start(&ctx->stats.touch, id);
 
-	ctx->mouse.x_sent = x;
-	ctx->mouse.y_sent = y;
+	ctx->mouse.move_outstanding = true;
+	ctx->mouse.move_id = id;
+	ctx->mouse.move_time = time_now;
+	ctx->mouse.x_sent = ctx->mouse.x_last;
+	ctx->mouse.y_sent = ctx->mouse.y_last;
 }
 
-static void cmd_sdl__flush_motion(struct cmd_sdl_ctx *ctx)
+static void cmd_sdl__touch_end(struct cmd_sdl_ctx *ctx, int x, int y)
 {
-	if (ctx->mouse.pressed && ctx->mouse.count > 0) {
-		if (ctx->mouse.x_sent != ctx->mouse.x_last ||
-		    ctx->mouse.y_sent != ctx->mouse.y_last) {
-			ctx->mouse.count = CMD_SDL_MOTION_RATE_LIMIT;
-			cmd_sdl__tap(ctx, ctx->mouse.x_last, ctx->mouse.y_last);
-		}
+	int id;
+
+	ctx->mouse.x_last = x;
+	ctx->mouse.y_last = y;
+	cmd_sdl__touch_move(ctx, true);
+	ctx->mouse.pressed = false;
+
+	if (msg_queue_for_send(ctx->msg, &(const struct msg) {
+			.type = MSG_TYPE_TOUCH_EVENT_END,
+		}, &id)) {
+		cmd_sdl__rtt_start(&ctx->stats.touch, id);
 	}
 }
 
 static bool cmd_sdl__handle_input(struct cmd_sdl_ctx *ctx)
 {
 	static SDL_Event event;
-	int id;
 
 	while (SDL_PollEvent(&event)) {
 		switch (event.type) {
@@ -431,6 +861,10 @@ static bool cmd_sdl__handle_input(struct cmd_sdl_ctx *ctx)
 			case SDLK_ESCAPE:
 				ctx->quit = true;
 				return false;
+
+			case SDLK_F1:
+				ctx->hud.show = !ctx->hud.show;
+				break;
 			}
 			break;
 
@@ -445,24 +879,26 @@ static bool cmd_sdl__handle_input(struct cmd_sdl_ctx *ctx)
 			break;
 
 		case SDL_MOUSEBUTTONUP:
-			cmd_sdl__tap(ctx, event.button.x, event.button.y);
-			cmd_sdl__flush_motion(ctx);
-			ctx->mouse.pressed = false;
-			msg_queue_for_send(&(const struct msg) {
-					.type = MSG_TYPE_TOUCH_EVENT_END,
-				}, &id);
+			if (ctx->mouse.pressed) {
+				cmd_sdl__touch_end(ctx,
+						event.button.x,
+						event.button.y);
+			}
 			break;
 
 		case SDL_MOUSEBUTTONDOWN:
-			cmd_sdl__tap(ctx, event.button.x, event.button.y);
-			ctx->mouse.pressed = true;
+			if (!ctx->mouse.pressed) {
+				cmd_sdl__touch_start(ctx,
+						event.button.x,
+						event.button.y);
+			}
 			break;
 
 		case SDL_MOUSEMOTION:
 			if (ctx->mouse.pressed) {
-				cmd_sdl__tap(ctx,
-						event.button.x,
-						event.button.y);
+				ctx->mouse.x_last = event.motion.x;
+				ctx->mouse.y_last = event.motion.y;
+				cmd_sdl__touch_move(ctx, false);
 			}
 			break;
 
@@ -471,21 +907,184 @@ static bool cmd_sdl__handle_input(struct cmd_sdl_ctx *ctx)
 		}
 	}
 
-	cmd_sdl__flush_motion(ctx);
+	if (ctx->mouse.pressed) {
+		cmd_sdl__touch_move(ctx, false);
+	}
+	cmd_sdl__check_resize(ctx);
 
 	return true;
 }
 
-static bool cmd_sdl_tick(void *pw)
+/**
+ * Roll the performance counters over, once per stats period.
+ *
+ * \param[in] ctx  The SDL command context.
+ */
+static void cmd_sdl__update_stats(struct cmd_sdl_ctx *ctx)
+{
+	struct timespec time_now;
+	int64_t period;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &time_now) == -1) {
+		return;
+	}
+
+	period = time_diff_ms(&ctx->stats.period_start, &time_now);
+	if (period < CMD_SDL_STATS_PERIOD) {
+		return;
+	}
+
+	ctx->stats.fps = (unsigned)(ctx->stats.frames * 1000 / period);
+	ctx->stats.bytes_per_s = ctx->stats.bytes * 1000 / (uint64_t)period;
+	if (ctx->stats.decoded > 0) {
+		ctx->stats.base64_avg_us = ctx->stats.base64_us /
+				ctx->stats.decoded;
+		ctx->stats.image_avg_us = ctx->stats.image_us /
+				ctx->stats.decoded;
+	}
+
+	cdt_log(CDT_LOG_DEBUG, "Frames: %u fps, %u dropped, %" PRIu64 " B/s, "
+			"decode: base64 %" PRIi64 " us, image %" PRIi64 " us",
+			ctx->stats.fps, ctx->stats.frames - ctx->stats.decoded,
+			ctx->stats.bytes_per_s,
+			ctx->stats.base64_avg_us, ctx->stats.image_avg_us);
+
+	ctx->stats.frames = 0;
+	ctx->stats.decoded = 0;
+	ctx->stats.bytes = 0;
+	ctx->stats.base64_us = 0;
+	ctx->stats.image_us = 0;
+	ctx->stats.period_start = time_now;
+}
+
+static void cmd_sdl__hud_flush(struct cmd_sdl_ctx *ctx)
+{
+	if (ctx->hud.rect_count > 0) {
+		SDL_RenderFillRects(ctx->ren, ctx->hud.rect,
+				ctx->hud.rect_count);
+		ctx->hud.rect_count = 0;
+	}
+}
+
+static void cmd_sdl__hud_pixel(struct cmd_sdl_ctx *ctx, int x, int y)
+{
+	SDL_Rect *r;
+
+	if (ctx->hud.rect_count == CMD_SDL_HUD_RECT_MAX) {
+		cmd_sdl__hud_flush(ctx);
+	}
+
+	r = &ctx->hud.rect[ctx->hud.rect_count++];
+	r->x = x;
+	r->y = y;
+	r->w = CMD_SDL_HUD_SCALE;
+	r->h = CMD_SDL_HUD_SCALE;
+}
+
+/**
+ * Draw a line of text in the HUD.
+ *
+ * Glyph pixels are batched as rectangles, so no allocation is required.
+ *
+ * \param[in] ctx   The SDL command context.
+ * \param[in] x     Left edge of text in window coordinates.
+ * \param[in] y     Top edge of text in window coordinates.
+ * \param[in] text  The text to draw.
+ */
+static void cmd_sdl__hud_text(struct cmd_sdl_ctx *ctx,
+		int x, int y, const char *text)
+{
+	for (; *text != '\0'; text++) {
+		const uint8_t *glyph = font_get_glyph(*text);
+
+		for (int i = 0; glyph != NULL &&
+				i < FONT_GLYPH_W * FONT_GLYPH_H; i++) {
+			int row = i / FONT_GLYPH_W;
+			int col = i % FONT_GLYPH_W;
+
+			if (glyph[row] & (1 << (FONT_GLYPH_W - 1 - col))) {
+				cmd_sdl__hud_pixel(ctx,
+						x + col * CMD_SDL_HUD_SCALE,
+						y + row * CMD_SDL_HUD_SCALE);
+			}
+		}
+
+		x += (FONT_GLYPH_W + 1) * CMD_SDL_HUD_SCALE;
+	}
+}
+
+static void cmd_sdl__hud_draw(struct cmd_sdl_ctx *ctx)
+{
+	enum {
+		HUD_LINES = 7,
+		HUD_PAD = 4 * CMD_SDL_HUD_SCALE,
+		HUD_LINE_H = (FONT_GLYPH_H + 2) * CMD_SDL_HUD_SCALE,
+		HUD_W = 24 * (FONT_GLYPH_W + 1) * CMD_SDL_HUD_SCALE,
+	};
+	const SDL_Rect bg = {
+		.x = 0,
+		.y = 0,
+		.w = HUD_W + 2 * HUD_PAD,
+		.h = HUD_LINES * HUD_LINE_H + 2 * HUD_PAD,
+	};
+	char line[64];
+	int y = HUD_PAD;
+
+	SDL_SetRenderDrawColor(ctx->ren, 0x00, 0x00, 0x00, 0xb0);
+	SDL_RenderFillRect(ctx->ren, &bg);
+	SDL_SetRenderDrawColor(ctx->ren, 0x40, 0xff, 0x40, 0xff);
+
+	snprintf(line, sizeof(line), "FPS       %u", ctx->stats.fps);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "RX        %.1f KB/S",
+			(double)ctx->stats.bytes_per_s / 1024);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "BASE64    %.2f MS",
+			(double)ctx->stats.base64_avg_us / 1000);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "JPEG      %.2f MS",
+			(double)ctx->stats.image_avg_us / 1000);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "ACK RTT   %.1f MS",
+			(double)ctx->stats.ack.rtt_us / 1000);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "TOUCH RTT %.1f MS",
+			(double)ctx->stats.touch.rtt_us / 1000);
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+	y += HUD_LINE_H;
+
+	snprintf(line, sizeof(line), "SEND Q    %u",
+			msg_queue_send_count(ctx->msg));
+	cmd_sdl__hud_text(ctx, HUD_PAD, y, line);
+
+	cmd_sdl__hud_flush(ctx);
+}
+
+static bool cmd_sdl_tick(void *pw, bool backpressure)
 {
 	struct cmd_sdl_ctx *ctx = pw;
 	bool running;
 
+	/* Input must stay responsive, and touch moves are already paced
+	 * to one in flight, so backpressure is not needed here. */
+	CDT_UNUSED(backpressure);
+
 	if (ctx->win == NULL || ctx->ren == NULL) {
 		return false;
 	}
 
 	running = cmd_sdl__handle_input(ctx);
+	cmd_sdl__update_stats(ctx);
 	if (running) {
 		SDL_Color bg = {
 			.r = 0x0,
@@ -493,12 +1092,17 @@ static bool cmd_sdl_tick(void *pw)
 			.b = 0x0,
 		};
 
+		cmd_sdl__decode_frame(ctx);
+
 		SDL_SetRenderDrawColor(ctx->ren, bg.r, bg.g, bg.b, 255);
 		SDL_RenderClear(ctx->ren);
 		if (ctx->frame != NULL) {
 			SDL_RenderCopy(ctx->ren, ctx->frame,
 					NULL, &ctx->frame_rect);
 		}
+		if (ctx->hud.show) {
+			cmd_sdl__hud_draw(ctx);
+		}
 		SDL_RenderPresent(ctx->ren);
 	}
 
@@ -507,6 +1111,40 @@ static bool cmd_sdl_tick(void *pw)
 
 static void cmd_sdl_help(int argc, const char **argv);
 
+static void cmd_sdl_reconnect(void *pw)
+{
+	struct cmd_sdl_ctx *ctx = pw;
+
+	/* Anything awaiting a response on the old connection is lost. */
+	ctx->stats.ack.waiting = false;
+	ctx->stats.touch.waiting = false;
+	ctx->mouse.move_outstanding = false;
+
+	/* The new connection has no screencast running. */
+	ctx->screencast.started = false;
+	ctx->screencast.max_w = 0;
+	ctx->screencast.max_h = 0;
+	cmd_sdl__update_screencast(ctx);
+}
+
+static bool cmd_sdl_timeout(void *pw, int id)
+{
+	struct cmd_sdl_ctx *ctx = pw;
+
+	/* Stop waiting, so timing and touch moves carry on. */
+	if (ctx->stats.ack.waiting && ctx->stats.ack.id == id) {
+		ctx->stats.ack.waiting = false;
+	}
+	if (ctx->stats.touch.waiting && ctx->stats.touch.id == id) {
+		ctx->stats.touch.waiting = false;
+	}
+	if (ctx->mouse.move_outstanding && ctx->mouse.move_id == id) {
+		ctx->mouse.move_outstanding = false;
+	}
+
+	return true;
+}
+
 const struct cmd_table cmd_sdl = {
 	.cmd  = "sdl",
 	.init = cmd_sdl_init,
@@ -514,6 +1152,8 @@ const struct cmd_table cmd_sdl = {
 	.msg  = cmd_sdl_msg,
 	.evt  = cmd_sdl_evt,
 	.tick = cmd_sdl_tick,
+	.reconnect = cmd_sdl_reconnect,
+	.timeout = cmd_sdl_timeout,
 	.fini = cmd_sdl_fini,
 };
 
@@ -24,7 +24,9 @@ static struct swipe_ctx {
 	int64_t speed;
 	int64_t direction;
 	int64_t dist;
-} swipe_ctx = {
+} swipe_ctx;
+
+static const struct swipe_ctx swipe_defaults = {
 	.speed = 800,
 };
 
@@ -91,12 +93,15 @@ static const struct cli_table cli = {
 };
 
 static bool cmd_swipe_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
 	int id;
 	int x_dist = 0;
 	int y_dist = 0;
 
+	swipe_ctx = swipe_defaults;
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
@@ -108,7 +113,7 @@ static bool cmd_swipe_init(int argc, const char **argv,
 	case CMD_SWIPE_RIGHT: x_dist =  (int)swipe_ctx.dist; break;
 	}
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_SCROLL_GESTURE,
 			.data = {
@@ -0,0 +1,199 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cmd/cmd.h"
+#include "cmd/locate.h"
+#include "cmd/private.h"
+
+#include "msg/msg.h"
+
+#include "util/cli.h"
+#include "util/log.h"
+#include "util/util.h"
+
+static struct tap_all_ctx {
+	const char *selector;
+	bool measure; /**< Whether to print the boxes rather than tap. */
+
+	struct locate_query query;
+
+	struct msg_ctx *msg;
+} tap_all_g;
+
+static const struct cli_table_entry cli_entries[] = {
+	CMD_CLI_COMMON("tap-all"),
+	{
+		.p = true,
+		.l = "SELECTOR",
+		.t = CLI_STRING,
+		.v.s = &tap_all_g.selector,
+		.d = "JSON-escaped CSS selector of the elements to tap."
+	},
+	{
+		.s = 'm',
+		.l = "measure",
+		.t = CLI_BOOL,
+		.v.b = &tap_all_g.measure,
+		.d = "Print each element's centre and size, without tapping."
+	},
+};
+static const struct cli_table cli = {
+	.entries = cli_entries,
+	.count = (sizeof(cli_entries))/(sizeof(*cli_entries)),
+	.min_positional = 3,
+};
+
+static void cmd_tap_all__located(void *pw,
+		const struct locate_box *box, unsigned count);
+
+static bool cmd_tap_all_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct tap_all_ctx *ctx;
+
+	tap_all_g = (struct tap_all_ctx) { 0 };
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = tap_all_g;
+	ctx->msg = msg;
+
+	/* A query that is done at once has already reported. */
+	locate_query_start(&ctx->query, msg, ctx->selector, true,
+			cmd_tap_all__located, ctx);
+
+	*pw_out = ctx;
+	return true;
+}
+
+/**
+ * Queue the touch events to tap a point.
+ *
+ * \param[in] ctx  The tap-all context.
+ * \param[in] x    X coordinate to tap.
+ * \param[in] y    Y coordinate to tap.
+ */
+static void cmd_tap_all__tap(struct tap_all_ctx *ctx, int x, int y)
+{
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_START,
+			.data = {
+				.touch_event = {
+					.x = x,
+					.y = y,
+				},
+			},
+		}, NULL);
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_END,
+		}, NULL);
+}
+
+/**
+ * Tap or measure the elements, once they have been located.
+ *
+ * The taps are all queued at once, in document order, so they are sent
+ * back to back, limited only by the send window.
+ *
+ * \param[in] pw     The tap-all context.
+ * \param[in] box    The elements' boxes.
+ * \param[in] count  Number of elements located.
+ */
+static void cmd_tap_all__located(void *pw,
+		const struct locate_box *box, unsigned count)
+{
+	struct tap_all_ctx *ctx = pw;
+	unsigned tapped = 0;
+
+	if (count == 0) {
+		cdt_log(CDT_LOG_ERROR, "Error: Could not locate: '%s'",
+				ctx->selector);
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		if (!box[i].found || box[i].w <= 0 || box[i].h <= 0 ||
+		    box[i].x < 0 || box[i].y < 0) {
+			cdt_log(CDT_LOG_INFO, "Skipping hidden element %u", i);
+			continue;
+		}
+
+		if (ctx->measure) {
+			printf("%g %g %g %g\n",
+					box[i].x, box[i].y,
+					box[i].w, box[i].h);
+		} else {
+			cmd_tap_all__tap(ctx, (int)box[i].x, (int)box[i].y);
+		}
+		tapped++;
+	}
+
+	cdt_log(CDT_LOG_NOTICE, "%s %u of %u elements matching '%s'",
+			ctx->measure ? "Measured" : "Tapping",
+			tapped, count, ctx->selector);
+}
+
+static void cmd_tap_all_msg(void *pw, int id, const char *msg, size_t len)
+{
+	(void)(pw);
+
+	cdt_log(CDT_LOG_INFO, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
+
+static bool cmd_tap_all_tick(void *pw, bool backpressure)
+{
+	struct tap_all_ctx *ctx = pw;
+
+	CDT_UNUSED(backpressure);
+
+	return !ctx->query.done;
+}
+
+static void cmd_tap_all_fini(void *pw)
+{
+	struct tap_all_ctx *ctx = pw;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	locate_query_fini(&ctx->query);
+	free(ctx);
+}
+
+static void cmd_tap_all_help(int argc, const char **argv);
+
+const struct cmd_table cmd_tap_all = {
+	.cmd  = "tap-all",
+	.init = cmd_tap_all_init,
+	.help = cmd_tap_all_help,
+	.msg  = cmd_tap_all_msg,
+	.tick = cmd_tap_all_tick,
+	.fini = cmd_tap_all_fini,
+};
+
+static void cmd_tap_all_help(int argc, const char **argv)
+{
+	cli_help(&cli, (argc > 0) ? argv[0] : "cdt");
+}
@@ -0,0 +1,171 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cmd/cmd.h"
+#include "cmd/locate.h"
+#include "cmd/private.h"
+
+#include "msg/msg.h"
+
+#include "util/cli.h"
+#include "util/log.h"
+#include "util/util.h"
+
+static struct tap_css_ctx {
+	const char *selector;
+
+	struct locate_query query;
+
+	struct msg_ctx *msg;
+} tap_css_g;
+
+static const struct cli_table_entry cli_entries[] = {
+	CMD_CLI_COMMON("tap-css"),
+	{
+		.p = true,
+		.l = "SELECTOR",
+		.t = CLI_STRING,
+		.v.s = &tap_css_g.selector,
+		.d = "JSON-escaped CSS selector of the element to tap."
+	},
+};
+static const struct cli_table cli = {
+	.entries = cli_entries,
+	.count = (sizeof(cli_entries))/(sizeof(*cli_entries)),
+	.min_positional = 3,
+};
+
+static void cmd_tap_css__located(void *pw,
+		const struct locate_box *box, unsigned count);
+
+static bool cmd_tap_css_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct tap_css_ctx *ctx;
+
+	tap_css_g = (struct tap_css_ctx) { 0 };
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = tap_css_g;
+	ctx->msg = msg;
+
+	/* A query that is done at once has already reported. */
+	locate_query_start(&ctx->query, msg, ctx->selector, false,
+			cmd_tap_css__located, ctx);
+
+	*pw_out = ctx;
+	return true;
+}
+
+/**
+ * Tap the element, once it has been located.
+ *
+ * \param[in] pw     The tap-css context.
+ * \param[in] box    The element's box.
+ * \param[in] count  Number of elements located.
+ */
+static void cmd_tap_css__located(void *pw,
+		const struct locate_box *box, unsigned count)
+{
+	struct tap_css_ctx *ctx = pw;
+	int x;
+	int y;
+
+	if (count == 0) {
+		cdt_log(CDT_LOG_ERROR, "Error: Could not locate: '%s'",
+				ctx->selector);
+		return;
+	}
+
+	if (!box->found || box->w <= 0 || box->h <= 0 ||
+	    box->x < 0 || box->y < 0) {
+		cdt_log(CDT_LOG_ERROR, "Element '%s' is not visible!",
+				ctx->selector);
+		return;
+	}
+
+	x = (int)box->x;
+	y = (int)box->y;
+
+	cdt_log(CDT_LOG_NOTICE, "Tapping '%s' at: (%d, %d)",
+			ctx->selector, x, y);
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_START,
+			.data = {
+				.touch_event = {
+					.x = x,
+					.y = y,
+				},
+			},
+		}, NULL);
+
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_TOUCH_EVENT_END,
+		}, NULL);
+}
+
+static void cmd_tap_css_msg(void *pw, int id, const char *msg, size_t len)
+{
+	(void)(pw);
+
+	cdt_log(CDT_LOG_INFO, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
+
+static bool cmd_tap_css_tick(void *pw, bool backpressure)
+{
+	struct tap_css_ctx *ctx = pw;
+
+	CDT_UNUSED(backpressure);
+
+	return !ctx->query.done;
+}
+
+static void cmd_tap_css_fini(void *pw)
+{
+	struct tap_css_ctx *ctx = pw;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	locate_query_fini(&ctx->query);
+	free(ctx);
+}
+
+static void cmd_tap_css_help(int argc, const char **argv);
+
+const struct cmd_table cmd_tap_css = {
+	.cmd  = "tap-css",
+	.init = cmd_tap_css_init,
+	.help = cmd_tap_css_help,
+	.msg  = cmd_tap_css_msg,
+	.tick = cmd_tap_css_tick,
+	.fini = cmd_tap_css_fini,
+};
+
+static void cmd_tap_css_help(int argc, const char **argv)
+{
+	cli_help(&cli, (argc > 0) ? argv[0] : "cdt");
+}
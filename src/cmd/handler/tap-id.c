@@ -5,11 +5,11 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-
-#include <cyaml/cyaml.h>
+#include <inttypes.h>
 
 #include "cmd/cmd.h"
 #include "cmd/private.h"
@@ -19,38 +19,74 @@
 #include "util/cli.h"
 #include "util/log.h"
 #include "util/util.h"
-#include "util/decode.h"
-
-/* The log messages arrive as an array of arrays as a JSON string.
- * These are the schema to decode that to a `char ***` type. */
 
 static struct tap_id_ctx {
 	const char *id;
+	bool wait; /**< Whether to wait for the element to appear. */
 
-	int vw;
-	int vh;
-
-	int msg_id_vw;
-	int msg_id_vh;
-	int msg_id_pos;
+	struct msg_ctx *msg;
 } tap_id_ctx;
 
 /**
- * Construct a JavaScript script to query an element's position.
+ * Construct a JavaScript script to locate an element in the viewport.
  *
- * \param[in] id  Identifies which element to get the position of.
+ * The script gives the viewport size and the element's position together,
+ * so only one round trip is needed. If the element isn't there, it gives
+ * null, or when waiting, a promise that settles once the element is added.
+ * The page stops watching for the element after the timeout, so nothing is
+ * left observing the document once the response is no longer wanted.
+ *
+ * \param[in] id          Identifies which element to get the position of.
+ * \param[in] wait        Whether to wait for the element to appear.
+ * \param[in] timeout_ms  Time to wait for the element, or 0 for ever.
  * \return Script to execute, or NULL on error.
  */
-static char *cmd_tap_id__get_pos_script(const char *id)
+static char *cmd_tap_id__get_pos_script(const char *id, bool wait,
+		int64_t timeout_ms)
 {
 	int written;
 	char *str = NULL;
 	static const char *id_position_script =
-		"JSON.stringify(document"
-		"    .getElementById('%s')"
-		"    .getBoundingClientRect());";
-
-	written = asprintf(&str, id_position_script, id);
+		"(() => {"
+		"    const id = '%s';"
+		"    const locate = (el) => {"
+		"        const r = el.getBoundingClientRect();"
+		"        return {"
+		"            vw: window.innerWidth,"
+		"            vh: window.innerHeight,"
+		"            x: r.x, y: r.y, width: r.width, height: r.height,"
+		"        };"
+		"    };"
+		"    const el = document.getElementById(id);"
+		"    if (el !== null || !%s) {"
+		"        return el && locate(el);"
+		"    }"
+		"    const timeout = %" PRIi64 ";"
+		"    return new Promise((resolve) => {"
+		"        let timer;"
+		"        const observer = new MutationObserver(() => {"
+		"            const el = document.getElementById(id);"
+		"            if (el !== null) {"
+		"                observer.disconnect();"
+		"                clearTimeout(timer);"
+		"                resolve(locate(el));"
+		"            }"
+		"        });"
+		"        observer.observe(document, {"
+		"            childList: true, subtree: true,"
+		"            attributes: true, attributeFilter: ['id'],"
+		"        });"
+		"        if (timeout > 0) {"
+		"            timer = setTimeout(() => {"
+		"                observer.disconnect();"
+		"                resolve(null);"
+		"            }, timeout);"
+		"        }"
+		"    });"
+		"})()";
+
+	written = asprintf(&str, id_position_script, id,
+			wait ? "true" : "false", timeout_ms);
 	if (written < 0) {
 		return NULL;
 	}
@@ -67,6 +103,13 @@ static const struct cli_table_entry cli_entries[] = {
 		.v.s = &tap_id_ctx.id,
 		.d = "An element ID attribute to tap."
 	},
+	{
+		.s = 'W',
+		.l = "wait",
+		.t = CLI_BOOL,
+		.v.b = &tap_id_ctx.wait,
+		.d = "Wait for the element to appear, up to the timeout."
+	},
 };
 static const struct cli_table cli = {
 	.entries = cli_entries,
@@ -74,148 +117,183 @@ static const struct cli_table cli = {
 	.min_positional = 3,
 };
 
+static void cmd_tap_id__pos_response(void *pw, int id,
+		const char *msg, size_t len);
+
 static bool cmd_tap_id_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
+	struct tap_id_ctx *ctx;
 	char *script;
 
+	tap_id_ctx = (struct tap_id_ctx) { 0 };
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
-	script = cmd_tap_id__get_pos_script(tap_id_ctx.id);
-	if (script == NULL) {
-		cdt_log(CDT_LOG_ERROR, "Failed to generate script for id %s",
-				tap_id_ctx.id);
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
 		return false;
 	}
 
-	/* Get the viewport width. */
-	msg_queue_for_send(&(const struct msg)
-		{
-			.type = MSG_TYPE_EVALUATE,
-			.data = {
-				.evaluate = {
-					.expression = "window.innerWidth",
-				},
-			},
-		}, &tap_id_ctx.msg_id_vw);
+	*ctx = tap_id_ctx;
+	ctx->msg = msg;
 
-	/* Get the viewport height. */
-	msg_queue_for_send(&(const struct msg)
-		{
-			.type = MSG_TYPE_EVALUATE,
-			.data = {
-				.evaluate = {
-					.expression = "window.innerHeight",
-				},
-			},
-		}, &tap_id_ctx.msg_id_vh);
+	script = cmd_tap_id__get_pos_script(ctx->id, ctx->wait,
+			options->timeout);
+	if (script == NULL) {
+		cdt_log(CDT_LOG_ERROR, "Failed to generate script for id %s",
+				ctx->id);
+		free(ctx);
+		return false;
+	}
 
 	/* Send element position acquisition script. */
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_EVALUATE,
+			.response = cmd_tap_id__pos_response,
+			.pw = ctx,
 			.data = {
 				.evaluate = {
 					.expression = script,
+					.await_promise = ctx->wait,
+					.return_by_value = true,
 				},
 			},
-		}, &tap_id_ctx.msg_id_pos);
+		}, NULL);
 
 	free(script);
 	script = NULL;
 
-	*pw_out = NULL;
+	*pw_out = ctx;
 	return true;
 }
 
+/** Position of an element, and the viewport it is in. */
 struct element_pos {
-	int x;
-	int y;
-	int w;
-	int h;
-	int b;
-	int r;
+	double vw;
+	double vh;
+	double x;
+	double y;
+	double w;
+	double h;
+	unsigned found; /**< Bit set of the fields found. */
 };
 
-static const struct cyaml_schema_field element_pos_fields_schema[] = {
-	CYAML_FIELD_INT("x", CYAML_FLAG_DEFAULT, struct element_pos, x),
-	CYAML_FIELD_INT("y", CYAML_FLAG_DEFAULT, struct element_pos, y),
-	CYAML_FIELD_INT("width", CYAML_FLAG_DEFAULT, struct element_pos, w),
-	CYAML_FIELD_INT("height", CYAML_FLAG_DEFAULT, struct element_pos, h),
-	CYAML_FIELD_INT("bottom", CYAML_FLAG_DEFAULT, struct element_pos, b),
-	CYAML_FIELD_INT("right", CYAML_FLAG_DEFAULT, struct element_pos, r),
-	CYAML_FIELD_END
+enum element_pos_field {
+	ELEMENT_POS_VW,
+	ELEMENT_POS_VH,
+	ELEMENT_POS_X,
+	ELEMENT_POS_Y,
+	ELEMENT_POS_W,
+	ELEMENT_POS_H,
+	ELEMENT_POS__COUNT,
 };
 
-static const struct cyaml_schema_value element_pos_schema = {
-	CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct element_pos,
-			element_pos_fields_schema),
+/* The fields are in the result's value object, in the order of
+ * \ref element_pos_field. */
+static const struct msg_scan_spec element_pos_spec[] = {
+	[ELEMENT_POS_VW] = { .key = "vw",     .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[ELEMENT_POS_VH] = { .key = "vh",     .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[ELEMENT_POS_X]  = { .key = "x",      .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[ELEMENT_POS_Y]  = { .key = "y",      .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[ELEMENT_POS_W]  = { .key = "width",  .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[ELEMENT_POS_H]  = { .key = "height", .depth = 4,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
 };
 
-static const cyaml_config_t config = {
-	.flags = CYAML_CFG_IGNORE_UNKNOWN_KEYS,
-	.log_level = CYAML_LOG_WARNING,
-	.mem_fn = cyaml_mem,
-	.log_fn = cyaml_log,
-};
+static bool cmd_tap_id__pos_scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	struct element_pos *pos = pw;
+	double *field[] = {
+		[ELEMENT_POS_VW] = &pos->vw,
+		[ELEMENT_POS_VH] = &pos->vh,
+		[ELEMENT_POS_X]  = &pos->x,
+		[ELEMENT_POS_Y]  = &pos->y,
+		[ELEMENT_POS_W]  = &pos->w,
+		[ELEMENT_POS_H]  = &pos->h,
+	};
+	unsigned i = (unsigned)(key - element_pos_spec);
+
+	*field[i] = value->floating_point;
+	pos->found |= 1u << i;
+
+	return pos->found == (1u << ELEMENT_POS__COUNT) - 1;
+}
 
-static void cmd_tap_id__do_tap(const char *pos_msg)
+static void cmd_tap_id__do_tap(struct tap_id_ctx *ctx,
+		const struct element_pos *pos)
 {
-	struct element_pos *pos;
-	cyaml_err_t res;
+	int x = (int)(pos->x + pos->w / 2);
+	int y = (int)(pos->y + pos->h / 2);
 	int id;
 
-	res = cyaml_load_data((const uint8_t *)pos_msg, strlen(pos_msg),
-			&config, &element_pos_schema,
-			(void **)&pos, NULL);
-	if (res != CYAML_OK) {
-		cdt_log(CDT_LOG_ERROR,
-				"Failed to parse response: %s",
-				cyaml_strerror(res));
-		cdt_log(CDT_LOG_ERROR,
-				"Error could not locate ID: %s",
-				tap_id_ctx.id);
-		return;
-	}
-
-	if (pos->x < 0 || pos->r >= tap_id_ctx.vw ||
-	    pos->y < 0 || pos->b >= tap_id_ctx.vh) {
+	if (pos->x < 0 || pos->x + pos->w >= pos->vw ||
+	    pos->y < 0 || pos->y + pos->h >= pos->vh) {
 		cdt_log(CDT_LOG_ERROR,
 				"Element '%s' outside viewport!",
-				tap_id_ctx.id);
-		cdt_log(CDT_LOG_NOTICE, " Viewport width  : %i", tap_id_ctx.vw);
-		cdt_log(CDT_LOG_NOTICE, " Viewport height : %i", tap_id_ctx.vh);
-		cdt_log(CDT_LOG_NOTICE, " Element left    : %i", pos->x);
-		cdt_log(CDT_LOG_NOTICE, " Element right   : %i", pos->r);
-		cdt_log(CDT_LOG_NOTICE, " Element top     : %i", pos->y);
-		cdt_log(CDT_LOG_NOTICE, " Element bottom  : %i", pos->b);
+				ctx->id);
+		cdt_log(CDT_LOG_NOTICE, " Viewport width  : %g", pos->vw);
+		cdt_log(CDT_LOG_NOTICE, " Viewport height : %g", pos->vh);
+		cdt_log(CDT_LOG_NOTICE, " Element left    : %g", pos->x);
+		cdt_log(CDT_LOG_NOTICE, " Element right   : %g",
+				pos->x + pos->w);
+		cdt_log(CDT_LOG_NOTICE, " Element top     : %g", pos->y);
+		cdt_log(CDT_LOG_NOTICE, " Element bottom  : %g",
+				pos->y + pos->h);
 		return;
 	}
 
-	cdt_log(CDT_LOG_NOTICE, "Tapping '%s' at: (%d, %d)",
-			tap_id_ctx.id,
-			pos->x + pos->w / 2,
-			pos->y + pos->h / 2);
+	cdt_log(CDT_LOG_NOTICE, "Tapping '%s' at: (%d, %d)", ctx->id, x, y);
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(ctx->msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_TOUCH_EVENT_START,
 			.data = {
 				.touch_event = {
-					.x = pos->x + pos->w / 2,
-					.y = pos->y + pos->h / 2,
+					.x = x,
+					.y = y,
 				},
 			},
 		}, &id);
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(ctx->msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_TOUCH_EVENT_END,
 		}, &id);
+}
+
+static void cmd_tap_id__pos_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	struct tap_id_ctx *ctx = pw;
+	struct element_pos pos = { 0 };
+
+	CDT_UNUSED(id);
+
+	/* A missing element gives a null result, with no value object. */
+	msg_str_scan(msg, len, element_pos_spec,
+			CDT_ARRAY_COUNT(element_pos_spec),
+			cmd_tap_id__pos_scan_cb, &pos);
+	if (pos.found != (1u << ELEMENT_POS__COUNT) - 1) {
+		cdt_log(CDT_LOG_ERROR, "Error: Could not locate ID: '%s'",
+				ctx->id);
+		return;
+	}
 
-	cyaml_free(&config, &element_pos_schema, pos, 0);
+	cmd_tap_id__do_tap(ctx, &pos);
 }
 
 static void cmd_tap_id_msg(void *pw, int id, const char *msg, size_t len)
@@ -224,39 +302,11 @@ static void cmd_tap_id_msg(void *pw, int id, const char *msg, size_t len)
 
 	cdt_log(CDT_LOG_INFO, "Received message with id %i: %*s",
 			id, (int)len, msg);
+}
 
-	if (id == tap_id_ctx.msg_id_vw) {
-		bool res = decode_extract_response_value_int(msg, len,
-				&tap_id_ctx.vw);
-		if (res == false) {
-			cdt_log(CDT_LOG_ERROR,
-					"Error: Could not get viewport width");
-			return;
-		}
-
-	} else if (id == tap_id_ctx.msg_id_vh) {
-		bool res = decode_extract_response_value_int(msg, len,
-				&tap_id_ctx.vh);
-		if (res == false) {
-			cdt_log(CDT_LOG_ERROR,
-					"Error: Could not get viewport height");
-			return;
-		}
-
-	} else if (id == tap_id_ctx.msg_id_pos) {
-		char *value;
-
-		value = decode_extract_response_value(msg, len);
-		if (value == NULL) {
-			cdt_log(CDT_LOG_ERROR,
-					"Error: Could not locate ID: '%s'",
-					tap_id_ctx.id);
-			return;
-		}
-
-		cmd_tap_id__do_tap(value);
-		free(value);
-	}
+static void cmd_tap_id_fini(void *pw)
+{
+	free(pw);
 }
 
 static void cmd_tap_id_help(int argc, const char **argv);
@@ -266,6 +316,7 @@ const struct cmd_table cmd_tap_id = {
 	.init = cmd_tap_id_init,
 	.help = cmd_tap_id_help,
 	.msg  = cmd_tap_id_msg,
+	.fini = cmd_tap_id_fini,
 };
 
 static void cmd_tap_id_help(int argc, const char **argv)
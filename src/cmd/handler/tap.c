@@ -47,15 +47,18 @@ static const struct cli_table cli = {
 };
 
 static bool cmd_tap_init(int argc, const char **argv,
-		struct cmd_options *options, void **pw_out)
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
 {
 	int id;
 
+	tap_ctx = (struct tap_ctx) { 0 };
+
 	if (!cmd_cli_parse(argc, argv, &cli, options)) {
 		return false;
 	}
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_TOUCH_EVENT_START,
 			.data = {
@@ -66,7 +69,7 @@ static bool cmd_tap_init(int argc, const char **argv,
 			},
 		}, &id);
 
-	msg_queue_for_send(&(const struct msg)
+	msg_queue_for_send(msg, &(const struct msg)
 		{
 			.type = MSG_TYPE_TOUCH_EVENT_END,
 		}, &id);
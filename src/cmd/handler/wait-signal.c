@@ -0,0 +1,230 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cmd/cmd.h"
+#include "cmd/private.h"
+
+#include "msg/msg.h"
+
+#include "util/cli.h"
+#include "util/log.h"
+#include "util/util.h"
+#include "util/decode.h"
+
+static struct wait_signal_ctx {
+	const char *script;
+	const char *name;
+
+	bool signalled; /**< Whether the page has called the binding. */
+
+	struct msg_ctx *msg;
+} wait_signal_g;
+
+static const struct wait_signal_ctx wait_signal_defaults = {
+	.name = "cdtSignal",
+};
+
+static const struct cli_table_entry cli_entries[] = {
+	CMD_CLI_COMMON("wait-signal"),
+	{
+		.p = true,
+		.l = "SCRIPT",
+		.t = CLI_STRING,
+		.v.s = &wait_signal_g.script,
+		.d = "JSON-escaped JavaScript to run once the binding is added."
+	},
+	{
+		.s = 'n',
+		.l = "name",
+		.t = CLI_STRING,
+		.v.s = &wait_signal_g.name,
+		.d = "Name of the function the page calls to signal. "
+		     "The default is 'cdtSignal'."
+	},
+};
+static const struct cli_table cli = {
+	.entries = cli_entries,
+	.count = (sizeof(cli_entries))/(sizeof(*cli_entries)),
+	.min_positional = 2,
+};
+
+/**
+ * Check a binding name is a plain JavaScript identifier.
+ *
+ * \param[in] name  The binding name.
+ * \return true if the name is valid, false otherwise.
+ */
+static bool cmd_wait_signal__valid_name(const char *name)
+{
+	if (name[0] == '\0' || isdigit((unsigned char)name[0])) {
+		return false;
+	}
+
+	for (const char *c = name; *c != '\0'; c++) {
+		if (!isalnum((unsigned char)*c) && *c != '_' && *c != '$') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Add the binding to the page.
+ *
+ * \param[in] ctx  The wait-signal context.
+ */
+static void cmd_wait_signal__add_binding(struct wait_signal_ctx *ctx)
+{
+	msg_queue_for_send(ctx->msg, &(const struct msg)
+		{
+			.type = MSG_TYPE_ADD_BINDING,
+			.data = {
+				.binding = {
+					.name = ctx->name,
+				},
+			},
+		}, NULL);
+}
+
+static bool cmd_wait_signal_init(int argc, const char **argv,
+		struct cmd_options *options,
+		struct msg_ctx *msg, void **pw_out)
+{
+	struct wait_signal_ctx *ctx;
+
+	wait_signal_g = wait_signal_defaults;
+
+	if (!cmd_cli_parse(argc, argv, &cli, options)) {
+		return false;
+	}
+
+	if (!cmd_wait_signal__valid_name(wait_signal_g.name)) {
+		cdt_log(CDT_LOG_ERROR, "Invalid binding name: '%s'",
+				wait_signal_g.name);
+		return false;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	*ctx = wait_signal_g;
+	ctx->msg = msg;
+
+	/* The binding is a control message, so it is added before the
+	 * script runs. */
+	cmd_wait_signal__add_binding(ctx);
+
+	if (ctx->script != NULL) {
+		msg_queue_for_send(msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_EVALUATE,
+				.data = {
+					.evaluate = {
+						.expression = ctx->script,
+					},
+				},
+			}, NULL);
+	}
+
+	*pw_out = ctx;
+	return true;
+}
+
+static void cmd_wait_signal_msg(void *pw, int id, const char *msg, size_t len)
+{
+	(void)(pw);
+
+	cdt_log(CDT_LOG_INFO, "Received message with id %i: %*s",
+			id, (int)len, msg);
+}
+
+static void cmd_wait_signal_evt(void *pw, const char *method,
+		size_t method_len, const char *msg, size_t len)
+{
+	struct wait_signal_ctx *ctx = pw;
+	char *payload;
+	char *name;
+
+	if (ctx->signalled ||
+	    strncmp(method, "Runtime.bindingCalled", method_len) != 0) {
+		return;
+	}
+
+	if (!decode_extract_binding_call(msg, len, &name, &payload)) {
+		return;
+	}
+
+	if (strcmp(name, ctx->name) == 0) {
+		printf("%s\n", payload);
+		ctx->signalled = true;
+
+		msg_queue_for_send(ctx->msg, &(const struct msg)
+			{
+				.type = MSG_TYPE_REMOVE_BINDING,
+				.data = {
+					.binding = {
+						.name = ctx->name,
+					},
+				},
+			}, NULL);
+	}
+
+	free(payload);
+	free(name);
+}
+
+static bool cmd_wait_signal_tick(void *pw, bool backpressure)
+{
+	const struct wait_signal_ctx *ctx = pw;
+
+	CDT_UNUSED(backpressure);
+
+	return !ctx->signalled;
+}
+
+static void cmd_wait_signal_reconnect(void *pw)
+{
+	struct wait_signal_ctx *ctx = pw;
+
+	if (!ctx->signalled) {
+		cdt_log(CDT_LOG_NOTICE, "Adding binding '%s' again",
+				ctx->name);
+		cmd_wait_signal__add_binding(ctx);
+	}
+}
+
+static void cmd_wait_signal_fini(void *pw)
+{
+	free(pw);
+}
+
+static void cmd_wait_signal_help(int argc, const char **argv);
+
+const struct cmd_table cmd_wait_signal = {
+	.cmd  = "wait-signal",
+	.init = cmd_wait_signal_init,
+	.help = cmd_wait_signal_help,
+	.msg  = cmd_wait_signal_msg,
+	.evt  = cmd_wait_signal_evt,
+	.tick = cmd_wait_signal_tick,
+	.reconnect = cmd_wait_signal_reconnect,
+	.fini = cmd_wait_signal_fini,
+};
+
+static void cmd_wait_signal_help(int argc, const char **argv)
+{
+	cli_help(&cli, (argc > 0) ? argv[0] : "cdt");
+}
@@ -0,0 +1,649 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cmd/locate.h"
+
+#include "msg/msg.h"
+
+#include "util/log.h"
+#include "util/util.h"
+#include "util/locate.h"
+
+static void locate__get_document(struct locate_query *query);
+
+/** A value found in a response. */
+struct locate_scan {
+	union msg_scan_data value;
+	bool found;
+};
+
+static bool locate__scan_cb(void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	struct locate_scan *result = pw;
+
+	CDT_UNUSED(key);
+
+	result->value = *value;
+	result->found = true;
+	return true;
+}
+
+/**
+ * Scan a response for a single value.
+ *
+ * \param[in]  msg    The response.
+ * \param[in]  len    Length of msg in bytes.
+ * \param[in]  spec   The value to look for.
+ * \param[out] value  Returns the value, if found.
+ * \return true if the value was found, false otherwise.
+ */
+static bool locate__scan(const char *msg, size_t len,
+		const struct msg_scan_spec *spec, union msg_scan_data *value)
+{
+	struct locate_scan result = { 0 };
+
+	msg_str_scan(msg, len, spec, 1, locate__scan_cb, &result);
+	if (result.found) {
+		*value = result.value;
+	}
+
+	return result.found;
+}
+
+/**
+ * Get the error message from a response, if it is an error.
+ *
+ * \param[in]  msg    The response.
+ * \param[in]  len    Length of msg in bytes.
+ * \param[out] error  Returns the error message, if there is one.
+ * \return true if the response is an error, false otherwise.
+ */
+static bool locate__error(const char *msg, size_t len,
+		union msg_scan_data *error)
+{
+	static const struct msg_scan_spec spec = {
+		.key = "message",
+		.type = MSG_SCAN_TYPE_STRING,
+		.depth = 2,
+	};
+
+	return locate__scan(msg, len, &spec, error);
+}
+
+/**
+ * Get whether a response rejects a nodeId that DevTools no longer knows.
+ *
+ * Other errors, such as a node that isn't rendered having no box model,
+ * won't be fixed by finding the nodes again.
+ *
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ * \return true if the response is a stale nodeId error, false otherwise.
+ */
+static bool locate__stale_node(const char *msg, size_t len)
+{
+	static const char *const stale[] = {
+		"Could not find node with given id",
+		"No node with given id found",
+	};
+	union msg_scan_data error;
+
+	if (!locate__error(msg, len, &error)) {
+		return false;
+	}
+
+	for (unsigned i = 0; i < CDT_ARRAY_COUNT(stale); i++) {
+		size_t stale_len = strlen(stale[i]);
+
+		if (error.string.len >= stale_len &&
+		    memcmp(error.string.str, stale[i], stale_len) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Free the nodes found by a query.
+ *
+ * Responses to any box model requests still in flight are ignored.
+ *
+ * \param[in] query  The query.
+ */
+static void locate__free_nodes(struct locate_query *query)
+{
+	free(query->node_ids);
+	free(query->msg_ids);
+	free(query->box);
+
+	query->node_ids = NULL;
+	query->msg_ids = NULL;
+	query->box = NULL;
+	query->count = 0;
+	query->pending = 0;
+}
+
+/**
+ * Finish a query, passing the boxes found to the query's callback.
+ *
+ * \param[in] query  The query.
+ */
+static void locate__done(struct locate_query *query)
+{
+	query->done = true;
+	query->fn(query->pw, query->box, query->count);
+}
+
+/**
+ * Handle a rejected request.
+ *
+ * The first time, the query starts again from the document, in case the
+ * nodeIds it used had gone stale. After that, the query fails.
+ *
+ * \param[in] query  The query.
+ * \param[in] msg    The response.
+ * \param[in] len    Length of msg in bytes.
+ */
+static void locate__failed(struct locate_query *query,
+		const char *msg, size_t len)
+{
+	union msg_scan_data error = { 0 };
+
+	locate__error(msg, len, &error);
+	locate__free_nodes(query);
+
+	if (query->retried) {
+		cdt_log(CDT_LOG_ERROR, "Failed to locate '%s': %.*s",
+				query->selector,
+				(int)error.string.len, error.string.str);
+		locate__done(query);
+		return;
+	}
+
+	cdt_log(CDT_LOG_INFO, "Locating '%s' failed (%.*s), trying again",
+			query->selector,
+			(int)error.string.len, error.string.str);
+
+	locate_cache_clear(msg_ctx_get_locate(query->msg));
+	query->document = 0;
+	query->retried = true;
+	locate__get_document(query);
+}
+
+/**
+ * Fail a query whose request got no response.
+ *
+ * \param[in] query  The query.
+ */
+static void locate__no_response(struct locate_query *query)
+{
+	cdt_log(CDT_LOG_ERROR, "Failed to locate '%s': No response",
+			query->selector);
+	locate__free_nodes(query);
+	locate__done(query);
+}
+
+/**
+ * Send a message for a query, failing the query if it can't be queued.
+ *
+ * \param[in]  query   The query.
+ * \param[in]  msg     The message to queue.
+ * \param[out] id_out  Returns the id of the message on success, or NULL.
+ * \return true on success, false otherwise.
+ */
+static bool locate__send(struct locate_query *query,
+		const struct msg *msg, int *id_out)
+{
+	if (!msg_queue_for_send(query->msg, msg, id_out)) {
+		cdt_log(CDT_LOG_ERROR, "Failed to locate '%s'",
+				query->selector);
+		locate__free_nodes(query);
+		locate__done(query);
+		return false;
+	}
+
+	return true;
+}
+
+/** Fields of a node's box model. */
+enum locate_box_field {
+	LOCATE_BOX_CONTENT,
+	LOCATE_BOX_WIDTH,
+	LOCATE_BOX_HEIGHT,
+	LOCATE_BOX__COUNT,
+};
+
+/* The fields are in the result's model object, in the order of
+ * \ref locate_box_field. */
+static const struct msg_scan_spec locate_box_spec[] = {
+	[LOCATE_BOX_CONTENT] = { .key = "content", .depth = 3,
+			.type = MSG_SCAN_TYPE_ARRAY },
+	[LOCATE_BOX_WIDTH]   = { .key = "width",   .depth = 3,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+	[LOCATE_BOX_HEIGHT]  = { .key = "height",  .depth = 3,
+			.type = MSG_SCAN_TYPE_FLOATING_POINT },
+};
+
+struct locate_box_scan {
+	struct locate_box *box;
+	unsigned found; /**< Bit set of the fields found. */
+};
+
+/**
+ * Get the centre of a quad.
+ *
+ * \param[in]  str  The quad's array contents: four x, y pairs.
+ * \param[in]  len  Length of str in bytes.
+ * \param[out] box  Returns the quad's centre.
+ * \return true on success, false otherwise.
+ */
+static bool locate__quad_centre(const char *str, size_t len,
+		struct locate_box *box)
+{
+	const char *end = str + len;
+	const char *pos = str;
+	double sum[2] = { 0 };
+
+	for (unsigned i = 0; i < 8; i++) {
+		char *fin = NULL;
+		double value;
+
+		while (pos < end && (*pos == ',' || *pos == ' ')) {
+			pos++;
+		}
+		if (pos >= end) {
+			return false;
+		}
+
+		value = strtod(pos, &fin);
+		if (fin == pos) {
+			return false;
+		}
+
+		sum[i & 1] += value;
+		pos = fin;
+	}
+
+	box->x = sum[0] / 4;
+	box->y = sum[1] / 4;
+	return true;
+}
+
+static bool locate__box_scan_cb(
+		void *pw,
+		const struct msg_scan_spec *key,
+		const union  msg_scan_data *value)
+{
+	struct locate_box_scan *scan = pw;
+	unsigned i = (unsigned)(key - locate_box_spec);
+
+	switch (i) {
+	case LOCATE_BOX_CONTENT:
+		if (!locate__quad_centre(value->string.str,
+				value->string.len, scan->box)) {
+			return true;
+		}
+		break;
+	case LOCATE_BOX_WIDTH:
+		scan->box->w = value->floating_point;
+		break;
+	case LOCATE_BOX_HEIGHT:
+		scan->box->h = value->floating_point;
+		break;
+	}
+	scan->found |= 1u << i;
+
+	return scan->found == (1u << LOCATE_BOX__COUNT) - 1;
+}
+
+/**
+ * Handle the response to getting a node's box model.
+ *
+ * \param[in] pw   The query.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void locate__box_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	struct locate_query *query = pw;
+	struct locate_box_scan scan = { 0 };
+	unsigned i;
+
+	for (i = 0; i < query->count; i++) {
+		if (query->msg_ids[i] == id) {
+			break;
+		}
+	}
+	if (query->done || i == query->count) {
+		/* From before the query started again. */
+		return;
+	}
+
+	if (msg == NULL) {
+		locate__no_response(query);
+		return;
+	}
+
+	scan.box = &query->box[i];
+	msg_str_scan(msg, len, locate_box_spec,
+			CDT_ARRAY_COUNT(locate_box_spec),
+			locate__box_scan_cb, &scan);
+	if (scan.found == (1u << LOCATE_BOX__COUNT) - 1) {
+		query->box[i].found = true;
+
+	} else if (!query->retried && locate__stale_node(msg, len)) {
+		locate__failed(query, msg, len);
+		return;
+
+	} else {
+		/* Nodes that aren't rendered have no box model. */
+		cdt_log(CDT_LOG_INFO, "No box for node %i matching '%s'",
+				query->node_ids[i], query->selector);
+	}
+
+	query->msg_ids[i] = -1;
+
+	if (--query->pending == 0) {
+		locate__done(query);
+	}
+}
+
+/**
+ * Get the box models of every node found, all at once.
+ *
+ * \param[in] query     The query.
+ * \param[in] node_ids  The nodes found.
+ * \param[in] count     Number of nodes found.
+ */
+static void locate__get_boxes(struct locate_query *query,
+		const int *node_ids, unsigned count)
+{
+	locate__free_nodes(query);
+
+	query->node_ids = malloc(count * sizeof(*query->node_ids));
+	query->msg_ids = malloc(count * sizeof(*query->msg_ids));
+	query->box = calloc(count, sizeof(*query->box));
+	if (query->node_ids == NULL ||
+	    query->msg_ids == NULL ||
+	    query->box == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		locate__free_nodes(query);
+		locate__done(query);
+		return;
+	}
+
+	memcpy(query->node_ids, node_ids, count * sizeof(*node_ids));
+	query->count = count;
+	query->pending = count;
+
+	for (unsigned i = 0; i < count; i++) {
+		if (!locate__send(query, &(const struct msg)
+			{
+				.type = MSG_TYPE_GET_BOX_MODEL,
+				.response = locate__box_response,
+				.pw = query,
+				.data = {
+					.get_box_model = {
+						.node_id = node_ids[i],
+					},
+				},
+			}, &query->msg_ids[i])) {
+			return;
+		}
+	}
+}
+
+/**
+ * Parse an array of nodeIds.
+ *
+ * \param[in]  str        The array's contents.
+ * \param[in]  len        Length of str in bytes.
+ * \param[out] count_out  Returns the number of nodeIds.
+ * \return the nodeIds, or NULL on error.
+ */
+static int *locate__parse_node_ids(const char *str, size_t len,
+		unsigned *count_out)
+{
+	const char *end = str + len;
+	const char *pos = str;
+	unsigned count = 1;
+	int *node_ids;
+
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] == ',') {
+			count++;
+		}
+	}
+
+	node_ids = malloc(count * sizeof(*node_ids));
+	if (node_ids == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	count = 0;
+	while (pos < end) {
+		char *fin = NULL;
+		long value;
+
+		if (*pos == ',' || *pos == ' ') {
+			pos++;
+			continue;
+		}
+
+		value = strtol(pos, &fin, 10);
+		if (fin == pos || value <= 0 || value > INT32_MAX) {
+			free(node_ids);
+			return NULL;
+		}
+
+		node_ids[count++] = (int)value;
+		pos = fin;
+	}
+
+	*count_out = count;
+	return node_ids;
+}
+
+/**
+ * Handle the response to querying the document.
+ *
+ * \param[in] pw   The query.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void locate__query_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	static const struct msg_scan_spec spec_one = {
+		.key = "nodeId",
+		.type = MSG_SCAN_TYPE_INTEGER,
+		.depth = 2,
+	};
+	static const struct msg_scan_spec spec_all = {
+		.key = "nodeIds",
+		.type = MSG_SCAN_TYPE_ARRAY,
+		.depth = 2,
+	};
+	struct locate_query *query = pw;
+	union msg_scan_data value;
+	unsigned count = 0;
+	int *node_ids;
+
+	CDT_UNUSED(id);
+
+	if (msg == NULL) {
+		locate__no_response(query);
+		return;
+	}
+
+	if (!locate__scan(msg, len, query->all ? &spec_all : &spec_one,
+			&value)) {
+		locate__failed(query, msg, len);
+		return;
+	}
+
+	if (query->all) {
+		node_ids = locate__parse_node_ids(value.string.str,
+				value.string.len, &count);
+		if (node_ids == NULL) {
+			cdt_log(CDT_LOG_ERROR, "Failed to locate '%s'",
+					query->selector);
+			locate__done(query);
+			return;
+		}
+	} else {
+		/* A nodeId of 0 means nothing matched. */
+		node_ids = malloc(sizeof(*node_ids));
+		if (node_ids == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			locate__done(query);
+			return;
+		}
+		node_ids[0] = (int)value.integer;
+		count = (value.integer > 0) ? 1 : 0;
+	}
+
+	if (count == 0) {
+		/* Not cached, as the elements may yet be added. */
+		free(node_ids);
+		locate__done(query);
+		return;
+	}
+
+	locate_cache_set(msg_ctx_get_locate(query->msg),
+			query->selector, query->all, node_ids, count);
+	locate__get_boxes(query, node_ids, count);
+	free(node_ids);
+}
+
+/**
+ * Find the nodes that match the selector.
+ *
+ * \param[in] query  The query.
+ */
+static void locate__query(struct locate_query *query)
+{
+	locate__send(query, &(const struct msg)
+		{
+			.type = query->all ?
+					MSG_TYPE_QUERY_SELECTOR_ALL :
+					MSG_TYPE_QUERY_SELECTOR,
+			.response = locate__query_response,
+			.pw = query,
+			.data = {
+				.query_selector = {
+					.node_id = query->document,
+					.selector = query->selector,
+				},
+			},
+		}, NULL);
+}
+
+/**
+ * Handle the response to getting the document.
+ *
+ * \param[in] pw   The query.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response.
+ * \param[in] len  Length of msg in bytes.
+ */
+static void locate__document_response(void *pw, int id,
+		const char *msg, size_t len)
+{
+	static const struct msg_scan_spec spec = {
+		.key = "nodeId",
+		.type = MSG_SCAN_TYPE_INTEGER,
+		.depth = 3,
+	};
+	struct locate_query *query = pw;
+	union msg_scan_data value;
+
+	CDT_UNUSED(id);
+
+	if (msg == NULL) {
+		locate__no_response(query);
+		return;
+	}
+
+	if (!locate__scan(msg, len, &spec, &value) ||
+	    value.integer <= 0 || value.integer > INT32_MAX) {
+		/* Don't start again; there are no nodeIds to go stale. */
+		query->retried = true;
+		locate__failed(query, msg, len);
+		return;
+	}
+
+	query->document = (int)value.integer;
+	locate_cache_set_document(msg_ctx_get_locate(query->msg),
+			query->document);
+	locate__query(query);
+}
+
+/**
+ * Get the document's nodeId.
+ *
+ * \param[in] query  The query.
+ */
+static void locate__get_document(struct locate_query *query)
+{
+	locate__send(query, &(const struct msg)
+		{
+			.type = MSG_TYPE_GET_DOCUMENT,
+			.response = locate__document_response,
+			.pw = query,
+		}, NULL);
+}
+
+bool locate_query_start(struct locate_query *query, struct msg_ctx *msg,
+		const char *selector, bool all, locate_fn fn, void *pw)
+{
+	const struct locate_cache *cache = msg_ctx_get_locate(msg);
+	const int *node_ids;
+	unsigned count;
+
+	*query = (struct locate_query) {
+		.msg = msg,
+		.selector = selector,
+		.all = all,
+		.fn = fn,
+		.pw = pw,
+	};
+
+	node_ids = locate_cache_get(cache, selector, all, &count);
+	if (node_ids != NULL) {
+		cdt_log(CDT_LOG_INFO, "Using cached nodes for '%s'",
+				selector);
+		locate__get_boxes(query, node_ids, count);
+		return !query->done;
+	}
+
+	query->document = locate_cache_get_document(cache);
+	if (query->document != 0) {
+		locate__query(query);
+	} else {
+		locate__get_document(query);
+	}
+
+	return !query->done;
+}
+
+void locate_query_fini(struct locate_query *query)
+{
+	locate__free_nodes(query);
+}
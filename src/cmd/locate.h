@@ -0,0 +1,91 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_CMD_LOCATE_H
+#define CDT_CMD_LOCATE_H
+
+/**
+ * \file
+ * \brief Locate elements by CSS selector, with the DOM domain.
+ *
+ * A query gets the document's nodeId with `DOM.getDocument`, finds the
+ * matching nodes with `DOM.querySelector` or `DOM.querySelectorAll`, and
+ * gets every node's box with `DOM.getBoxModel`. The box requests are all
+ * queued at once, so they are pipelined rather than waiting on each other.
+ *
+ * When the message context has a locate cache, the document and matches
+ * found are kept in it, so locating the same elements again on an
+ * unchanged page only needs the box models. If DevTools rejects the query,
+ * or a nodeId as unknown, the cache is cleared and the query starts again,
+ * once. Nodes without a box model, such as those that aren't rendered, are
+ * reported as not found, without starting again.
+ */
+
+struct msg_ctx;
+
+/** An element's box, in CSS pixels relative to the viewport. */
+struct locate_box {
+	double x; /**< Centre of the content box. */
+	double y; /**< Centre of the content box. */
+	double w; /**< Width of the content box. */
+	double h; /**< Height of the content box. */
+	bool found; /**< Whether DevTools gave the node's box model. */
+};
+
+/**
+ * Callback for a completed query.
+ *
+ * \param[in] pw     Client data passed to \ref locate_query_start.
+ * \param[in] box    The matching elements' boxes, in document order.
+ * \param[in] count  Number of elements matched; 0 if none, or on error.
+ */
+typedef void (*locate_fn)(void *pw,
+		const struct locate_box *box, unsigned count);
+
+/** A query, embedded in its owner. */
+struct locate_query {
+	struct msg_ctx *msg;
+	const char *selector;
+	bool all;
+
+	locate_fn fn;
+	void *pw;
+
+	int document;  /**< The document's nodeId, or 0 if not known yet. */
+	bool retried;  /**< Whether the query has been started again. */
+	bool done;     /**< Whether the callback has been called. */
+
+	int *node_ids; /**< The matching nodes. */
+	int *msg_ids;  /**< Ids of each node's `DOM.getBoxModel` message. */
+	struct locate_box *box;
+	unsigned count;   /**< Number of matching nodes. */
+	unsigned pending; /**< Number of box models still to come. */
+};
+
+/**
+ * Start locating elements.
+ *
+ * The query must stay in place until it is done, or finalised.
+ *
+ * \param[in] query     The query to start.
+ * \param[in] msg       Message context to send on.
+ * \param[in] selector  JSON escaped CSS selector. Not copied.
+ * \param[in] all       Whether to locate every match, or just the first.
+ * \param[in] fn        Function to call with the boxes.
+ * \param[in] pw        Client data to pass to `fn`.
+ * \return true on success, false otherwise.
+ */
+bool locate_query_start(struct locate_query *query, struct msg_ctx *msg,
+		const char *selector, bool all, locate_fn fn, void *pw);
+
+/**
+ * Finalise a query, freeing its resources.
+ *
+ * \param[in] query  The query to finalise.
+ */
+void locate_query_fini(struct locate_query *query);
+
+#endif
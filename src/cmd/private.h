@@ -18,11 +18,14 @@ struct cmd_table {
 
 	void (*help)(int argc, const char **argv);
 	bool (*init)(int argc, const char **argv,
-			struct cmd_options *options, void **pw_out);
+			struct cmd_options *options,
+			struct msg_ctx *msg, void **pw_out);
 	void (*msg) (void *pw, int id, const char *msg, size_t len);
 	void (*evt) (void *pw, const char *method, size_t method_len,
 			const char *msg, size_t len);
-	bool (*tick)(void *pw);
+	bool (*tick)(void *pw, bool backpressure);
+	void (*reconnect)(void *pw);
+	bool (*timeout)(void *pw, int id);
 	void (*fini)(void *pw);
 };
 
@@ -88,8 +91,61 @@ static const struct cli_str_val cmd_cli_common_log_target[] = {
 		.v.s = &cmd_options.host, \
 		.d = "Hostname for Chrome DevTools websocket connection. " \
 		     "Defaults to 'localhost'." \
+	}, \
+	{ \
+		.s = 'a', \
+		.l = "all", \
+		.t = CLI_BOOL, \
+		.v.b = &cmd_options.all, \
+		.d = "Run the command on every page matching DISPLAY." \
+	}, \
+	{ \
+		.s = 'b', \
+		.l = "browser", \
+		.t = CLI_BOOL, \
+		.v.b = &cmd_options.browser, \
+		.d = "Connect to the browser, and attach to pages through " \
+		     "that one connection." \
+	}, \
+	{ \
+		.s = 'r', \
+		.l = "reconnect", \
+		.t = CLI_INT, \
+		.v.i = &cmd_options.reconnect, \
+		.d = "Attempts to reconnect if the connection is lost. " \
+		     "Defaults to '5'." \
+	}, \
+	{ \
+		.s = 'w', \
+		.l = "window", \
+		.t = CLI_INT, \
+		.v.i = &cmd_options.window, \
+		.d = "Maximum requests awaiting responses at once, " \
+		     "or 0 for no limit. Defaults to '32'." \
+	}, \
+	{ \
+		.s = 'T', \
+		.l = "timeout", \
+		.t = CLI_INT, \
+		.v.i = &cmd_options.timeout, \
+		.d = "Time to wait for each response in ms, " \
+		     "or 0 to wait for ever. Defaults to '10000'." \
 	}
 
+/**
+ * Parse a command's command line.
+ *
+ * The parsed values are written into the command's static template, so a
+ * command must reset its template to its defaults before parsing, as the
+ * daemon runs many command lines in one process. Strings parsed point into
+ * `argv`, which outlives the command.
+ *
+ * \param[in]     argc     Number of command line arguments.
+ * \param[in]     argv     String vector containing command line arguments.
+ * \param[in]     cli      The command's CLI table.
+ * \param[in,out] options  Common command options.
+ * \return true on success, false otherwise.
+ */
 static inline bool cmd_cli_parse(int argc, const char **argv,
 		const struct cli_table *cli, struct cmd_options *options)
 {
@@ -101,6 +157,12 @@ static inline bool cmd_cli_parse(int argc, const char **argv,
 	}
 
 	*options = cmd_options;
+
+	if (options->parsed != NULL &&
+	    !options->parsed(options->parsed_pw, options)) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -0,0 +1,625 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+#include "control.h"
+
+#include "util/log.h"
+#include "util/time.h"
+#include "util/buffer.h"
+
+/** Maximum size of a request's command line. */
+#define CONTROL_REQUEST_MAX (64 * 1024)
+
+/** Time to wait for a client to send its request, in ms. */
+#define CONTROL_REQUEST_TIMEOUT_MS 2000
+
+/** Most clients that can be sending their requests at once. */
+#define CONTROL_PENDING_MAX 16
+
+/** Clients that are still sending their requests. */
+static struct control_ctx {
+	struct control_request pending[CONTROL_PENDING_MAX];
+	unsigned count;
+} control_g;
+
+const char *control_socket_path(void)
+{
+	static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	const char *env;
+	int ret;
+
+	env = getenv("CDT_SOCKET");
+	if (env != NULL && env[0] != '\0') {
+		return env;
+	}
+
+	env = getenv("XDG_RUNTIME_DIR");
+	if (env != NULL && env[0] != '\0') {
+		ret = snprintf(path, sizeof(path), "%s/cdt.sock", env);
+	} else {
+		ret = snprintf(path, sizeof(path), "/tmp/cdt-%u.sock",
+				(unsigned)getuid());
+	}
+
+	if (ret < 0 || (size_t)ret >= sizeof(path)) {
+		return NULL;
+	}
+
+	return path;
+}
+
+static bool control__get_addr(const char *path, struct sockaddr_un *addr)
+{
+	if (path == NULL || strlen(path) >= sizeof(addr->sun_path)) {
+		cdt_log(CDT_LOG_ERROR, "Invalid control socket path");
+		return false;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+int control_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!control__get_addr(path, &addr)) {
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to create socket: %s",
+				strerror(errno));
+		return -1;
+	}
+
+	/* Replace any socket left behind by a previous daemon. */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(fd, 16) == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to listen on %s: %s",
+				path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	cdt_log(CDT_LOG_NOTICE, "Listening on %s", path);
+	return fd;
+}
+
+/**
+ * Get the number of arguments in a request, once it has all arrived.
+ *
+ * The request is the number of arguments, followed by each argument's
+ * length and content. Lengths are 32-bit, in the host's byte order.
+ *
+ * \param[in]  buf        The request received so far.
+ * \param[out] argc_out   Returns the number of arguments, when complete.
+ * \param[out] error_out  Returns whether the request is invalid.
+ * \return true if the whole request has been received, false otherwise.
+ */
+static bool control__request_complete(const struct cdt_buffer *buf,
+		uint32_t *argc_out, bool *error_out)
+{
+	uint32_t argc;
+	size_t pos;
+
+	*error_out = false;
+
+	if (buf->len < sizeof(argc)) {
+		return false;
+	}
+
+	memcpy(&argc, buf->data, sizeof(argc));
+	if (argc == 0 || argc > CONTROL_REQUEST_MAX / sizeof(argc)) {
+		*error_out = true;
+		return false;
+	}
+
+	pos = sizeof(argc);
+	for (uint32_t i = 0; i < argc; i++) {
+		uint32_t len;
+
+		if (buf->len - pos < sizeof(len)) {
+			return false;
+		}
+
+		memcpy(&len, buf->data + pos, sizeof(len));
+		pos += sizeof(len);
+
+		if (len > CONTROL_REQUEST_MAX) {
+			*error_out = true;
+			return false;
+		}
+		if (buf->len - pos < len) {
+			return false;
+		}
+		pos += len;
+	}
+
+	*argc_out = argc;
+	return true;
+}
+
+/**
+ * Split a received command line into its arguments.
+ *
+ * \param[in] req   The request, with its command line in `buf`.
+ * \param[in] argc  Number of arguments in the command line.
+ * \return true on success, false otherwise.
+ */
+static bool control__parse_args(struct control_request *req, uint32_t argc)
+{
+	size_t pos = sizeof(argc);
+	size_t out = 0;
+
+	req->argv = calloc((size_t)argc + 1, sizeof(*req->argv));
+	req->data = malloc(req->buf.len);
+	if (req->argv == NULL || req->data == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	/* Each argument's length prefix makes room for its terminator. */
+	for (uint32_t i = 0; i < argc; i++) {
+		uint32_t len;
+
+		memcpy(&len, req->buf.data + pos, sizeof(len));
+		pos += sizeof(len);
+
+		memcpy(req->data + out, req->buf.data + pos, len);
+		req->data[out + len] = '\0';
+		req->argv[i] = req->data + out;
+
+		pos += len;
+		out += len + 1;
+	}
+
+	req->argc = (int)argc;
+	cdt_buffer_delete(&req->buf);
+	return true;
+}
+
+/**
+ * Take the client's stdout and stderr from a received control message.
+ *
+ * \param[in] req  The request being read.
+ * \param[in] msg  The received message.
+ */
+static void control__take_fds(struct control_request *req,
+		struct msghdr *msg)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		size_t count;
+		int fds[2];
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; i++) {
+			memcpy(&fds[i % 2], CMSG_DATA(cmsg) + i * sizeof(int),
+					sizeof(int));
+			if (count != 2 || req->out_fd != -1) {
+				/* Not what a client sends. */
+				close(fds[i % 2]);
+			}
+		}
+
+		if (count == 2 && req->out_fd == -1) {
+			req->out_fd = fds[0];
+			req->err_fd = fds[1];
+		}
+	}
+}
+
+/**
+ * Read whatever a client has sent of its request, without blocking.
+ *
+ * \param[in] req  The request to read into.
+ * \return CONTROL_READ_DONE once the whole request has been received,
+ *         CONTROL_READ_MORE if more is to come, or CONTROL_READ_ERROR.
+ */
+static enum control_read {
+	CONTROL_READ_DONE,
+	CONTROL_READ_MORE,
+	CONTROL_READ_ERROR,
+} control__read_request(struct control_request *req)
+{
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char chunk[512];
+
+	for (;;) {
+		struct iovec iov = {
+			.iov_base = chunk,
+			.iov_len = sizeof(chunk),
+		};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+		};
+		uint32_t argc;
+		bool error;
+		ssize_t got;
+
+		got = recvmsg(req->fd, &msg, MSG_CMSG_CLOEXEC);
+		if (got == -1 && errno == EINTR) {
+			continue;
+		} else if (got == -1 && (errno == EAGAIN ||
+				errno == EWOULDBLOCK)) {
+			return CONTROL_READ_MORE;
+		} else if (got <= 0) {
+			return CONTROL_READ_ERROR;
+		}
+
+		control__take_fds(req, &msg);
+
+		if (req->buf.len + (size_t)got > CONTROL_REQUEST_MAX ||
+		    !cdt_buffer_append(&req->buf, chunk, (size_t)got)) {
+			return CONTROL_READ_ERROR;
+		}
+
+		if (control__request_complete(&req->buf, &argc, &error)) {
+			if (req->out_fd == -1 ||
+			    !control__parse_args(req, argc)) {
+				return CONTROL_READ_ERROR;
+			}
+			return CONTROL_READ_DONE;
+		} else if (error) {
+			return CONTROL_READ_ERROR;
+		}
+	}
+}
+
+static void control__free_request(struct control_request *req)
+{
+	if (req->fd != -1) {
+		close(req->fd);
+	}
+	if (req->out_fd != -1) {
+		close(req->out_fd);
+	}
+	if (req->err_fd != -1) {
+		close(req->err_fd);
+	}
+	free(req->argv);
+	free(req->data);
+	cdt_buffer_delete(&req->buf);
+
+	req->fd = -1;
+	req->out_fd = -1;
+	req->err_fd = -1;
+	req->argv = NULL;
+	req->data = NULL;
+}
+
+/**
+ * Remove a client from the clients still sending their requests.
+ *
+ * \param[in] index  Index of the client to remove.
+ * \param[in] req    Returns the client's request, or NULL to drop it.
+ */
+static void control__remove_pending(unsigned index,
+		struct control_request *req)
+{
+	if (req != NULL) {
+		*req = control_g.pending[index];
+	} else {
+		control__free_request(&control_g.pending[index]);
+	}
+
+	control_g.pending[index] = control_g.pending[--control_g.count];
+}
+
+void control_close(int fd, const char *path)
+{
+	while (control_g.count > 0) {
+		control__remove_pending(0, NULL);
+	}
+
+	if (fd != -1) {
+		close(fd);
+		unlink(path);
+	}
+}
+
+/**
+ * Accept any new clients, without blocking.
+ *
+ * \param[in] fd  The listening socket.
+ */
+static void control__accept_new(int fd)
+{
+	while (control_g.count < CONTROL_PENDING_MAX) {
+		struct control_request *req;
+		int client;
+
+		client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client == -1) {
+			return;
+		}
+
+		req = &control_g.pending[control_g.count++];
+		memset(req, 0, sizeof(*req));
+		req->fd = client;
+		req->out_fd = -1;
+		req->err_fd = -1;
+		req->stdout_fd = -1;
+		req->stderr_fd = -1;
+		clock_gettime(CLOCK_MONOTONIC, &req->started);
+	}
+}
+
+bool control_accept(int fd, struct control_request *req)
+{
+	struct timespec now;
+
+	control__accept_new(fd);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (unsigned i = 0; i < control_g.count; i++) {
+		struct control_request *pending = &control_g.pending[i];
+		int flags;
+
+		switch (control__read_request(pending)) {
+		case CONTROL_READ_DONE:
+			/* Only the exit status is sent, once the command
+			 * is done, so the reply may as well block. */
+			flags = fcntl(pending->fd, F_GETFL);
+			if (flags != -1) {
+				fcntl(pending->fd, F_SETFL,
+						flags & ~O_NONBLOCK);
+			}
+			control__remove_pending(i, req);
+			return true;
+
+		case CONTROL_READ_MORE:
+			if (time_diff_ms(&pending->started, &now) <
+					CONTROL_REQUEST_TIMEOUT_MS) {
+				continue;
+			}
+			cdt_log(CDT_LOG_WARNING, "Control request timed out");
+			break;
+
+		case CONTROL_READ_ERROR:
+			cdt_log(CDT_LOG_ERROR, "Bad control request");
+			break;
+		}
+
+		control__remove_pending(i--, NULL);
+	}
+
+	return false;
+}
+
+bool control_redirect(struct control_request *req)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	req->stdout_fd = dup(STDOUT_FILENO);
+	req->stderr_fd = dup(STDERR_FILENO);
+	if (req->stdout_fd == -1 || req->stderr_fd == -1 ||
+	    dup2(req->out_fd, STDOUT_FILENO) == -1 ||
+	    dup2(req->err_fd, STDERR_FILENO) == -1) {
+		return false;
+	}
+
+	return true;
+}
+
+static void control__restore(struct control_request *req)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	if (req->stdout_fd != -1) {
+		dup2(req->stdout_fd, STDOUT_FILENO);
+		close(req->stdout_fd);
+		req->stdout_fd = -1;
+	}
+
+	if (req->stderr_fd != -1) {
+		dup2(req->stderr_fd, STDERR_FILENO);
+		close(req->stderr_fd);
+		req->stderr_fd = -1;
+	}
+}
+
+void control_reply(struct control_request *req, int status)
+{
+	const uint8_t reply = (uint8_t)status;
+
+	control__restore(req);
+
+	if (write(req->fd, &reply, sizeof(reply)) != sizeof(reply)) {
+		cdt_log(CDT_LOG_WARNING, "Failed to send reply to client");
+	}
+
+	control__free_request(req);
+}
+
+static bool control__write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t done = write(fd, data, len);
+
+		if (done == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		data += done;
+		len -= (size_t)done;
+	}
+
+	return true;
+}
+
+/**
+ * Build a request for a command line.
+ *
+ * \param[in]  argc  Number of command line arguments.
+ * \param[in]  argv  Command line arguments.
+ * \param[out] buf   Returns the request.
+ * \return true on success, false otherwise.
+ */
+static bool control__build_request(int argc, const char **argv,
+		struct cdt_buffer *buf)
+{
+	uint32_t count = (uint32_t)argc;
+
+	if (!cdt_buffer_append(buf, (const char *)&count, sizeof(count))) {
+		return false;
+	}
+
+	for (int i = 0; i < argc; i++) {
+		size_t len = strlen(argv[i]);
+		uint32_t len32 = (uint32_t)len;
+
+		if (len > CONTROL_REQUEST_MAX ||
+		    !cdt_buffer_append(buf, (const char *)&len32,
+				sizeof(len32)) ||
+		    !cdt_buffer_append(buf, argv[i], len)) {
+			return false;
+		}
+	}
+
+	return buf->len <= CONTROL_REQUEST_MAX;
+}
+
+/**
+ * Send a request, along with our stdout and stderr.
+ *
+ * \param[in] fd   Connection to the daemon.
+ * \param[in] buf  The request.
+ * \return true on success, false otherwise.
+ */
+static bool control__send_request(int fd, const struct cdt_buffer *buf)
+{
+	const int fds[] = { STDOUT_FILENO, STDERR_FILENO };
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {
+		.iov_base = buf->data,
+		.iov_len = buf->len,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t sent;
+
+	memset(&control, 0, sizeof(control));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	do {
+		sent = sendmsg(fd, &msg, 0);
+	} while (sent == -1 && errno == EINTR);
+
+	if (sent == -1) {
+		return false;
+	}
+
+	/* The descriptors went with the first part; send the rest. */
+	return control__write_all(fd, buf->data + sent,
+			buf->len - (size_t)sent);
+}
+
+int control_client(const char *path, int argc, const char **argv)
+{
+	struct cdt_buffer buf = { 0 };
+	struct sockaddr_un addr;
+	uint8_t status;
+	ssize_t got;
+	int fd;
+
+	if (!control__get_addr(path, &addr)) {
+		return EXIT_FAILURE;
+	}
+
+	if (!control__build_request(argc, argv, &buf)) {
+		cdt_log(CDT_LOG_ERROR, "Command line too long for daemon");
+		cdt_buffer_delete(&buf);
+		return EXIT_FAILURE;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to create socket: %s",
+				strerror(errno));
+		cdt_buffer_delete(&buf);
+		return EXIT_FAILURE;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to connect to daemon at %s: %s",
+				path, strerror(errno));
+		cdt_buffer_delete(&buf);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (!control__send_request(fd, &buf)) {
+		cdt_buffer_delete(&buf);
+		goto error;
+	}
+	cdt_buffer_delete(&buf);
+
+	/* The command writes to our stdout and stderr itself, so all that
+	 * comes back is the exit status. */
+	do {
+		got = read(fd, &status, sizeof(status));
+	} while (got == -1 && errno == EINTR);
+
+	if (got == sizeof(status)) {
+		close(fd);
+		return status;
+	}
+
+error:
+	cdt_log(CDT_LOG_ERROR, "Lost connection to daemon");
+	close(fd);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,109 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_CONTROL_H
+#define CDT_CONTROL_H
+
+#include <time.h>
+
+#include "util/buffer.h"
+
+/**
+ * \file
+ * \brief Local control socket.
+ *
+ * A `cdt daemon` listens on a UNIX domain socket for command lines from
+ * `cdt client` invocations. The client sends its arguments, each prefixed
+ * with its length, along with its own stdout and stderr. The daemon runs
+ * the command with its output going straight to the client's stdout and
+ * stderr, and then replies with the command's exit status.
+ */
+
+/** A command line received from a client. */
+struct control_request {
+	int fd;            /**< Client connection. */
+	int argc;          /**< Number of command line arguments. */
+	const char **argv; /**< Command line arguments. */
+	char *data;        /**< Storage for the argument strings. */
+
+	int out_fd;        /**< Client's stdout, or -1. */
+	int err_fd;        /**< Client's stderr, or -1. */
+	int stdout_fd;     /**< Saved stdout, while redirected to client. */
+	int stderr_fd;     /**< Saved stderr, while redirected to client. */
+
+	struct cdt_buffer buf;   /**< Request received so far. */
+	struct timespec started; /**< Time the client connected. */
+};
+
+/**
+ * Get the path of the control socket.
+ *
+ * This is `$CDT_SOCKET` if set, or `cdt.sock` in `$XDG_RUNTIME_DIR`,
+ * falling back to a per-user path in `/tmp`.
+ *
+ * \return the control socket path.
+ */
+const char *control_socket_path(void);
+
+/**
+ * Start listening on the control socket.
+ *
+ * \param[in] path  Path of the control socket.
+ * \return the listening socket, or -1 on error.
+ */
+int control_listen(const char *path);
+
+/**
+ * Stop listening on the control socket.
+ *
+ * Any clients still sending their requests are dropped.
+ *
+ * \param[in] fd    The listening socket.
+ * \param[in] path  Path of the control socket.
+ */
+void control_close(int fd, const char *path);
+
+/**
+ * Accept a client's request, if one has been received.
+ *
+ * New clients are accepted, and whatever they have sent so far is read,
+ * without blocking. Clients that take too long to send their request are
+ * dropped.
+ *
+ * \param[in]  fd   The listening socket.
+ * \param[out] req  Returns the request on success.
+ * \return true if a request was received, false otherwise.
+ */
+bool control_accept(int fd, struct control_request *req);
+
+/**
+ * Redirect stdout and stderr to the client's, until the reply is sent.
+ *
+ * \param[in] req  The request being handled.
+ * \return true on success, false otherwise.
+ */
+bool control_redirect(struct control_request *req);
+
+/**
+ * Send a request's exit status to its client, and release the request.
+ *
+ * \param[in] req     The request being handled.
+ * \param[in] status  The exit status to send.
+ */
+void control_reply(struct control_request *req, int status);
+
+/**
+ * Have a daemon run a command line, with its output on our stdout and
+ * stderr.
+ *
+ * \param[in] path  Path of the control socket.
+ * \param[in] argc  Number of command line arguments.
+ * \param[in] argv  Command line arguments to send.
+ * \return the command's exit status.
+ */
+int control_client(const char *path, int argc, const char **argv);
+
+#endif
@@ -4,9 +4,17 @@
  * Copyright (c) 2022 Codethink
  */
 
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <stdbool.h>
 
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
 #include <cyaml/cyaml.h>
 #include <libwebsockets.h>
 
@@ -15,8 +23,15 @@
 #include "msg/msg.h"
 
 #include "util/log.h"
+#include "util/util.h"
 #include "util/buffer.h"
 
+/** Seconds a cached display path is trusted for. */
+#define DISPLAY_CACHE_TTL 60
+
+/** Name of the display cache file, within the user's cache directory. */
+#define DISPLAY_CACHE_FILE "cdt-displays"
+
 struct display {
 	char *description;
 	char *frontend_url;
@@ -63,17 +78,46 @@ static const struct cyaml_schema_value display_schema = {
 				&display_entry_schema, 0, CYAML_UNLIMITED),
 };
 
+/** Browser version info, from `/json/version`. */
+struct display_version {
+	char *debugger_url;
+};
+
+static const struct cyaml_schema_field display_version_fields_schema[] = {
+	CYAML_FIELD_STRING_PTR("webSocketDebuggerUrl", CYAML_FLAG_POINTER,
+			struct display_version, debugger_url,
+			0, CYAML_UNLIMITED),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_value display_version_schema = {
+		CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct display_version,
+				display_version_fields_schema),
+};
+
 static struct {
 	bool interrupted;
 	struct lws *client_wsi;
 
+	/** Context shared with the caller's connections, or NULL. */
+	struct lws_context *context;
+
+	/** Host last resolved, and its numeric addresses. */
+	char *resolved_host;
+	char (*resolved_addr)[INET6_ADDRSTRLEN];
+	unsigned resolved_count;
+	unsigned resolved_next; /**< Index of the address to use. */
+
+	/** Whether the last fetch failed to connect. */
+	bool connect_failed;
+
 	struct cdt_buffer multipart_msg;
 
 	struct display *display;
 	unsigned display_count;
 } display_g;
 
-static int http_cb(struct lws *wsi, enum lws_callback_reasons reason,
+int display_http_cb(struct lws *wsi, enum lws_callback_reasons reason,
 		void *user, void *in, size_t len)
 {
 	unsigned status;
@@ -82,6 +126,7 @@ static int http_cb(struct lws *wsi, enum lws_callback_reasons reason,
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 		cdt_log(CDT_LOG_ERROR, "Disconnected");
 		display_g.client_wsi = NULL;
+		display_g.connect_failed = true;
 		break;
 
 	case LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP:
@@ -128,8 +173,8 @@ enum protocols
 
 static const struct lws_protocols protocols[PROTOCOL_COUNT] = {
 	{
-		.name = "http",
-		.callback = http_cb,
+		.name = DISPLAY_PROTOCOL_NAME,
+		.callback = display_http_cb,
 	},
 };
 
@@ -175,10 +220,126 @@ static bool display_parse(const uint8_t *data, size_t len)
 	return true;
 }
 
-static bool display_init(const char *host, int port)
+void display_set_context(struct lws_context *context)
 {
-	bool parsed;
-	struct lws_context *context;
+	display_g.context = context;
+}
+
+void display_free_addresses(void)
+{
+	free(display_g.resolved_host);
+	free(display_g.resolved_addr);
+
+	display_g.resolved_host = NULL;
+	display_g.resolved_addr = NULL;
+	display_g.resolved_count = 0;
+	display_g.resolved_next = 0;
+}
+
+/**
+ * Resolve a host, keeping every numeric address it has.
+ *
+ * \param[in] host  Hostname for Chrome DevTools.
+ * \return true on success, false otherwise.
+ */
+static bool display__resolve(const char *host)
+{
+	const struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *res;
+	unsigned count = 0;
+
+	display_free_addresses();
+
+	if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+		return false;
+	}
+
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		count++;
+	}
+
+	display_g.resolved_host = strdup(host);
+	display_g.resolved_addr = calloc(count,
+			sizeof(*display_g.resolved_addr));
+	if (display_g.resolved_host == NULL ||
+	    display_g.resolved_addr == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		freeaddrinfo(res);
+		display_free_addresses();
+		return false;
+	}
+
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		char *out = display_g.resolved_addr[display_g.resolved_count];
+		const void *addr;
+
+		if (ai->ai_family == AF_INET6) {
+			addr = &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+		} else if (ai->ai_family == AF_INET) {
+			addr = &((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+		} else {
+			continue;
+		}
+
+		if (inet_ntop(ai->ai_family, addr, out,
+				INET6_ADDRSTRLEN) != NULL) {
+			cdt_log(CDT_LOG_INFO, "Resolved %s to %s", host, out);
+			display_g.resolved_count++;
+		}
+	}
+	freeaddrinfo(res);
+
+	if (display_g.resolved_count == 0) {
+		display_free_addresses();
+		return false;
+	}
+
+	return true;
+}
+
+const char *display_get_address(const char *host)
+{
+	if (display_g.resolved_host == NULL ||
+	    strcmp(display_g.resolved_host, host) != 0) {
+		if (!display__resolve(host)) {
+			/* Leave it to lws to report the failure. */
+			return host;
+		}
+	}
+
+	return display_g.resolved_addr[display_g.resolved_next];
+}
+
+bool display_address_failed(const char *host)
+{
+	if (display_g.resolved_host == NULL ||
+	    strcmp(display_g.resolved_host, host) != 0 ||
+	    display_g.resolved_count < 2) {
+		return false;
+	}
+
+	display_g.resolved_next = (display_g.resolved_next + 1) %
+			display_g.resolved_count;
+
+	cdt_log(CDT_LOG_NOTICE, "Trying %s at %s", host,
+			display_g.resolved_addr[display_g.resolved_next]);
+	return true;
+}
+
+/**
+ * Fetch a DevTools HTTP endpoint into the multipart message buffer.
+ *
+ * \param[in] host  Hostname for Chrome DevTools.
+ * \param[in] port  Port for Chrome DevTools.
+ * \param[in] path  Endpoint path to fetch.
+ * \return true on success, false otherwise.
+ */
+static bool display__fetch(const char *host, int port, const char *path)
+{
+	struct lws_context *context = display_g.context;
 	struct lws_context_creation_info info = {
 		.port = CONTEXT_PORT_NO_LISTEN,
 		.protocols = protocols,
@@ -187,36 +348,62 @@ static bool display_init(const char *host, int port)
 	};
 	struct lws_client_connect_info i = {
 		.port = port,
-		.address = host,
-		.path = "/json",
+		.path = path,
 		.method = "GET",
-		.host = i.address,
-		.origin = i.address,
-		.protocol = protocols[PROTOCOL_HTTP].name,
+		.host = host,
+		.origin = host,
+		.protocol = DISPLAY_PROTOCOL_NAME,
 		.pwsi = &display_g.client_wsi,
 	};
 
-	context = lws_create_context(&info);
 	if (context == NULL) {
-		cdt_log(CDT_LOG_ERROR, "lws_create_context failed");
-		return EXIT_FAILURE;
+		context = lws_create_context(&info);
+		if (context == NULL) {
+			cdt_log(CDT_LOG_ERROR, "lws_create_context failed");
+			return false;
+		}
 	}
 
 	i.context = context;
-	lws_client_connect_via_info(&i);
 
-	while (display_g.client_wsi && !display_g.interrupted) {
-		if (lws_service(context, 1000) < 0) {
+	/* Try each of the host's addresses until one connects. */
+	for (unsigned tries = 0; ; tries++) {
+		display_g.connect_failed = false;
+		i.address = display_get_address(host);
+		lws_client_connect_via_info(&i);
+
+		while (display_g.client_wsi && !display_g.interrupted) {
+			if (lws_service(context, 1000) < 0) {
+				break;
+			}
+		}
+
+		if (!display_g.connect_failed ||
+		    tries + 1 >= display_g.resolved_count ||
+		    !display_address_failed(host)) {
 			break;
 		}
 	}
 
-	lws_context_destroy(context);
+	if (context != display_g.context) {
+		lws_context_destroy(context);
+	}
 
 	if (display_g.multipart_msg.data == NULL) {
 		return false;
 	}
 
+	return true;
+}
+
+static bool display_init(const char *host, int port)
+{
+	bool parsed;
+
+	if (!display__fetch(host, port, "/json")) {
+		return false;
+	}
+
 	parsed = display_parse((const uint8_t *)
 			display_g.multipart_msg.data,
 			display_g.multipart_msg.len);
@@ -233,37 +420,403 @@ static void display_fini(void)
 	display__free_displays();
 }
 
-char *display_get_path(const char *display, const char *host, int port)
+/**
+ * Get the websocket path for a display entry if it matches.
+ *
+ * \param[in] d        Display entry to check.
+ * \param[in] display  Display title substring to match.
+ * \return the path within the entry's debugger URL, or NULL.
+ */
+static const char *display__match(const struct display *d,
+		const char *display)
+{
+	if (strcmp(d->type, "page") != 0) {
+		return NULL;
+	}
+
+	if (strstr(d->title, display) == NULL) {
+		return NULL;
+	}
+
+	return strstr(d->debugger_url, "/devtools/page");
+}
+
+/**
+ * Get the path of the display cache file.
+ *
+ * \return the path, which the caller must free, or NULL if there is none.
+ */
+static char *display__cache_path(void)
+{
+	const char *env;
+	char *path;
+
+	env = getenv("XDG_CACHE_HOME");
+	if (env != NULL && env[0] != '\0') {
+		if (asprintf(&path, "%s/" DISPLAY_CACHE_FILE, env) < 0) {
+			return NULL;
+		}
+		return path;
+	}
+
+	env = getenv("HOME");
+	if (env != NULL && env[0] != '\0') {
+		if (asprintf(&path, "%s/.cache/" DISPLAY_CACHE_FILE, env) < 0) {
+			return NULL;
+		}
+		return path;
+	}
+
+	return NULL;
+}
+
+/** A line of the display cache file, split into its fields. */
+struct display_cache_entry {
+	long long expiry;
+	int port;
+	const char *host;
+	const char *path;
+	const char *display;
+};
+
+/**
+ * Split a display cache file line into its fields.
+ *
+ * Lines are "<expiry>\t<port>\t<host>\t<path>\t<display>". The display
+ * comes last, so it may contain tabs.
+ *
+ * \param[in]  line   The line, which is modified. Trailing newline removed.
+ * \param[out] entry  Returns the entry on success.
+ * \return true on success, false if the line is invalid.
+ */
+static bool display__cache_parse(char *line,
+		struct display_cache_entry *entry)
+{
+	char *field[5];
+	char *end;
+
+	field[0] = line;
+	for (unsigned i = 1; i < CDT_ARRAY_COUNT(field); i++) {
+		char *tab = strchr(field[i - 1], '\t');
+
+		if (tab == NULL) {
+			return false;
+		}
+
+		*tab = '\0';
+		field[i] = tab + 1;
+	}
+
+	entry->expiry = strtoll(field[0], &end, 10);
+	if (*end != '\0') {
+		return false;
+	}
+
+	entry->port = (int)strtol(field[1], &end, 10);
+	if (*end != '\0') {
+		return false;
+	}
+
+	entry->host = field[2];
+	entry->path = field[3];
+	entry->display = field[4];
+	return true;
+}
+
+static bool display__cache_match(const struct display_cache_entry *entry,
+		const char *display, const char *host, int port)
+{
+	return entry->port == port &&
+			strcmp(entry->host, host) == 0 &&
+			strcmp(entry->display, display) == 0;
+}
+
+/**
+ * Look a display up in the display cache.
+ *
+ * \param[in] display  Display title substring.
+ * \param[in] host     Hostname for Chrome DevTools.
+ * \param[in] port     Port for Chrome DevTools.
+ * \return the cached path, or NULL if there is no fresh entry.
+ */
+static char *display__cache_lookup(const char *display,
+		const char *host, int port)
+{
+	char *cache_path = display__cache_path();
+	char *path = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	FILE *f;
+
+	if (cache_path == NULL) {
+		return NULL;
+	}
+
+	f = fopen(cache_path, "r");
+	free(cache_path);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	while ((len = getline(&line, &size, f)) > 0) {
+		struct display_cache_entry entry;
+
+		if (line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+
+		if (!display__cache_parse(line, &entry) ||
+		    !display__cache_match(&entry, display, host, port)) {
+			continue;
+		}
+
+		if (entry.expiry > (long long)time(NULL)) {
+			path = strdup(entry.path);
+		}
+		break;
+	}
+
+	free(line);
+	fclose(f);
+	return path;
+}
+
+/**
+ * Update the display cache.
+ *
+ * Expired entries, and any existing entry for the display, are dropped.
+ *
+ * \param[in] display  Display title substring.
+ * \param[in] host     Hostname for Chrome DevTools.
+ * \param[in] port     Port for Chrome DevTools.
+ * \param[in] path     Path to store for the display, or NULL to remove it.
+ */
+static void display__cache_update(const char *display,
+		const char *host, int port, const char *path)
+{
+	long long now = (long long)time(NULL);
+	char *cache_path = display__cache_path();
+	char *tmp_path = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	FILE *in;
+	FILE *out;
+
+	if (cache_path == NULL) {
+		return;
+	}
+
+	/* The fields are tab separated, one entry per line. */
+	if (strchr(display, '\n') != NULL || strchr(host, '\t') != NULL ||
+	    asprintf(&tmp_path, "%s.%ld", cache_path, (long)getpid()) < 0) {
+		free(cache_path);
+		return;
+	}
+
+	out = fopen(tmp_path, "w");
+	if (out == NULL) {
+		cdt_log(CDT_LOG_INFO, "Failed to write display cache: %s",
+				tmp_path);
+		free(tmp_path);
+		free(cache_path);
+		return;
+	}
+
+	in = fopen(cache_path, "r");
+	while (in != NULL && (len = getline(&line, &size, in)) > 0) {
+		struct display_cache_entry entry;
+		char *copy = strdup(line);
+
+		if (copy == NULL) {
+			break;
+		}
+
+		if (line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+
+		if (display__cache_parse(line, &entry) && entry.expiry > now &&
+		    !display__cache_match(&entry, display, host, port)) {
+			fputs(copy, out);
+		}
+		free(copy);
+	}
+
+	if (path != NULL) {
+		fprintf(out, "%lld\t%d\t%s\t%s\t%s\n",
+				now + DISPLAY_CACHE_TTL,
+				port, host, path, display);
+	}
+
+	if (in != NULL) {
+		fclose(in);
+	}
+
+	if (fclose(out) != 0 || rename(tmp_path, cache_path) != 0) {
+		unlink(tmp_path);
+	}
+
+	free(line);
+	free(tmp_path);
+	free(cache_path);
+}
+
+void display_forget_path(const char *display, const char *host, int port)
+{
+	display__cache_update(display, host, port, NULL);
+}
+
+char *display_get_path(const char *display, const char *host, int port,
+		bool *cached_out)
 {
 	char *path = NULL;
 
+	*cached_out = false;
+
 	if (strlen(display) > 0 && display[0] == '/') {
 		path = strdup(display);
 
 	} else {
+		path = display__cache_lookup(display, host, port);
+		if (path != NULL) {
+			cdt_log(CDT_LOG_INFO, "Using cached path for %s",
+					display);
+			*cached_out = true;
+			return path;
+		}
+
 		if (!display_init(host, port)) {
 			return NULL;
 		}
 
 		for (unsigned i = 0; i < display_g.display_count; i++) {
-			struct display *d = &display_g.display[i];
-
-			if (strcmp(d->type, "page") != 0) {
-				continue;
-			}
+			const char *tmp = display__match(&display_g.display[i],
+					display);
 
-			if (strstr(d->title, display) != NULL) {
-				const char *tmp = strstr(d->debugger_url,
-						"/devtools/page");
-				if (tmp != NULL) {
-					path = strdup(tmp);
-				}
+			if (tmp != NULL) {
+				path = strdup(tmp);
 				break;
 			}
 		}
 
 		display_fini();
+
+		if (path != NULL) {
+			display__cache_update(display, host, port, path);
+		}
+	}
+
+	return path;
+}
+
+bool display_get_paths(const char *display, const char *host, int port,
+		char ***paths_out, unsigned *count_out)
+{
+	unsigned count = 0;
+	char **paths;
+
+	if (strlen(display) > 0 && display[0] == '/') {
+		paths = malloc(sizeof(*paths));
+		if (paths == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			return false;
+		}
+
+		paths[0] = strdup(display);
+		if (paths[0] == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			free(paths);
+			return false;
+		}
+
+		*paths_out = paths;
+		*count_out = 1;
+		return true;
+	}
+
+	if (!display_init(host, port)) {
+		return false;
+	}
+
+	paths = calloc(display_g.display_count + 1, sizeof(*paths));
+	if (paths == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		display_fini();
+		return false;
+	}
+
+	for (unsigned i = 0; i < display_g.display_count; i++) {
+		const char *path = display__match(&display_g.display[i],
+				display);
+
+		if (path == NULL) {
+			continue;
+		}
+
+		paths[count] = strdup(path);
+		if (paths[count] == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			display_free_paths(paths, count);
+			display_fini();
+			return false;
+		}
+		count++;
+	}
+
+	display_fini();
+
+	*paths_out = paths;
+	*count_out = count;
+	return true;
+}
+
+void display_free_paths(char **paths, unsigned count)
+{
+	if (paths == NULL) {
+		return;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		free(paths[i]);
+	}
+
+	free(paths);
+}
+
+char *display_get_browser_path(const char *host, int port)
+{
+	struct display_version *version;
+	const char *tmp;
+	char *path = NULL;
+	cyaml_err_t res;
+
+	if (!display__fetch(host, port, "/json/version")) {
+		return NULL;
+	}
+
+	res = cyaml_load_data((const uint8_t *)
+			display_g.multipart_msg.data,
+			display_g.multipart_msg.len,
+			&config,
+			&display_version_schema,
+			(void **)&version, NULL);
+	cdt_buffer_delete(&display_g.multipart_msg);
+	if (res != CYAML_OK) {
+		cdt_log(CDT_LOG_ERROR, "Failed to parse browser version: %s",
+				cyaml_strerror(res));
+		return NULL;
+	}
+
+	tmp = strstr(version->debugger_url, "/devtools/browser");
+	if (tmp != NULL) {
+		path = strdup(tmp);
 	}
 
+	cyaml_free(&config, &display_version_schema, version, 0);
 	return path;
 }
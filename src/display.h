@@ -7,6 +7,112 @@
 #ifndef CDT_DISPLAY_H
 #define CDT_DISPLAY_H
 
-char *display_get_path(const char *display, const char *host, int port);
+#include <libwebsockets.h>
+
+/** Name of the lws protocol used to fetch display info over HTTP. */
+#define DISPLAY_PROTOCOL_NAME "http"
+
+/**
+ * The lws callback for the display protocol.
+ *
+ * Callers sharing their lws context with display discovery must include
+ * this in the context's protocols as \ref DISPLAY_PROTOCOL_NAME.
+ */
+int display_http_cb(struct lws *wsi, enum lws_callback_reasons reason,
+		void *user, void *in, size_t len);
+
+/**
+ * Set an lws context for display discovery to use.
+ *
+ * By default, discovery creates and destroys a context of its own for
+ * every lookup. With a shared context, discovery and the websocket
+ * connection run back to back without any teardown.
+ *
+ * \param[in] context  The context to use, or NULL to use private ones.
+ */
+void display_set_context(struct lws_context *context);
+
+/**
+ * Get a numeric address for a host.
+ *
+ * The last resolved host is remembered, along with all of its addresses,
+ * so discovery and the websocket connection only resolve it once.
+ *
+ * \param[in] host  Hostname for Chrome DevTools.
+ * \return the address to try, or host if it could not be resolved.
+ */
+const char *display_get_address(const char *host);
+
+/**
+ * Note that connecting to a host's current address failed.
+ *
+ * The host's next address, if it has another, is used from now on.
+ *
+ * \param[in] host  Hostname for Chrome DevTools.
+ * \return true if there is another address to try, false otherwise.
+ */
+bool display_address_failed(const char *host);
+
+/**
+ * Free the remembered host addresses.
+ */
+void display_free_addresses(void);
+
+/**
+ * Get the websocket path for the first page matching a display.
+ *
+ * Paths found by title are kept in an on-disk cache for a short time, and
+ * the cache is checked before asking Chrome DevTools.
+ *
+ * \param[in]  display     Display title substring, or websocket path.
+ * \param[in]  host        Hostname for Chrome DevTools.
+ * \param[in]  port        Port for Chrome DevTools.
+ * \param[out] cached_out  Returns whether the path came from the cache.
+ * \return the path, or NULL on error.
+ */
+char *display_get_path(const char *display, const char *host, int port,
+		bool *cached_out);
+
+/**
+ * Remove a display's path from the cache.
+ *
+ * Use this when a cached path turns out to be stale, before calling
+ * \ref display_get_path again to rediscover it.
+ *
+ * \param[in] display  Display title substring.
+ * \param[in] host     Hostname for Chrome DevTools.
+ * \param[in] port     Port for Chrome DevTools.
+ */
+void display_forget_path(const char *display, const char *host, int port);
+
+/**
+ * Get the websocket paths for every page matching a display.
+ *
+ * \param[in]  display    Display title substring, or websocket path.
+ * \param[in]  host       Hostname for Chrome DevTools.
+ * \param[in]  port       Port for Chrome DevTools.
+ * \param[out] paths_out  Returns array of paths on success.
+ * \param[out] count_out  Returns number of paths on success.
+ * \return true on success, false otherwise.
+ */
+bool display_get_paths(const char *display, const char *host, int port,
+		char ***paths_out, unsigned *count_out);
+
+/**
+ * Free an array of paths returned by \ref display_get_paths.
+ *
+ * \param[in] paths  Array of paths to free.
+ * \param[in] count  Number of paths in the array.
+ */
+void display_free_paths(char **paths, unsigned count);
+
+/**
+ * Get the websocket path for the browser, rather than a page.
+ *
+ * \param[in] host  Hostname for Chrome DevTools.
+ * \param[in] port  Port for Chrome DevTools.
+ * \return the path, or NULL on error.
+ */
+char *display_get_browser_path(const char *host, int port);
 
 #endif
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#define PRINT_FMT_ATTACH_TO_TARGET__ID_TARGET_ID \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"Target.attachToTarget\"," \
+		"\"params\":{" \
+			"\"targetId\":\"%s\"," \
+			"\"flatten\":true" \
+		"}" \
+	"}"
+
+char *msg_str_attach_to_target(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_ATTACH_TO_TARGET__ID_TARGET_ID, id,
+			msg->data.attach_to_target.target_id)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
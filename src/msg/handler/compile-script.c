@@ -0,0 +1,39 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#define PRINT_FMT_COMPILE_SCRIPT__ID_EXPRESSION \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"Runtime.compileScript\"," \
+		"\"params\":{" \
+			"\"expression\":\"%s\"," \
+			"\"sourceURL\":\"\"," \
+			"\"persistScript\":true" \
+		"}" \
+	"}"
+
+char *msg_str_compile_script(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_COMPILE_SCRIPT__ID_EXPRESSION, id,
+			msg->data.compile_script.expression)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
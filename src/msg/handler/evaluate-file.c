@@ -0,0 +1,47 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+/* The file is streamed into the expression after this. */
+#define PRINT_FMT_EVALUATE_FILE__ID \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"Runtime.evaluate\"," \
+		"\"params\":{" \
+			"\"expression\":\""
+
+#define EVALUATE_FILE_TAIL \
+			"\"" \
+		"}" \
+	"}"
+
+char *msg_str_evaluate_file(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_EVALUATE_FILE__ID, id)) {
+		return NULL;
+	}
+
+	if (!msg_stream_create(m, msg->data.evaluate_file.path,
+			EVALUATE_FILE_TAIL)) {
+		free(m);
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
@@ -12,21 +12,30 @@
 #include "msg/queue.h"
 #include "msg/private.h"
 
-#define PRINT_FMT_EVALUATE_START__ID_EXPRESSION \
+#define PRINT_FMT_EVALUATE_START__ID_EXPRESSION_AWAIT_BY_VALUE \
 	"{" \
 		"\"id\":%i," \
 		"\"method\":\"Runtime.evaluate\"," \
 		"\"params\":{" \
-			"\"expression\":\"%s\"" \
+			"\"expression\":\"%s\"," \
+			"\"awaitPromise\":%s," \
+			"\"returnByValue\":%s" \
 		"}" \
 	"}"
 
 char *msg_str_evaluate(const struct msg *msg, int id)
 {
+	const char *await_promise;
+	const char *return_by_value;
 	struct msg_container *m;
 
-	if (!msg_create(&m, PRINT_FMT_EVALUATE_START__ID_EXPRESSION, id,
-			msg->data.evaluate.expression)) {
+	await_promise = msg->data.evaluate.await_promise ? "true" : "false";
+	return_by_value = msg->data.evaluate.return_by_value ? "true" : "false";
+
+	if (!msg_create(&m,
+			PRINT_FMT_EVALUATE_START__ID_EXPRESSION_AWAIT_BY_VALUE,
+			id, msg->data.evaluate.expression,
+			await_promise, return_by_value)) {
 		return NULL;
 	}
 
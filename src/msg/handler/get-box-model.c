@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#define PRINT_FMT_GET_BOX_MODEL__ID_NODE \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"DOM.getBoxModel\"," \
+		"\"params\":{" \
+			"\"nodeId\":%i" \
+		"}" \
+	"}"
+
+char *msg_str_get_box_model(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_GET_BOX_MODEL__ID_NODE, id,
+			msg->data.get_box_model.node_id)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
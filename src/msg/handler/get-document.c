@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+/* Only the document node itself is needed; its descendants are found by
+ * querying. */
+#define PRINT_FMT_GET_DOCUMENT__ID \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"DOM.getDocument\"," \
+		"\"params\":{" \
+			"\"depth\":0" \
+		"}" \
+	"}"
+
+char *msg_str_get_document(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_GET_DOCUMENT__ID, id)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
@@ -0,0 +1,72 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#include "util/log.h"
+
+#define PRINT_FMT_QUERY_SELECTOR__ID_NODE_SELECTOR \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"DOM.querySelector\"," \
+		"\"params\":{" \
+			"\"nodeId\":%i," \
+			"\"selector\":\"%s\"" \
+		"}" \
+	"}"
+
+#define PRINT_FMT_QUERY_SELECTOR_ALL__ID_NODE_SELECTOR \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"DOM.querySelectorAll\"," \
+		"\"params\":{" \
+			"\"nodeId\":%i," \
+			"\"selector\":\"%s\"" \
+		"}" \
+	"}"
+
+char *msg_str_query_selector(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	switch (msg->type) {
+	case MSG_TYPE_QUERY_SELECTOR:
+		if (!msg_create(&m,
+				PRINT_FMT_QUERY_SELECTOR__ID_NODE_SELECTOR,
+				id,
+				msg->data.query_selector.node_id,
+				msg->data.query_selector.selector)) {
+			return NULL;
+		}
+		break;
+
+	case MSG_TYPE_QUERY_SELECTOR_ALL:
+		if (!msg_create(&m,
+				PRINT_FMT_QUERY_SELECTOR_ALL__ID_NODE_SELECTOR,
+				id,
+				msg->data.query_selector.node_id,
+				msg->data.query_selector.selector)) {
+			return NULL;
+		}
+		break;
+
+	default:
+		cdt_log(CDT_LOG_ERROR, "%s: Unexpected message type: %i",
+				__func__, msg->type);
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#define PRINT_FMT_REMOVE_BINDING__ID_NAME \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"Runtime.removeBinding\"," \
+		"\"params\":{" \
+			"\"name\":\"%s\"" \
+		"}" \
+	"}"
+
+char *msg_str_remove_binding(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_REMOVE_BINDING__ID_NAME, id,
+			msg->data.binding.name)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#define PRINT_FMT_RUN_SCRIPT__ID_SCRIPT_ID \
+	"{" \
+		"\"id\":%i," \
+		"\"method\":\"Runtime.runScript\"," \
+		"\"params\":{" \
+			"\"scriptId\":\"%s\"" \
+		"}" \
+	"}"
+
+char *msg_str_run_script(const struct msg *msg, int id)
+{
+	struct msg_container *m;
+
+	if (!msg_create(&m, PRINT_FMT_RUN_SCRIPT__ID_SCRIPT_ID, id,
+			msg->data.run_script.script_id)) {
+		return NULL;
+	}
+
+	m->type = msg->type;
+	m->id = id;
+
+	return m->str;
+}
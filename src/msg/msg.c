@@ -4,6 +4,7 @@
  * Copyright (c) 2022 Codethink
  */
 
+#include <time.h>
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -15,8 +16,169 @@
 
 #include "util/log.h"
 #include "util/util.h"
+#include "util/script.h"
+#include "util/locate.h"
 
-struct msg_ctx msg_g;
+struct msg_ctx *msg_ctx_create(void)
+{
+	struct msg_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+void msg_ctx_destroy(struct msg_ctx *ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	msg_queue_drain_send(ctx);
+	msg_queue_drain(&ctx->queue_sent);
+	free(ctx->session_id);
+	free(ctx);
+}
+
+/**
+ * Create a copy of a message string with the flattened session ID added.
+ *
+ * \param[in] ctx      The message context.
+ * \param[in] msg_str  The message to copy.
+ * \return the new message string, or NULL on error.
+ */
+static char *msg__add_session_id(const struct msg_ctx *ctx, char *msg_str)
+{
+	struct msg_container *old = msg_str_to_container(msg_str);
+	struct msg_container *cont;
+
+	if (!msg_create(&cont, "{\"sessionId\":\"%s\",%s",
+			ctx->session_id, msg_str + 1)) {
+		return NULL;
+	}
+
+	cont->type = old->type;
+	cont->prio = old->prio;
+	cont->coalesce = old->coalesce;
+	cont->idempotent = old->idempotent;
+	cont->response = old->response;
+	cont->response_pw = old->response_pw;
+	cont->sent_time = old->sent_time;
+	cont->queued = old->queued;
+	cont->id = old->id;
+	cont->stream = old->stream;
+	old->stream = NULL;
+
+	return cont->str;
+}
+
+void msg_ctx_set_timeout(struct msg_ctx *ctx, struct timer_wheel *timers,
+		unsigned timeout_ms, msg_timeout_fn fn, void *pw)
+{
+	ctx->timers = timers;
+	ctx->timeout_ms = timeout_ms;
+	ctx->timeout_fn = fn;
+	ctx->timeout_pw = pw;
+}
+
+bool msg_ctx_set_session(struct msg_ctx *ctx,
+		const char *session_id, size_t len)
+{
+	char *copy;
+
+	copy = strndup(session_id, len);
+	if (copy == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	free(ctx->session_id);
+	ctx->session_id = copy;
+
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		struct msg_queue *queue = &ctx->queue_send[i];
+		struct msg_container *next;
+
+		for (struct msg_container *m = queue->head;
+				m != NULL; m = next) {
+			char *msg_str;
+
+			next = m->next;
+
+			msg_str = msg__add_session_id(ctx, m->str);
+			if (msg_str == NULL) {
+				return false;
+			}
+
+			msg_queue_replace(queue, m->str, msg_str);
+			msg_destroy(m->str);
+		}
+	}
+
+	return true;
+}
+
+unsigned msg_ctx_reconnect(struct msg_ctx *ctx)
+{
+	unsigned dropped = 0;
+	char *msg_str;
+
+	memset(&ctx->scan, 0, sizeof(ctx->scan));
+	memset(ctx->sent_hash, 0, sizeof(ctx->sent_hash));
+	script_cache_clear(ctx->scripts);
+	locate_cache_clear(ctx->locate);
+
+	while ((msg_str = msg_queue_pop(&ctx->queue_sent)) != NULL) {
+		struct msg_container *cont = msg_str_to_container(msg_str);
+
+		timer_cancel(&cont->deadline);
+
+		if (!cont->idempotent) {
+			cdt_log(CDT_LOG_NOTICE, "Dropped unanswered message %i",
+					cont->id);
+			msg_abort(ctx, msg_str);
+			dropped++;
+			continue;
+		}
+
+		cdt_log(CDT_LOG_INFO, "Resending message %i", cont->id);
+		clock_gettime(CLOCK_MONOTONIC, &cont->queued);
+		msg_queue_push(msg_queue_get_send(ctx, cont->prio), msg_str);
+	}
+
+	return dropped;
+}
+
+void msg_ctx_set_scripts(struct msg_ctx *ctx, struct script_cache *scripts)
+{
+	ctx->scripts = scripts;
+}
+
+struct script_cache *msg_ctx_get_scripts(const struct msg_ctx *ctx)
+{
+	return ctx->scripts;
+}
+
+void msg_ctx_continue(struct msg_ctx *ctx, const struct msg_ctx *prev)
+{
+	if (prev != NULL) {
+		ctx->id = prev->id;
+	}
+}
+
+void msg_ctx_set_locate(struct msg_ctx *ctx, struct locate_cache *locate)
+{
+	ctx->locate = locate;
+}
+
+struct locate_cache *msg_ctx_get_locate(const struct msg_ctx *ctx)
+{
+	return ctx->locate;
+}
 
 bool msg_create(struct msg_container **msg, const char *restrict fmt, ...)
 {
@@ -73,29 +235,152 @@ error:
 void msg_destroy(char *msg)
 {
 	if (msg != NULL) {
-		free(msg_str_to_container(msg));
+		struct msg_container *cont = msg_str_to_container(msg);
+
+		timer_cancel(&cont->deadline);
+		msg_stream_destroy(cont->stream);
+		free(cont);
 	}
 }
 
+void msg_drop(char *msg_str)
+{
+	struct msg_container *cont = msg_str_to_container(msg_str);
+
+	if (cont->response != NULL) {
+		cont->response(cont->response_pw, cont->id, NULL, 0);
+	}
+
+	msg_destroy(msg_str);
+}
+
+void msg_abort(struct msg_ctx *ctx, char *msg_str)
+{
+	int id = msg_str_to_container(msg_str)->id;
+
+	msg_drop(msg_str);
+
+	if (ctx->timeout_fn != NULL) {
+		ctx->timeout_fn(ctx->timeout_pw, id);
+	}
+}
+
+bool msg_complete(char *msg_str, const char *data, size_t len)
+{
+	struct msg_container *cont = msg_str_to_container(msg_str);
+
+	if (cont == NULL || cont->response == NULL) {
+		return false;
+	}
+
+	cont->response(cont->response_pw, cont->id, data, len);
+	return true;
+}
+
 size_t msg_get_len(char *msg_str)
 {
 	struct msg_container *msg = msg_str_to_container(msg_str);
 	return msg->len;
 }
 
-bool msg_to_msg_str(const struct msg *msg, char **msg_str, int *id_out)
+enum msg_prio msg_type_get_prio(enum msg_type type)
 {
-	static uint16_t id;
+	static const enum msg_prio prio[] = {
+		[MSG_TYPE_SCREENCAST_FRAME_ACK] = MSG_PRIO_CONTROL,
+		[MSG_TYPE_CAPTURE_SCREENSHOT]   = MSG_PRIO_CONTROL,
+		[MSG_TYPE_START_SCREENCAST]     = MSG_PRIO_CONTROL,
+		[MSG_TYPE_STOP_SCREENCAST]      = MSG_PRIO_CONTROL,
+		[MSG_TYPE_SCROLL_GESTURE]       = MSG_PRIO_INPUT,
+		[MSG_TYPE_TOUCH_EVENT_START]    = MSG_PRIO_INPUT,
+		[MSG_TYPE_TOUCH_EVENT_MOVE]     = MSG_PRIO_INPUT,
+		[MSG_TYPE_TOUCH_EVENT_END]      = MSG_PRIO_INPUT,
+		[MSG_TYPE_EVALUATE]             = MSG_PRIO_BULK,
+		[MSG_TYPE_EVALUATE_FILE]        = MSG_PRIO_BULK,
+		[MSG_TYPE_ATTACH_TO_TARGET]     = MSG_PRIO_CONTROL,
+		[MSG_TYPE_RUNTIME_ENABLE]       = MSG_PRIO_CONTROL,
+		[MSG_TYPE_RUNTIME_DISABLE]      = MSG_PRIO_CONTROL,
+		[MSG_TYPE_ADD_BINDING]          = MSG_PRIO_CONTROL,
+		[MSG_TYPE_REMOVE_BINDING]       = MSG_PRIO_CONTROL,
+		[MSG_TYPE_COMPILE_SCRIPT]       = MSG_PRIO_BULK,
+		[MSG_TYPE_RUN_SCRIPT]           = MSG_PRIO_BULK,
+		[MSG_TYPE_GET_DOCUMENT]         = MSG_PRIO_CONTROL,
+		[MSG_TYPE_QUERY_SELECTOR]       = MSG_PRIO_CONTROL,
+		[MSG_TYPE_QUERY_SELECTOR_ALL]   = MSG_PRIO_CONTROL,
+		[MSG_TYPE_GET_BOX_MODEL]        = MSG_PRIO_CONTROL,
+	};
+
+	if (type >= CDT_ARRAY_COUNT(prio)) {
+		return MSG_PRIO_BULK;
+	}
 
+	return prio[type];
+}
+
+enum msg_coalesce msg_type_get_coalesce(enum msg_type type)
+{
+	static const enum msg_coalesce coalesce[] = {
+		[MSG_TYPE_START_SCREENCAST]     = MSG_COALESCE_SCREENCAST,
+		[MSG_TYPE_STOP_SCREENCAST]      = MSG_COALESCE_SCREENCAST,
+		[MSG_TYPE_TOUCH_EVENT_START]    = MSG_COALESCE_TOUCH,
+		[MSG_TYPE_TOUCH_EVENT_MOVE]     = MSG_COALESCE_TOUCH,
+		[MSG_TYPE_TOUCH_EVENT_END]      = MSG_COALESCE_TOUCH,
+	};
+
+	if (type >= CDT_ARRAY_COUNT(coalesce)) {
+		return MSG_COALESCE_NONE;
+	}
+
+	return coalesce[type];
+}
+
+bool msg_type_get_idempotent(enum msg_type type)
+{
+	static const bool idempotent[] = {
+		[MSG_TYPE_CAPTURE_SCREENSHOT]   = true,
+		[MSG_TYPE_STOP_SCREENCAST]      = true,
+		[MSG_TYPE_RUNTIME_ENABLE]       = true,
+		[MSG_TYPE_RUNTIME_DISABLE]      = true,
+		[MSG_TYPE_ADD_BINDING]          = true,
+		[MSG_TYPE_REMOVE_BINDING]       = true,
+		[MSG_TYPE_COMPILE_SCRIPT]       = true,
+		[MSG_TYPE_GET_DOCUMENT]         = true,
+		[MSG_TYPE_QUERY_SELECTOR]       = true,
+		[MSG_TYPE_QUERY_SELECTOR_ALL]   = true,
+		[MSG_TYPE_GET_BOX_MODEL]        = true,
+	};
+
+	if (type >= CDT_ARRAY_COUNT(idempotent)) {
+		return false;
+	}
+
+	return idempotent[type];
+}
+
+bool msg_to_msg_str(struct msg_ctx *ctx, const struct msg *msg,
+		char **msg_str, int *id_out)
+{
 	msg_str_fn msg_stringify[] = {
 		[MSG_TYPE_EVALUATE]             = msg_str_evaluate,
+		[MSG_TYPE_EVALUATE_FILE]        = msg_str_evaluate_file,
 		[MSG_TYPE_TOUCH_EVENT_END]      = msg_str_touch_event,
 		[MSG_TYPE_TOUCH_EVENT_MOVE]     = msg_str_touch_event,
 		[MSG_TYPE_TOUCH_EVENT_START]    = msg_str_touch_event,
 		[MSG_TYPE_SCROLL_GESTURE]       = msg_str_scroll_gesture,
 		[MSG_TYPE_START_SCREENCAST]     = msg_str_start_screencast,
+		[MSG_TYPE_STOP_SCREENCAST]      = msg_str_stop_screencast,
 		[MSG_TYPE_CAPTURE_SCREENSHOT]   = msg_str_capture_screenshot,
 		[MSG_TYPE_SCREENCAST_FRAME_ACK] = msg_str_screencast_frame_ack,
+		[MSG_TYPE_ATTACH_TO_TARGET]     = msg_str_attach_to_target,
+		[MSG_TYPE_RUNTIME_ENABLE]       = msg_str_runtime_enable,
+		[MSG_TYPE_RUNTIME_DISABLE]      = msg_str_runtime_disable,
+		[MSG_TYPE_ADD_BINDING]          = msg_str_add_binding,
+		[MSG_TYPE_REMOVE_BINDING]       = msg_str_remove_binding,
+		[MSG_TYPE_COMPILE_SCRIPT]       = msg_str_compile_script,
+		[MSG_TYPE_RUN_SCRIPT]           = msg_str_run_script,
+		[MSG_TYPE_GET_DOCUMENT]         = msg_str_get_document,
+		[MSG_TYPE_QUERY_SELECTOR]       = msg_str_query_selector,
+		[MSG_TYPE_QUERY_SELECTOR_ALL]   = msg_str_query_selector,
+		[MSG_TYPE_GET_BOX_MODEL]        = msg_str_get_box_model,
 	};
 
 	if (msg->type >= CDT_ARRAY_COUNT(msg_stringify)) {
@@ -104,7 +389,7 @@ bool msg_to_msg_str(const struct msg *msg, char **msg_str, int *id_out)
 		return false;
 	}
 
-	*msg_str = msg_stringify[msg->type](msg, id);
+	*msg_str = msg_stringify[msg->type](msg, ctx->id);
 	if (*msg_str == NULL) {
 		cdt_log(CDT_LOG_ERROR,
 				"%s: Failed to assemble message type: %i",
@@ -112,40 +397,91 @@ bool msg_to_msg_str(const struct msg *msg, char **msg_str, int *id_out)
 		return false;
 	}
 
-	*id_out = id++;
+	msg_str_to_container(*msg_str)->prio = msg_type_get_prio(msg->type);
+	msg_str_to_container(*msg_str)->coalesce =
+			msg_type_get_coalesce(msg->type);
+	msg_str_to_container(*msg_str)->idempotent = msg->idempotent ||
+			msg_type_get_idempotent(msg->type);
+	msg_str_to_container(*msg_str)->response = msg->response;
+	msg_str_to_container(*msg_str)->response_pw = msg->pw;
+	msg_str_to_container(*msg_str)->sent_time = msg->sent_time;
+
+	if (ctx->session_id != NULL) {
+		char *flat = msg__add_session_id(ctx, *msg_str);
+
+		msg_destroy(*msg_str);
+		*msg_str = flat;
+		if (*msg_str == NULL) {
+			return false;
+		}
+	}
+
+	if (id_out != NULL) {
+		*id_out = ctx->id;
+	}
+	ctx->id++;
 	return true;
 }
 
-bool msg_queue_for_send(const struct msg *msg, int *id_out)
+bool msg_queue_for_send(struct msg_ctx *ctx, const struct msg *msg,
+		int *id_out)
 {
+	struct msg_container *cont;
 	char *msg_str;
 
-	if (!msg_to_msg_str(msg, &msg_str, id_out)) {
+	if (!msg_to_msg_str(ctx, msg, &msg_str, id_out)) {
 		return false;
 	}
 
-	msg_queue_push(msg_queue_get_send(), msg_str);
+	cont = msg_str_to_container(msg_str);
+	clock_gettime(CLOCK_MONOTONIC, &cont->queued);
+
+	msg_queue_push(msg_queue_get_send(ctx, cont->prio), msg_str);
+
+	if (ctx->window_stats.queued_max < msg_queue_send_count(ctx)) {
+		ctx->window_stats.queued_max = msg_queue_send_count(ctx);
+	}
 	return true;
 }
 
-struct msg_str_ctx {
-	bool quote;
-	bool begin;
-	int depth;
-	int id;
-};
+bool msg_queue_for_send_replace(struct msg_ctx *ctx, const struct msg *msg,
+		int id_old, int *id_out)
+{
+	struct msg_queue *queue;
+	char *msg_old;
+	char *msg_str;
+
+	queue = msg_queue_get_send(ctx, msg_type_get_prio(msg->type));
+	msg_old = msg_queue_find_by_id(queue, id_old);
+	if (msg_old == NULL) {
+		return false;
+	}
+
+	if (!msg_to_msg_str(ctx, msg, &msg_str, id_out)) {
+		return false;
+	}
+
+	/* Keep the original queue time, for queue wait measurement. */
+	msg_str_to_container(msg_str)->queued =
+			msg_str_to_container(msg_old)->queued;
+
+	msg_queue_replace(queue, msg_old, msg_str);
+	msg_destroy(msg_old);
+	return true;
+}
 
 static void msg_str_chunk_scan_reset(struct msg_str_ctx *c)
 {
 	memset(c, 0, sizeof(*c));
 }
 
-enum msg_scan msg_str_chunk_scan(const char *str, size_t len)
+enum msg_scan msg_str_chunk_scan(struct msg_ctx *ctx,
+		const char *str, size_t len)
 {
-	static struct msg_str_ctx c;
+	struct msg_str_ctx *c = &ctx->scan;
 	const char *end = str + len;
 
-	if (c.depth == 0) {
+	if (c->depth == 0) {
 		if (str == NULL || len == 0 || str[0] != '{') {
 			return MSG_SCAN_ERROR;
 		}
@@ -153,29 +489,29 @@ enum msg_scan msg_str_chunk_scan(const char *str, size_t len)
 
 	while (str < end) {
 		switch (*str) {
-		case '\\': str++; c.begin = false; break;
-		case ',': if (!c.quote) { c.begin = true;            } break;
-		case '[': if (!c.quote) { c.begin = true; c.depth++; } break;
-		case '{': if (!c.quote) { c.begin = true; c.depth++; } break;
-		case ']': if (!c.quote) {                 c.depth--; } break;
-		case '}': if (!c.quote) {                 c.depth--; } break;
+		case '\\': str++; c->begin = false; break;
+		case ',': if (!c->quote) { c->begin = true;             } break;
+		case '[': if (!c->quote) { c->begin = true; c->depth++; } break;
+		case '{': if (!c->quote) { c->begin = true; c->depth++; } break;
+		case ']': if (!c->quote) {                  c->depth--; } break;
+		case '}': if (!c->quote) {                  c->depth--; } break;
 		case '"':
-			c.quote = !c.quote;
+			c->quote = !c->quote;
 			/* Fall through. */
 		default:
-			c.begin = false;
+			c->begin = false;
 			break;
 		}
 
 		str++;
 	}
 
-	if (c.depth != 0) {
+	if (c->depth != 0) {
 		/* More message required. */
 		return MSG_SCAN_CONTINUE;
 	}
 
-	msg_str_chunk_scan_reset(&c);
+	msg_str_chunk_scan_reset(c);
 	return MSG_SCAN_COMPLETE;
 }
 
@@ -225,6 +561,33 @@ static bool msg_str_get_value_len(
 			pos++;
 		}
 		break;
+	case MSG_SCAN_TYPE_ARRAY:
+		{
+			int depth = 0;
+			bool quote = false;
+
+			if (pos + 1 >= end || pos[0] != '[') {
+				return false;
+			}
+
+			while (pos < end) {
+				if (*pos == '\\') {
+					pos += 2;
+					continue;
+				} else if (*pos == '"') {
+					quote = !quote;
+				} else if (!quote && *pos == '[') {
+					depth++;
+				} else if (!quote && *pos == ']') {
+					if (--depth == 0) {
+						*len = (size_t)(pos - str) - 1;
+						return true;
+					}
+				}
+				pos++;
+			}
+		}
+		break;
 	}
 
 	return false;
@@ -311,6 +674,7 @@ static const struct msg_scan_spec *msg_str_scan_get_match(
 			return s;
 
 		case MSG_SCAN_TYPE_STRING:
+		case MSG_SCAN_TYPE_ARRAY:
 			value->string.str = pos + 1;
 			value->string.len = value_len;
 			return s;
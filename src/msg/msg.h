@@ -7,6 +7,26 @@
 #ifndef CDT_MSG_H
 #define CDT_MSG_H
 
+/**
+ * Message context.
+ *
+ * Holds the send and sent queues, the message id counter and the received
+ * message scan state for a single DevTools connection. Each connection must
+ * have its own context.
+ */
+struct msg_ctx;
+
+/**
+ * Callback for a response to a sent message.
+ *
+ * \param[in] pw   Client data given with the message.
+ * \param[in] id   Id of the message.
+ * \param[in] msg  The response, or NULL if none will come.
+ * \param[in] len  Length of msg in bytes.
+ */
+typedef void (*msg_response_fn)(void *pw, int id,
+		const char *msg, size_t len);
+
 struct msg {
 	enum msg_type {
 		MSG_TYPE_SCREENCAST_FRAME_ACK,
@@ -18,13 +38,64 @@ struct msg {
 		MSG_TYPE_TOUCH_EVENT_MOVE,
 		MSG_TYPE_TOUCH_EVENT_END,
 		MSG_TYPE_EVALUATE,
+		MSG_TYPE_ATTACH_TO_TARGET,
+		MSG_TYPE_RUNTIME_ENABLE,
+		MSG_TYPE_RUNTIME_DISABLE,
+		MSG_TYPE_ADD_BINDING,
+		MSG_TYPE_REMOVE_BINDING,
+		MSG_TYPE_COMPILE_SCRIPT,
+		MSG_TYPE_RUN_SCRIPT,
+		MSG_TYPE_EVALUATE_FILE,
+		MSG_TYPE_GET_DOCUMENT,
+		MSG_TYPE_QUERY_SELECTOR,
+		MSG_TYPE_QUERY_SELECTOR_ALL,
+		MSG_TYPE_GET_BOX_MODEL,
 	} type;
 
+	/**
+	 * Whether the message is safe to send again after a reconnect.
+	 *
+	 * Some message types are always safe to send again. This marks
+	 * messages of other types, e.g. a script without side effects.
+	 */
+	bool idempotent;
+
+	/**
+	 * Function to call with the response, or NULL to pass the response
+	 * to the command's message handler.
+	 *
+	 * A message that gets no response, because it is superseded before
+	 * it is sent, is abandoned, or times out, has its callback called
+	 * with a NULL response.
+	 */
+	msg_response_fn response;
+	void *pw; /**< Client data for `response`. */
+
+	/** Returns the time the message is written to the connection, or
+	 *  NULL. Updated if the message is sent again after a reconnect. */
+	struct timespec *sent_time;
+
 	union {
 		struct {
 			/** JSON escaped JavaScript expression to run. */
 			const char *expression;
+			/** Whether to wait for a promise result to settle. */
+			bool await_promise;
+			/** Whether to return an object result as JSON. */
+			bool return_by_value;
 		} evaluate;
+		struct {
+			/** Path of a file of JavaScript to run. */
+			const char *path;
+		} evaluate_file;
+		struct {
+			/** JSON escaped JavaScript to compile and keep. */
+			const char *expression;
+		} compile_script;
+		struct {
+			/** Id of a script from `Runtime.compileScript`. */
+			const char *script_id;
+		} run_script;
 		struct {
 			int x;
 			int y;
@@ -49,16 +120,251 @@ struct msg {
 		struct {
 			int session_id;
 		} screencast_frame_ack;
+		struct {
+			const char *target_id;
+		} attach_to_target;
+		struct {
+			/** Name of the page's function to notify cdt. */
+			const char *name;
+		} binding;
+		struct {
+			int node_id; /**< Node to search under. */
+			/** JSON escaped CSS selector. */
+			const char *selector;
+		} query_selector;
+		struct {
+			int node_id;
+		} get_box_model;
 	} data;
 };
 
+/**
+ * Create a message context.
+ *
+ * \return the new message context, or NULL on error.
+ */
+struct msg_ctx *msg_ctx_create(void);
+
+/**
+ * Destroy a message context, and any messages still queued in it.
+ *
+ * \param[in] ctx  The message context to destroy.
+ */
+void msg_ctx_destroy(struct msg_ctx *ctx);
+
+/**
+ * Continue a connection's message ids from a previous message context.
+ *
+ * Responses to messages sent on the previous context may still arrive, so
+ * the new context must not reuse their ids.
+ *
+ * \param[in] ctx   The new message context.
+ * \param[in] prev  The connection's previous message context, or NULL.
+ */
+void msg_ctx_continue(struct msg_ctx *ctx, const struct msg_ctx *prev);
+
+/**
+ * Set the flattened session that a message context's messages are for.
+ *
+ * When a connection is to the browser rather than to a page, messages for
+ * a page must carry the session ID from attaching to the page's target.
+ * Once set, the session ID is added to every message, including any that
+ * are already waiting to be sent.
+ *
+ * \param[in] ctx         The message context.
+ * \param[in] session_id  The session ID.
+ * \param[in] len         Length of session_id in bytes.
+ * \return true on success, false otherwise.
+ */
+bool msg_ctx_set_session(struct msg_ctx *ctx,
+		const char *session_id, size_t len);
+
+/**
+ * Prepare a message context for sending on a new connection.
+ *
+ * Messages that were sent, but got no response before the old connection
+ * was lost, are queued to be sent again if they are idempotent, keeping
+ * their ids. Others are dropped, since there is no knowing whether they
+ * took effect, and passed to the context's timeout function, as their
+ * responses will never arrive.
+ *
+ * \param[in] ctx  The message context.
+ * \return the number of messages dropped.
+ */
+unsigned msg_ctx_reconnect(struct msg_ctx *ctx);
+
+struct script_cache;
+
+/**
+ * Set the cache of scripts compiled on a message context's connection.
+ *
+ * The cache is not owned by the message context. It outlives any one
+ * command when a connection is kept open, and is cleared by
+ * \ref msg_ctx_reconnect, since script ids don't survive the connection.
+ *
+ * \param[in] ctx      The message context.
+ * \param[in] scripts  The script cache, or NULL for none.
+ */
+void msg_ctx_set_scripts(struct msg_ctx *ctx, struct script_cache *scripts);
+
+/**
+ * Get the cache of scripts compiled on a message context's connection.
+ *
+ * \param[in] ctx  The message context.
+ * \return the script cache, or NULL if there is none.
+ */
+struct script_cache *msg_ctx_get_scripts(const struct msg_ctx *ctx);
+
+struct locate_cache;
+
+/**
+ * Set the cache of elements located on a message context's connection.
+ *
+ * The cache is not owned by the message context.
+ *
+ * \param[in] ctx     The message context.
+ * \param[in] locate  The locate cache, or NULL for none.
+ */
+void msg_ctx_set_locate(struct msg_ctx *ctx, struct locate_cache *locate);
+
+/**
+ * Get the cache of elements located on a message context's connection.
+ *
+ * \param[in] ctx  The message context.
+ * \return the locate cache, or NULL if there is none.
+ */
+struct locate_cache *msg_ctx_get_locate(const struct msg_ctx *ctx);
+
+/**
+ * Callback for a sent message that got no response in time.
+ *
+ * The message has been removed from the sent queue and destroyed, after
+ * its response callback, if it has one, was called with a NULL response.
+ *
+ * \param[in] pw  Client data passed to \ref msg_ctx_set_timeout.
+ * \param[in] id  Id of the message.
+ */
+typedef void (*msg_timeout_fn)(void *pw, int id);
+
+struct timer_wheel;
+
+/**
+ * Set a deadline for responses to sent messages.
+ *
+ * \param[in] ctx         The message context.
+ * \param[in] timers      Timer wheel to run the deadlines on.
+ * \param[in] timeout_ms  Time to wait for each response, or 0 for ever.
+ * \param[in] fn          Function to call when a response is overdue.
+ * \param[in] pw          Client data to pass to `fn`.
+ */
+void msg_ctx_set_timeout(struct msg_ctx *ctx, struct timer_wheel *timers,
+		unsigned timeout_ms, msg_timeout_fn fn, void *pw);
+
 void msg_destroy(char *msg);
 
+/**
+ * Destroy a message that will get no response.
+ *
+ * The message's response callback, if it has one, is called with a NULL
+ * response first.
+ *
+ * \param[in] msg_str  The message to drop.
+ */
+void msg_drop(char *msg_str);
+
+/**
+ * Abandon a message that can't be sent.
+ *
+ * The message is dropped, as by \ref msg_drop, and its id passed to the
+ * context's timeout function, since no response will arrive.
+ *
+ * \param[in] ctx      The message context the message is from.
+ * \param[in] msg_str  The message to abandon.
+ */
+void msg_abort(struct msg_ctx *ctx, char *msg_str);
+
+/**
+ * Pass a response to its message's response callback, if it has one.
+ *
+ * \param[in] msg_str  The sent message, or NULL.
+ * \param[in] data     The response.
+ * \param[in] len      Length of the response in bytes.
+ * \return true if the message's callback handled the response, or false
+ *         if it should be passed to the command's message handler.
+ */
+bool msg_complete(char *msg_str, const char *data, size_t len);
+
 size_t msg_get_len(char *msg_str);
 
-bool msg_to_msg_str(const struct msg *msg, char **msg_str, int *id_out);
+/**
+ * Get whether a message has a body to stream after its text.
+ *
+ * The message's text is sent as the first fragment of a websocket message,
+ * and \ref msg_stream_next gives the rest. Nothing else may be sent on the
+ * connection until the last fragment has been sent.
+ *
+ * \param[in] msg_str  The message.
+ * \return true if the message is streamed.
+ */
+bool msg_is_streamed(char *msg_str);
+
+/** Outcome of getting the next fragment of a streamed message. */
+enum msg_stream_state {
+	MSG_STREAM_MORE,  /**< Got a fragment, with more to come. */
+	MSG_STREAM_LAST,  /**< Got the last fragment. */
+	MSG_STREAM_ERROR, /**< The body could not be read. */
+};
 
-bool msg_queue_for_send(const struct msg *msg, int *id_out);
+/**
+ * Get the next fragment of a streamed message.
+ *
+ * The fragment has padding for lws before and after it. It is only valid
+ * until the next call.
+ *
+ * If the body can't be read, no fragment is given. The message can't be
+ * finished, so the connection must be closed.
+ *
+ * \param[in]  msg_str  The message being sent.
+ * \param[out] data     Returns the fragment.
+ * \param[out] len      Returns the length of the fragment in bytes.
+ * \return MSG_STREAM_LAST if this is the last fragment, MSG_STREAM_MORE if
+ *         more are to come, or MSG_STREAM_ERROR on error.
+ */
+enum msg_stream_state msg_stream_next(char *msg_str, char **data, size_t *len);
+
+bool msg_to_msg_str(struct msg_ctx *ctx, const struct msg *msg,
+		char **msg_str, int *id_out);
+
+/**
+ * Queue a message to be sent.
+ *
+ * If the message has a response callback, the response is passed to it
+ * rather than to the command's message handler, so the command needn't
+ * keep track of the message's id.
+ *
+ * \param[in]  ctx     The message context.
+ * \param[in]  msg     The message to queue.
+ * \param[out] id_out  Returns the id of the message on success, or NULL.
+ * \return true on success, false otherwise.
+ */
+bool msg_queue_for_send(struct msg_ctx *ctx, const struct msg *msg,
+		int *id_out);
+
+/**
+ * Replace a message that is still waiting to be sent.
+ *
+ * The new message takes the place of the old one in the send queue, and the
+ * old message is destroyed without being sent.
+ *
+ * \param[in]  ctx     The message context.
+ * \param[in]  msg     The message to queue in place of the old one.
+ * \param[in]  id_old  Id of the queued message to replace.
+ * \param[out] id_out  Returns the id of the new message on success.
+ * \return true if the message was replaced, or false if the old message
+ *         is no longer waiting to be sent, or on error.
+ */
+bool msg_queue_for_send_replace(struct msg_ctx *ctx, const struct msg *msg,
+		int id_old, int *id_out);
 
 enum msg_scan {
 	MSG_SCAN_COMPLETE, /**< Have complete message. */
@@ -69,6 +375,7 @@ enum msg_scan {
 /**
  * Scan a message string (JSON) for an ID at the top level.
  *
+ * \param[in]  ctx  The message context the message was received on.
  * \param[in]  str  Message chunk data.
  * \param[in]  len  Message chunk length.
  * \param[out] id   Returns message ID on MSG_SCAN_COMPLETE only.
@@ -76,7 +383,8 @@ enum msg_scan {
  *         MSG_SCAN_CONTINUE if message needs more data.
  *         MSG_SCAN_ERROR on error.
  */
-enum msg_scan msg_str_chunk_scan(const char *str, size_t len);
+enum msg_scan msg_str_chunk_scan(struct msg_ctx *ctx,
+		const char *str, size_t len);
 
 struct msg_scan_spec {
 	int depth;
@@ -85,6 +393,7 @@ struct msg_scan_spec {
 		MSG_SCAN_TYPE_FLOATING_POINT,
 		MSG_SCAN_TYPE_INTEGER,
 		MSG_SCAN_TYPE_STRING,
+		MSG_SCAN_TYPE_ARRAY, /**< Gives the array's contents. */
 	} type;
 };
 union msg_scan_data {
@@ -7,17 +7,79 @@
 #ifndef CDT_MSG_PRIVATE_H
 #define CDT_MSG_PRIVATE_H
 
+#include <time.h>
+
 #include <libwebsockets.h>
 
+#include "util/timer.h"
+
+/** Number of sent message hash buckets; must be a power of two. */
+#define MSG_SENT_HASH_SIZE 64
+
+/** State for scanning a message that arrives in several chunks. */
+struct msg_str_ctx {
+	bool quote;
+	bool begin;
+	int depth;
+	int id;
+};
+
+/** Message context for a single DevTools connection. */
 struct msg_ctx {
-	struct msg_queue queue_send;
+	struct msg_queue queue_send[MSG_PRIO__COUNT];
 	struct msg_queue queue_sent;
+
+	/** Sent messages, hashed by id, for matching responses. */
+	struct msg_container *sent_hash[MSG_SENT_HASH_SIZE];
+
+	/** Consecutive pops each send queue has been passed over for. */
+	unsigned skipped[MSG_PRIO__COUNT];
+	struct msg_queue_stats stats[MSG_PRIO__COUNT];
+
+	/** Maximum messages in flight, or 0 for no limit. */
+	unsigned window;
+	bool stalled; /**< Whether sending is stalled on a full window. */
+	struct timespec stall_start;
+	struct msg_window_stats window_stats;
+
+	/** Timer wheel for response deadlines, or NULL for none. */
+	struct timer_wheel *timers;
+	unsigned timeout_ms; /**< Time to wait for a response. */
+	msg_timeout_fn timeout_fn;
+	void *timeout_pw;
+
+	/** Id to give the next message. */
+	uint16_t id;
+
+	/** Flattened session ID to add to messages, or NULL. */
+	char *session_id;
+
+	/** Scripts compiled on the connection, or NULL. Not owned. */
+	struct script_cache *scripts;
+
+	/** Elements located on the connection, or NULL. Not owned. */
+	struct locate_cache *locate;
+
+	/** Received message chunk scan state. */
+	struct msg_str_ctx scan;
 };
 
 struct msg_container {
 	struct msg_container *prev;
 	struct msg_container *next;
 	enum msg_type type;
+	enum msg_prio prio;
+	enum msg_coalesce coalesce;
+	bool idempotent;
+	msg_response_fn response;
+	void *response_pw;
+	struct timespec *sent_time; /**< Where to record `sent`, or NULL. */
+	struct msg_container *hash_next; /**< Next in sent hash bucket. */
+	struct timespec queued;  /**< Time queued for sending. */
+	struct timespec sent;    /**< Time sent, once on the sent queue. */
+	struct msg_ctx *ctx;     /**< Context the message was sent on. */
+	struct timer deadline;   /**< Response deadline, once sent. */
+	struct msg_stream *stream; /**< Body to stream after `str`, or NULL. */
 	size_t offset;
 	int id;
 	char *str;
@@ -25,8 +87,6 @@ struct msg_container {
 	char data[];
 };
 
-extern struct msg_ctx msg_g;
-
 /**
  * Variadic function to build message container with internal message string.
  */
@@ -49,16 +109,74 @@ static inline struct msg_container *msg_str_to_container(char *msg_str)
 			- offsetof(struct msg_container, data));
 }
 
+/**
+ * Give a message a body to stream from a file after its text.
+ *
+ * The message's text is sent first, and must end part way through a JSON
+ * string. The file is JSON escaped into the string as it is sent, a
+ * fragment at a time, and then the tail ends the message.
+ *
+ * \param[in] cont  The message container.
+ * \param[in] path  Path of the file to stream.
+ * \param[in] tail  Static text to end the message with.
+ * \return true on success, false otherwise.
+ */
+bool msg_stream_create(struct msg_container *cont,
+		const char *path, const char *tail);
+
+/**
+ * Destroy a message's stream, closing its file.
+ *
+ * \param[in] stream  The stream to destroy, or NULL.
+ */
+void msg_stream_destroy(struct msg_stream *stream);
+
 /**
  * Prototype for message type-specific handler: message to string.
  */
 typedef char *(*msg_str_fn)(const struct msg *msg, int id);
 
+/**
+ * Get the send queue priority class for a message type.
+ *
+ * \param[in] type  The message type.
+ * \return the priority class.
+ */
+enum msg_prio msg_type_get_prio(enum msg_type type);
+
+/**
+ * Get the coalescing key for a message type.
+ *
+ * \param[in] type  The message type.
+ * \return the coalescing key.
+ */
+enum msg_coalesce msg_type_get_coalesce(enum msg_type type);
+
+/**
+ * Get whether messages of a type are always safe to send again.
+ *
+ * \param[in] type  The message type.
+ * \return true if the message type is idempotent.
+ */
+bool msg_type_get_idempotent(enum msg_type type);
+
 /* Handler functions in msg/handler/ .c files. */
 char *msg_str_evaluate(const struct msg *msg, int id);
+char *msg_str_evaluate_file(const struct msg *msg, int id);
 char *msg_str_touch_event(const struct msg *msg, int id);
 char *msg_str_scroll_gesture(const struct msg *msg, int id);
 char *msg_str_start_screencast(const struct msg *msg, int id);
+char *msg_str_stop_screencast(const struct msg *msg, int id);
+char *msg_str_attach_to_target(const struct msg *msg, int id);
+char *msg_str_runtime_enable(const struct msg *msg, int id);
+char *msg_str_runtime_disable(const struct msg *msg, int id);
+char *msg_str_add_binding(const struct msg *msg, int id);
+char *msg_str_remove_binding(const struct msg *msg, int id);
+char *msg_str_compile_script(const struct msg *msg, int id);
+char *msg_str_run_script(const struct msg *msg, int id);
+char *msg_str_get_document(const struct msg *msg, int id);
+char *msg_str_query_selector(const struct msg *msg, int id);
+char *msg_str_get_box_model(const struct msg *msg, int id);
 char *msg_str_capture_screenshot(const struct msg *msg, int id);
 char *msg_str_screencast_frame_ack(const struct msg *msg, int id);
 
@@ -4,32 +4,389 @@
  * Copyright (c) 2022 Codethink
  */
 
+#include <time.h>
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <inttypes.h>
 
 #include "msg.h"
 #include "queue.h"
 #include "private.h"
 
-struct msg_queue *msg_queue_get_send(void)
+#include "util/log.h"
+#include "util/time.h"
+
+/**
+ * Number of consecutive pops a non-empty send queue may be passed over for
+ * before it is given a turn.
+ */
+#define MSG_QUEUE_STARVE_LIMIT 8
+
+/** Length of the start of a message's text kept once it is sent. */
+#define MSG_QUEUE_SENT_SUMMARY_LEN 80
+
+struct msg_queue *msg_queue_get_send(struct msg_ctx *ctx,
+		enum msg_prio prio)
+{
+	assert(prio < MSG_PRIO__COUNT);
+
+	return &ctx->queue_send[prio];
+}
+
+unsigned msg_queue_send_count(const struct msg_ctx *ctx)
+{
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		count += ctx->queue_send[i].count;
+	}
+
+	return count;
+}
+
+void msg_queue_set_window(struct msg_ctx *ctx, unsigned window)
+{
+	ctx->window = window;
+}
+
+bool msg_queue_window_full(const struct msg_ctx *ctx)
 {
-	return &msg_g.queue_send;
+	return ctx->window != 0 && ctx->queue_sent.count >= ctx->window;
 }
 
-struct msg_queue *msg_queue_get_sent(void)
+bool msg_queue_can_send(const struct msg_ctx *ctx)
 {
-	return &msg_g.queue_sent;
+	return msg_queue_send_count(ctx) > 0 && !msg_queue_window_full(ctx);
+}
+
+bool msg_queue_backpressure(const struct msg_ctx *ctx)
+{
+	return msg_queue_send_count(ctx) > 0 || msg_queue_window_full(ctx);
+}
+
+/**
+ * Update the window stall statistics.
+ *
+ * \param[in] ctx      The message context.
+ * \param[in] stalled  Whether sending is now stalled on a full window.
+ * \param[in] now      The current time.
+ */
+static void msg_queue__stall(struct msg_ctx *ctx, bool stalled,
+		const struct timespec *now)
+{
+	struct msg_window_stats *stats = &ctx->window_stats;
+	int64_t stall;
+
+	if (stalled == ctx->stalled) {
+		return;
+	}
+
+	ctx->stalled = stalled;
+	if (stalled) {
+		ctx->stall_start = *now;
+		stats->stalls++;
+		return;
+	}
+
+	stall = time_diff_us(&ctx->stall_start, now);
+	stats->stall_total_us += stall;
+	if (stats->stall_max_us < stall) {
+		stats->stall_max_us = stall;
+	}
+}
+
+/**
+ * Pick which send queue to pop the next message from.
+ *
+ * \param[in] ctx  The message context.
+ * \return the priority class to pop from, or MSG_PRIO__COUNT if all the
+ *         send queues are empty.
+ */
+static enum msg_prio msg_queue__pick_send(const struct msg_ctx *ctx)
+{
+	enum msg_prio pick = MSG_PRIO__COUNT;
+
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		if (ctx->queue_send[i].head == NULL) {
+			continue;
+		}
+
+		if (ctx->skipped[i] >= MSG_QUEUE_STARVE_LIMIT) {
+			return i;
+		}
+
+		if (pick == MSG_PRIO__COUNT) {
+			pick = i;
+		}
+	}
+
+	return pick;
+}
+
+char *msg_queue_pop_send(struct msg_ctx *ctx)
+{
+	struct msg_container *msg;
+	struct msg_queue_stats *stats;
+	struct timespec time_now;
+	enum msg_prio prio;
+	bool have_time;
+	int64_t wait;
+
+	prio = msg_queue__pick_send(ctx);
+	if (prio == MSG_PRIO__COUNT) {
+		return NULL;
+	}
+
+	have_time = (clock_gettime(CLOCK_MONOTONIC, &time_now) == 0);
+
+	if (msg_queue_window_full(ctx)) {
+		if (have_time) {
+			msg_queue__stall(ctx, true, &time_now);
+		}
+		return NULL;
+	}
+
+	if (have_time) {
+		msg_queue__stall(ctx, false, &time_now);
+	}
+
+	/* Count the popped message as in flight. */
+	if (ctx->window_stats.sent_max < ctx->queue_sent.count + 1) {
+		ctx->window_stats.sent_max = ctx->queue_sent.count + 1;
+	}
+
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		if (i == prio) {
+			ctx->skipped[i] = 0;
+		} else if (ctx->queue_send[i].head != NULL) {
+			ctx->skipped[i]++;
+		}
+	}
+
+	msg = msg_str_to_container(msg_queue_pop(&ctx->queue_send[prio]));
+	msg->coalesce = MSG_COALESCE_NONE;
+
+	stats = &ctx->stats[prio];
+	stats->sent++;
+	if (have_time) {
+		wait = time_diff_us(&msg->queued, &time_now);
+		stats->wait_total_us += wait;
+		if (stats->wait_max_us < wait) {
+			stats->wait_max_us = wait;
+		}
+	}
+
+	return msg->str;
+}
+
+void msg_queue_drain_send(struct msg_ctx *ctx)
+{
+	for (unsigned i = 0; i < MSG_PRIO__COUNT; i++) {
+		msg_queue_drain(&ctx->queue_send[i]);
+		ctx->skipped[i] = 0;
+	}
+}
+
+const struct msg_queue_stats *msg_queue_get_send_stats(
+		const struct msg_ctx *ctx, enum msg_prio prio)
+{
+	assert(prio < MSG_PRIO__COUNT);
+
+	return &ctx->stats[prio];
+}
+
+const struct msg_window_stats *msg_queue_get_window_stats(
+		const struct msg_ctx *ctx)
+{
+	return &ctx->window_stats;
+}
+
+struct msg_queue *msg_queue_get_sent(struct msg_ctx *ctx)
+{
+	return &ctx->queue_sent;
+}
+
+static struct msg_container **msg_queue__sent_bucket(struct msg_ctx *ctx,
+		int id)
+{
+	return &ctx->sent_hash[(unsigned)id & (MSG_SENT_HASH_SIZE - 1)];
+}
+
+/**
+ * Remove a message from the sent queue and the sent hash.
+ *
+ * \param[in] ctx  The message context.
+ * \param[in] msg  The sent message to remove.
+ */
+static void msg_queue__unlink_sent(struct msg_ctx *ctx,
+		struct msg_container *msg)
+{
+	struct msg_container **m = msg_queue__sent_bucket(ctx, msg->id);
+
+	while (*m != NULL) {
+		if (*m == msg) {
+			*m = msg->hash_next;
+			break;
+		}
+		m = &(*m)->hash_next;
+	}
+	msg->hash_next = NULL;
+
+	msg_queue_remove(&ctx->queue_sent, msg->str);
+}
+
+/**
+ * Handle a sent message's response deadline passing.
+ *
+ * \param[in] pw  The message container.
+ */
+static void msg_queue__deadline(void *pw)
+{
+	struct msg_container *msg = pw;
+
+	cdt_log(CDT_LOG_DEBUG, "No response to: %s", msg->str);
+
+	msg_queue__unlink_sent(msg->ctx, msg);
+	msg_abort(msg->ctx, msg->str);
+}
+
+/**
+ * Replace a sent message with a compact record of it.
+ *
+ * A sent message is only needed to match its response, so all but the
+ * start of its text is let go, and large scripts aren't held until their
+ * response. Messages that may be sent again after a reconnect keep their
+ * text, as do all messages when debug logging.
+ *
+ * \param[in] msg  The sent message.
+ * \return the message to keep on the sent queue.
+ */
+static struct msg_container *msg_queue__compact(struct msg_container *msg)
+{
+	struct msg_container *record;
+
+	/* A streamed body has been sent in full, so its file is done. */
+	msg_stream_destroy(msg->stream);
+	msg->stream = NULL;
+
+	if (msg->idempotent || msg->len <= MSG_QUEUE_SENT_SUMMARY_LEN ||
+	    cdt_log_get_level() >= CDT_LOG_DEBUG) {
+		return msg;
+	}
+
+	if (!msg_create(&record, "%.*s...",
+			MSG_QUEUE_SENT_SUMMARY_LEN, msg->str)) {
+		/* Keeping the whole message will do. */
+		return msg;
+	}
+
+	record->type = msg->type;
+	record->prio = msg->prio;
+	record->idempotent = msg->idempotent;
+	record->response = msg->response;
+	record->response_pw = msg->response_pw;
+	record->sent_time = msg->sent_time;
+	record->queued = msg->queued;
+	record->id = msg->id;
+
+	msg_destroy(msg->str);
+	return record;
+}
+
+void msg_queue_push_sent(struct msg_ctx *ctx, char *msg_str)
+{
+	struct msg_container *msg;
+	struct msg_container **bucket;
+
+	msg = msg_queue__compact(msg_str_to_container(msg_str));
+	bucket = msg_queue__sent_bucket(ctx, msg->id);
+
+	clock_gettime(CLOCK_MONOTONIC, &msg->sent);
+	if (msg->sent_time != NULL) {
+		*msg->sent_time = msg->sent;
+	}
+	msg_queue_push(&ctx->queue_sent, msg->str);
+
+	msg->hash_next = *bucket;
+	*bucket = msg;
+
+	if (ctx->timers != NULL && ctx->timeout_ms != 0) {
+		msg->ctx = ctx;
+		timer_init(&msg->deadline, msg_queue__deadline, msg);
+		timer_schedule(ctx->timers, &msg->deadline, ctx->timeout_ms);
+	}
+}
+
+char *msg_queue_take_sent(struct msg_ctx *ctx, int id)
+{
+	struct msg_container *msg = *msg_queue__sent_bucket(ctx, id);
+
+	while (msg != NULL && msg->id != id) {
+		msg = msg->hash_next;
+	}
+
+	if (msg == NULL) {
+		return NULL;
+	}
+
+	timer_cancel(&msg->deadline);
+	msg_queue__unlink_sent(ctx, msg);
+
+	if (cdt_log_get_level() >= CDT_LOG_DEBUG) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		cdt_log(CDT_LOG_DEBUG, "Response to %i after %" PRIi64 " us",
+				id, time_diff_us(&msg->sent, &now));
+	}
+
+	return msg->str;
+}
+
+/**
+ * Find a queued message that a new message supersedes.
+ *
+ * \param[in] queue  The queue to search.
+ * \param[in] msg    The new message.
+ * \return the superseded message, or NULL if there is none.
+ */
+static struct msg_container *msg_queue__find_superseded(
+		const struct msg_queue *queue,
+		const struct msg_container *msg)
+{
+	if (msg->coalesce == MSG_COALESCE_NONE) {
+		return NULL;
+	}
+
+	for (struct msg_container *m = queue->tail; m != NULL; m = m->prev) {
+		if (m->coalesce == msg->coalesce) {
+			return (m->type == msg->type) ? m : NULL;
+		}
+	}
+
+	return NULL;
 }
 
 void msg_queue_push(struct msg_queue *queue, char *msg_str)
 {
 	struct msg_container *msg = msg_str_to_container(msg_str);
+	struct msg_container *old;
 
 	assert(msg->prev == NULL);
 	assert(msg->next == NULL);
 
+	old = msg_queue__find_superseded(queue, msg);
+	if (old != NULL) {
+		cdt_log(CDT_LOG_DEBUG, "Message %i superseded by %i",
+				old->id, msg->id);
+		msg->queued = old->queued;
+		msg_queue_replace(queue, old->str, msg_str);
+		msg_drop(old->str);
+		return;
+	}
+
 	if (queue->head == NULL || queue->tail == NULL) {
 		assert(queue->head == NULL);
 		assert(queue->tail == NULL);
@@ -114,6 +471,37 @@ void msg_queue_remove(struct msg_queue *queue, char *msg_str)
 	msg->prev = NULL;
 }
 
+void msg_queue_replace(struct msg_queue *queue, char *msg_old, char *msg_new)
+{
+	struct msg_container *old = msg_str_to_container(msg_old);
+	struct msg_container *new = msg_str_to_container(msg_new);
+
+	assert(new->prev == NULL);
+	assert(new->next == NULL);
+
+	new->prev = old->prev;
+	new->next = old->next;
+
+	if (new->prev != NULL) {
+		new->prev->next = new;
+	}
+
+	if (new->next != NULL) {
+		new->next->prev = new;
+	}
+
+	if (queue->head == old) {
+		queue->head = new;
+	}
+
+	if (queue->tail == old) {
+		queue->tail = new;
+	}
+
+	old->next = NULL;
+	old->prev = NULL;
+}
+
 void msg_queue_drain(struct msg_queue *queue)
 {
 	while (queue->head != NULL) {
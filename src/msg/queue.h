@@ -7,6 +7,7 @@
 #ifndef CDT_MSG_QUEUE_H
 #define CDT_MSG_QUEUE_H
 
+struct msg_ctx;
 struct msg_container;
 
 struct msg_queue {
@@ -15,10 +16,178 @@ struct msg_queue {
 	unsigned count;
 };
 
-struct msg_queue *msg_queue_get_send(void);
+/**
+ * Send queue priority classes, highest priority first.
+ *
+ * Each class has its own send queue. Higher priority queues are drained
+ * first, but a queue that has been passed over too many times in a row is
+ * given a turn, so lower priority messages are never starved.
+ */
+enum msg_prio {
+	MSG_PRIO_INPUT,   /**< Latency sensitive input events. */
+	MSG_PRIO_CONTROL, /**< Control messages and acknowledgements. */
+	MSG_PRIO_BULK,    /**< Bulk messages, e.g. script evaluation. */
+	MSG_PRIO__COUNT,
+};
+
+/**
+ * Coalescing keys.
+ *
+ * Messages with the same coalescing key form a stream, in which a newer
+ * message can make an older unsent one pointless. When a message is pushed
+ * to a queue, if the most recent queued message in its stream has the same
+ * type, the new message replaces it in place rather than being appended.
+ *
+ * Only messages waiting to be sent are coalesced. Messages lose their
+ * coalescing key when they are popped for sending.
+ */
+enum msg_coalesce {
+	MSG_COALESCE_NONE,       /**< Never coalesced. */
+	MSG_COALESCE_TOUCH,      /**< Touch events, e.g. consecutive moves. */
+	MSG_COALESCE_SCREENCAST, /**< Screencast starting and stopping. */
+};
+
+/** Send queue wait time statistics for a priority class. */
+struct msg_queue_stats {
+	unsigned sent;         /**< Number of messages popped for sending. */
+	int64_t wait_total_us; /**< Total time spent queued. */
+	int64_t wait_max_us;   /**< Longest time spent queued. */
+};
+
+/** Send window statistics for a message context. */
+struct msg_window_stats {
+	unsigned stalls;        /**< Times sending stalled on a full window. */
+	int64_t stall_total_us; /**< Total time spent stalled. */
+	int64_t stall_max_us;   /**< Longest stall. */
+	unsigned sent_max;      /**< Most messages in flight at once. */
+	unsigned queued_max;    /**< Most messages waiting to be sent. */
+};
+
+/**
+ * Get the send queue for a priority class.
+ *
+ * \param[in] ctx   The message context.
+ * \param[in] prio  Priority class to get the send queue for.
+ * \return the send queue.
+ */
+struct msg_queue *msg_queue_get_send(struct msg_ctx *ctx,
+		enum msg_prio prio);
 
-struct msg_queue *msg_queue_get_sent(void);
+/**
+ * Get the total number of messages waiting to be sent.
+ *
+ * \param[in] ctx  The message context.
+ * \return the number of messages in all the send queues.
+ */
+unsigned msg_queue_send_count(const struct msg_ctx *ctx);
+
+/**
+ * Set the maximum number of messages in flight.
+ *
+ * Once this many sent messages await responses, no more are popped for
+ * sending until responses arrive.
+ *
+ * \param[in] ctx     The message context.
+ * \param[in] window  Maximum messages in flight, or 0 for no limit.
+ */
+void msg_queue_set_window(struct msg_ctx *ctx, unsigned window);
+
+/**
+ * Get whether the in-flight window is full.
+ *
+ * \param[in] ctx  The message context.
+ * \return true if no more messages may be sent until responses arrive.
+ */
+bool msg_queue_window_full(const struct msg_ctx *ctx);
+
+/**
+ * Get whether a message can be popped for sending now.
+ *
+ * \param[in] ctx  The message context.
+ * \return true if there are messages waiting and the window has room.
+ */
+bool msg_queue_can_send(const struct msg_ctx *ctx);
+
+/**
+ * Get whether commands should hold off queueing more messages.
+ *
+ * \param[in] ctx  The message context.
+ * \return true if messages are waiting to be sent, or the window is full.
+ */
+bool msg_queue_backpressure(const struct msg_ctx *ctx);
 
+/**
+ * Pop the next message to send from the send queues.
+ *
+ * \param[in] ctx  The message context.
+ * \return the message to send, or NULL if there are none, or the in-flight
+ *         window is full.
+ */
+char *msg_queue_pop_send(struct msg_ctx *ctx);
+
+/**
+ * Destroy all messages waiting to be sent.
+ *
+ * \param[in] ctx  The message context.
+ */
+void msg_queue_drain_send(struct msg_ctx *ctx);
+
+/**
+ * Get the send queue wait time statistics for a priority class.
+ *
+ * \param[in] ctx   The message context.
+ * \param[in] prio  Priority class to get statistics for.
+ * \return the statistics.
+ */
+const struct msg_queue_stats *msg_queue_get_send_stats(
+		const struct msg_ctx *ctx, enum msg_prio prio);
+
+/**
+ * Get the send window statistics.
+ *
+ * \param[in] ctx  The message context.
+ * \return the statistics.
+ */
+const struct msg_window_stats *msg_queue_get_window_stats(
+		const struct msg_ctx *ctx);
+
+struct msg_queue *msg_queue_get_sent(struct msg_ctx *ctx);
+
+/**
+ * Push a message that has been sent onto the sent queue.
+ *
+ * If the context has a response timeout, the message's deadline is started.
+ *
+ * The message may be replaced by a compact record of it, with only the
+ * start of its text, so `msg_str` must not be used afterwards.
+ *
+ * \param[in] ctx      The message context.
+ * \param[in] msg_str  The message that was sent.
+ */
+void msg_queue_push_sent(struct msg_ctx *ctx, char *msg_str);
+
+/**
+ * Take the sent message that a response is for off the sent queue.
+ *
+ * Sent messages are hashed by id, so this doesn't search the queue.
+ *
+ * \param[in] ctx  The message context.
+ * \param[in] id   Id from the response.
+ * \return the message, which the caller must destroy, or NULL if no sent
+ *         message has the id.
+ */
+char *msg_queue_take_sent(struct msg_ctx *ctx, int id);
+
+/**
+ * Push a message onto the end of a queue.
+ *
+ * If the message supersedes a queued message with the same coalescing key,
+ * it takes that message's place in the queue instead, and the superseded
+ * message is destroyed.
+ *
+ * \param[in] queue    The queue to push to.
+ * \param[in] msg_str  The message to push.
+ */
 void msg_queue_push(struct msg_queue *queue, char *msg_str);
 
 char *msg_queue_pop(struct msg_queue *queue);
@@ -27,6 +196,17 @@ char *msg_queue_find_by_id(const struct msg_queue *queue, int id);
 
 void msg_queue_remove(struct msg_queue *queue, char *msg_str);
 
+/**
+ * Replace a queued message with another, keeping its place in the queue.
+ *
+ * The replaced message is removed from the queue, but not destroyed.
+ *
+ * \param[in] queue    The queue containing `msg_old`.
+ * \param[in] msg_old  Queued message to replace.
+ * \param[in] msg_new  Unqueued message to take its place.
+ */
+void msg_queue_replace(struct msg_queue *queue, char *msg_old, char *msg_new);
+
 void msg_queue_drain(struct msg_queue *queue);
 
 #endif
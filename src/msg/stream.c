@@ -0,0 +1,155 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include "msg/msg.h"
+#include "msg/queue.h"
+#include "msg/private.h"
+
+#include "util/log.h"
+#include "util/json.h"
+
+/** Bytes of the file to read at a time. */
+#define MSG_STREAM_READ_SIZE (16 * 1024)
+
+/** Escaped bytes of the file to send in each fragment. */
+#define MSG_STREAM_FRAGMENT_SIZE (64 * 1024)
+
+/** Longest tail to end a streamed message with. */
+#define MSG_STREAM_TAIL_MAX 64
+
+/** A message body, read from a file and escaped as it is sent. */
+struct msg_stream {
+	int fd;
+	bool eof;         /**< Whether the file has all been read. */
+	bool error;       /**< Whether reading the file failed. */
+	const char *tail; /**< Text to end the message with. */
+	size_t tail_len;
+
+	size_t in_pos; /**< Position of the next byte to escape. */
+	size_t in_len; /**< Bytes read into `in`. */
+	char in[MSG_STREAM_READ_SIZE];
+
+	/** The fragment being sent, after padding for lws. */
+	char out[LWS_SEND_BUFFER_PRE_PADDING + MSG_STREAM_FRAGMENT_SIZE +
+			MSG_STREAM_TAIL_MAX + LWS_SEND_BUFFER_POST_PADDING];
+};
+
+bool msg_stream_create(struct msg_container *cont,
+		const char *path, const char *tail)
+{
+	struct msg_stream *stream;
+
+	assert(strlen(tail) <= MSG_STREAM_TAIL_MAX);
+
+	stream = calloc(1, sizeof(*stream));
+	if (stream == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	stream->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (stream->fd == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to open '%s': %s",
+				path, strerror(errno));
+		free(stream);
+		return false;
+	}
+
+	stream->tail = tail;
+	stream->tail_len = strlen(tail);
+
+	cont->stream = stream;
+	return true;
+}
+
+void msg_stream_destroy(struct msg_stream *stream)
+{
+	if (stream != NULL) {
+		close(stream->fd);
+		free(stream);
+	}
+}
+
+/**
+ * Read more of a stream's file.
+ *
+ * A read error leaves the message unfinishable, so it is flagged for the
+ * message to be abandoned, rather than ending the file early.
+ *
+ * \param[in] stream  The stream to read.
+ */
+static void msg_stream__read(struct msg_stream *stream)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(stream->fd, stream->in, sizeof(stream->in));
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		cdt_log(CDT_LOG_ERROR, "Failed to read script: %s",
+				strerror(errno));
+		stream->error = true;
+		return;
+	}
+
+	stream->in_pos = 0;
+	stream->in_len = (size_t)ret;
+	stream->eof = (ret == 0);
+}
+
+bool msg_is_streamed(char *msg_str)
+{
+	return msg_str_to_container(msg_str)->stream != NULL;
+}
+
+enum msg_stream_state msg_stream_next(char *msg_str, char **data, size_t *len)
+{
+	struct msg_stream *stream = msg_str_to_container(msg_str)->stream;
+	char *out = stream->out + LWS_SEND_BUFFER_PRE_PADDING;
+	size_t n = 0;
+
+	while (!stream->eof && n < MSG_STREAM_FRAGMENT_SIZE) {
+		size_t written;
+
+		if (stream->in_pos == stream->in_len) {
+			msg_stream__read(stream);
+			if (stream->error) {
+				*data = out;
+				*len = 0;
+				return MSG_STREAM_ERROR;
+			}
+			continue;
+		}
+
+		written = json_escape(out + n, MSG_STREAM_FRAGMENT_SIZE - n,
+				stream->in, &stream->in_pos, stream->in_len);
+		if (written == 0) {
+			break;
+		}
+		n += written;
+	}
+
+	*data = out;
+	*len = n;
+
+	if (!stream->eof) {
+		return MSG_STREAM_MORE;
+	}
+
+	memcpy(out + n, stream->tail, stream->tail_len);
+	*len += stream->tail_len;
+	return MSG_STREAM_LAST;
+}
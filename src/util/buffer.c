@@ -46,4 +46,5 @@ void cdt_buffer_delete(struct cdt_buffer *buf)
 	buf->alloc_size = 0;
 
 	free(buf->data);
+	buf->data = NULL;
 }
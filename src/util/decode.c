@@ -169,3 +169,158 @@ bool decode_extract_response_value_int(const char *msg, size_t len, int *ret)
 
 	return true;
 }
+
+/* Data structure for a Runtime.consoleAPICalled event. */
+struct console_api_call {
+	struct console_api_params {
+		char *type;
+		struct console_api_arg {
+			char *value;
+			char *description;
+		} *args;
+		unsigned args_count;
+	} params;
+};
+
+/* Schema to decode a Runtime.consoleAPICalled event. */
+
+static const struct cyaml_schema_field console_api_arg_fields_schema[] = {
+	CYAML_FIELD_STRING_PTR("value",
+			CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL,
+			struct console_api_arg, value,
+			0, CYAML_UNLIMITED),
+	CYAML_FIELD_STRING_PTR("description",
+			CYAML_FLAG_POINTER | CYAML_FLAG_OPTIONAL,
+			struct console_api_arg, description,
+			0, CYAML_UNLIMITED),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_value console_api_arg_schema = {
+	CYAML_VALUE_MAPPING(CYAML_FLAG_DEFAULT, struct console_api_arg,
+			console_api_arg_fields_schema),
+};
+
+static const struct cyaml_schema_field console_api_params_fields_schema[] = {
+	CYAML_FIELD_STRING_PTR("type", CYAML_FLAG_POINTER,
+			struct console_api_params, type, 0, CYAML_UNLIMITED),
+	CYAML_FIELD_SEQUENCE("args", CYAML_FLAG_POINTER,
+			struct console_api_params, args,
+			&console_api_arg_schema, 0, CYAML_UNLIMITED),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_field console_api_call_fields_schema[] = {
+	CYAML_FIELD_MAPPING("params", CYAML_FLAG_DEFAULT,
+			struct console_api_call, params,
+			console_api_params_fields_schema),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_value console_api_call_schema = {
+	CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct console_api_call,
+			console_api_call_fields_schema),
+};
+
+bool decode_extract_console_api_call(const char *msg, size_t len,
+		char **type_out, char **value_out)
+{
+	struct console_api_call *call;
+	struct console_api_arg *arg;
+	cyaml_err_t res;
+
+	config.log_ctx = (void *) cdt_log_get_level();
+
+	res = cyaml_load_data((const uint8_t *)msg, len,
+			&config,
+			&console_api_call_schema,
+			(void **)&call, NULL);
+	if (res != CYAML_OK) {
+		cdt_log(CDT_LOG_ERROR,
+				"Failed to parse event: %s",
+				cyaml_strerror(res));
+		return false;
+	}
+
+	/* Extract the type and value. */
+	*type_out = call->params.type;
+	call->params.type = NULL;
+
+	*value_out = NULL;
+	if (call->params.args_count > 0) {
+		arg = &call->params.args[0];
+		if (arg->value != NULL) {
+			*value_out = arg->value;
+			arg->value = NULL;
+		} else {
+			*value_out = arg->description;
+			arg->description = NULL;
+		}
+	}
+
+	cyaml_free(&config, &console_api_call_schema, call, 0);
+	call = NULL;
+
+	return true;
+}
+
+/* Data structure for a Runtime.bindingCalled event. */
+struct binding_call {
+	struct binding_params {
+		char *name;
+		char *payload;
+	} params;
+};
+
+/* Schema to decode a Runtime.bindingCalled event. */
+
+static const struct cyaml_schema_field binding_params_fields_schema[] = {
+	CYAML_FIELD_STRING_PTR("name", CYAML_FLAG_POINTER,
+			struct binding_params, name, 0, CYAML_UNLIMITED),
+	CYAML_FIELD_STRING_PTR("payload", CYAML_FLAG_POINTER,
+			struct binding_params, payload, 0, CYAML_UNLIMITED),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_field binding_call_fields_schema[] = {
+	CYAML_FIELD_MAPPING("params", CYAML_FLAG_DEFAULT,
+			struct binding_call, params,
+			binding_params_fields_schema),
+	CYAML_FIELD_END
+};
+
+static const struct cyaml_schema_value binding_call_schema = {
+	CYAML_VALUE_MAPPING(CYAML_FLAG_POINTER, struct binding_call,
+			binding_call_fields_schema),
+};
+
+bool decode_extract_binding_call(const char *msg, size_t len,
+		char **name_out, char **payload_out)
+{
+	struct binding_call *call;
+	cyaml_err_t res;
+
+	config.log_ctx = (void *) cdt_log_get_level();
+
+	res = cyaml_load_data((const uint8_t *)msg, len,
+			&config,
+			&binding_call_schema,
+			(void **)&call, NULL);
+	if (res != CYAML_OK) {
+		cdt_log(CDT_LOG_ERROR,
+				"Failed to parse event: %s",
+				cyaml_strerror(res));
+		return false;
+	}
+
+	/* Extract the name and payload. */
+	*name_out = call->params.name;
+	*payload_out = call->params.payload;
+	call->params.name = NULL;
+	call->params.payload = NULL;
+
+	cyaml_free(&config, &binding_call_schema, call, 0);
+	call = NULL;
+
+	return true;
+}
@@ -26,4 +26,30 @@ char *decode_extract_response_value(const char *msg, size_t len);
  */
 bool decode_extract_response_value_int(const char *msg, size_t len, int *ret);
 
+/**
+ * Extract the type and first argument from a Runtime.consoleAPICalled event.
+ *
+ * \param[in]  msg        The event message.
+ * \param[in]  len        The length of the event message.
+ * \param[out] type_out   Returns the call's type, e.g. "log", owned by caller.
+ * \param[out] value_out  Returns the first argument's value, or description
+ *                        if it has no value, owned by caller, or NULL if
+ *                        there are no arguments.
+ * \return Returns true on success of false on error.
+ */
+bool decode_extract_console_api_call(const char *msg, size_t len,
+		char **type_out, char **value_out);
+
+/**
+ * Extract the binding name and payload from a Runtime.bindingCalled event.
+ *
+ * \param[in]  msg          The event message.
+ * \param[in]  len          The length of the event message.
+ * \param[out] name_out     Returns the binding's name, owned by caller.
+ * \param[out] payload_out  Returns the call's payload, owned by caller.
+ * \return Returns true on success of false on error.
+ */
+bool decode_extract_binding_call(const char *msg, size_t len,
+		char **name_out, char **payload_out);
+
 #endif
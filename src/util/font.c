@@ -0,0 +1,94 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/font.h"
+#include "util/util.h"
+
+static const uint8_t font_digits[][FONT_GLYPH_H] = {
+	{ 7, 5, 5, 5, 7 }, /* 0 */
+	{ 2, 6, 2, 2, 7 }, /* 1 */
+	{ 7, 1, 7, 4, 7 }, /* 2 */
+	{ 7, 1, 3, 1, 7 }, /* 3 */
+	{ 5, 5, 7, 1, 1 }, /* 4 */
+	{ 7, 4, 7, 1, 7 }, /* 5 */
+	{ 7, 4, 7, 5, 7 }, /* 6 */
+	{ 7, 1, 2, 2, 2 }, /* 7 */
+	{ 7, 5, 7, 5, 7 }, /* 8 */
+	{ 7, 5, 7, 1, 7 }, /* 9 */
+};
+
+static const uint8_t font_letters[][FONT_GLYPH_H] = {
+	{ 2, 5, 7, 5, 5 }, /* A */
+	{ 6, 5, 6, 5, 6 }, /* B */
+	{ 3, 4, 4, 4, 3 }, /* C */
+	{ 6, 5, 5, 5, 6 }, /* D */
+	{ 7, 4, 6, 4, 7 }, /* E */
+	{ 7, 4, 6, 4, 4 }, /* F */
+	{ 3, 4, 5, 5, 3 }, /* G */
+	{ 5, 5, 7, 5, 5 }, /* H */
+	{ 7, 2, 2, 2, 7 }, /* I */
+	{ 1, 1, 1, 5, 2 }, /* J */
+	{ 5, 5, 6, 5, 5 }, /* K */
+	{ 4, 4, 4, 4, 7 }, /* L */
+	{ 5, 7, 7, 5, 5 }, /* M */
+	{ 6, 5, 5, 5, 5 }, /* N */
+	{ 2, 5, 5, 5, 2 }, /* O */
+	{ 6, 5, 6, 4, 4 }, /* P */
+	{ 2, 5, 5, 6, 3 }, /* Q */
+	{ 6, 5, 6, 5, 5 }, /* R */
+	{ 3, 4, 2, 1, 6 }, /* S */
+	{ 7, 2, 2, 2, 2 }, /* T */
+	{ 5, 5, 5, 5, 7 }, /* U */
+	{ 5, 5, 5, 5, 2 }, /* V */
+	{ 5, 5, 7, 7, 5 }, /* W */
+	{ 5, 5, 2, 5, 5 }, /* X */
+	{ 5, 5, 2, 2, 2 }, /* Y */
+	{ 7, 1, 2, 4, 7 }, /* Z */
+};
+
+static const struct {
+	char c;
+	uint8_t rows[FONT_GLYPH_H];
+} font_symbols[] = {
+	{ ' ', { 0, 0, 0, 0, 0 } },
+	{ '.', { 0, 0, 0, 0, 2 } },
+	{ ',', { 0, 0, 0, 2, 4 } },
+	{ ':', { 0, 2, 0, 2, 0 } },
+	{ '/', { 1, 1, 2, 4, 4 } },
+	{ '-', { 0, 0, 7, 0, 0 } },
+	{ '+', { 0, 2, 7, 2, 0 } },
+	{ '%', { 5, 1, 2, 4, 5 } },
+	{ '(', { 1, 2, 2, 2, 1 } },
+	{ ')', { 4, 2, 2, 2, 4 } },
+	{ '=', { 0, 7, 0, 7, 0 } },
+};
+
+const uint8_t *font_get_glyph(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return font_digits[c - '0'];
+	}
+
+	if (c >= 'a' && c <= 'z') {
+		c = (char)(c - 'a' + 'A');
+	}
+
+	if (c >= 'A' && c <= 'Z') {
+		return font_letters[c - 'A'];
+	}
+
+	for (size_t i = 0; i < CDT_ARRAY_COUNT(font_symbols); i++) {
+		if (font_symbols[i].c == c) {
+			return font_symbols[i].rows;
+		}
+	}
+
+	return NULL;
+}
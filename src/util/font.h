@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_UTIL_FONT_H
+#define CDT_UTIL_FONT_H
+
+#include <stdint.h>
+
+/** Width of a glyph in font pixels. */
+#define FONT_GLYPH_W 3
+
+/** Height of a glyph in font pixels. */
+#define FONT_GLYPH_H 5
+
+/**
+ * Get the bitmap for a character.
+ *
+ * The font is a tiny fixed-width bitmap font, intended for drawing
+ * diagnostic overlays without any font rendering dependency. Lower case
+ * letters are drawn as upper case.
+ *
+ * Each of the \ref FONT_GLYPH_H rows is a byte, with the most significant
+ * of the low \ref FONT_GLYPH_W bits being the leftmost pixel.
+ *
+ * \param[in] c  Character to get the glyph for.
+ * \return Glyph rows, or NULL if the character has no glyph.
+ */
+const uint8_t *font_get_glyph(char c);
+
+#endif
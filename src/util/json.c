@@ -0,0 +1,106 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util/json.h"
+
+/** A byte repeated in each byte of a word. */
+#define JSON_WORD_REPEAT(_b) (UINT64_C(0x0101010101010101) * (_b))
+
+/**
+ * Check a word for bytes that need escaping.
+ *
+ * Checks eight bytes at once, for any below 0x20, or equal to a quote or a
+ * backslash. Bytes 0x80 and above never match, so UTF-8 passes straight
+ * through.
+ *
+ * \param[in] w  Eight bytes of input.
+ * \return true if any of the bytes need escaping.
+ */
+static inline bool json__word_needs_escape(uint64_t w)
+{
+	const uint64_t high = JSON_WORD_REPEAT(0x80);
+	uint64_t quote = w ^ JSON_WORD_REPEAT('"');
+	uint64_t slash = w ^ JSON_WORD_REPEAT('\\');
+	uint64_t found;
+
+	found  = (w - JSON_WORD_REPEAT(0x20)) & ~w;
+	found |= (quote - JSON_WORD_REPEAT(0x01)) & ~quote;
+	found |= (slash - JSON_WORD_REPEAT(0x01)) & ~slash;
+
+	return (found & high) != 0;
+}
+
+/**
+ * Escape one byte.
+ *
+ * \param[out] out  Buffer with room for \ref JSON_ESCAPE_MAX bytes.
+ * \param[in]  c    The byte to escape.
+ * \return the number of bytes written.
+ */
+static size_t json__escape_byte(char *out, unsigned char c)
+{
+	static const char short_escape[0x20] = {
+		['\b'] = 'b',
+		['\f'] = 'f',
+		['\n'] = 'n',
+		['\r'] = 'r',
+		['\t'] = 't',
+	};
+
+	if (c == '"' || c == '\\') {
+		out[0] = '\\';
+		out[1] = (char)c;
+		return 2;
+
+	} else if (c >= 0x20) {
+		out[0] = (char)c;
+		return 1;
+
+	} else if (short_escape[c] != '\0') {
+		out[0] = '\\';
+		out[1] = short_escape[c];
+		return 2;
+	}
+
+	snprintf(out, JSON_ESCAPE_MAX + 1, "\\u%04x", c);
+	return JSON_ESCAPE_MAX;
+}
+
+size_t json_escape(char *out, size_t out_size,
+		const char *in, size_t *in_pos, size_t in_len)
+{
+	size_t pos = *in_pos;
+	size_t n = 0;
+
+	while (pos < in_len) {
+		if (in_len - pos >= sizeof(uint64_t) &&
+		    out_size - n >= sizeof(uint64_t)) {
+			uint64_t w;
+
+			memcpy(&w, in + pos, sizeof(w));
+			if (!json__word_needs_escape(w)) {
+				memcpy(out + n, &w, sizeof(w));
+				n += sizeof(w);
+				pos += sizeof(w);
+				continue;
+			}
+		}
+
+		if (out_size - n < JSON_ESCAPE_MAX + 1) {
+			break;
+		}
+
+		n += json__escape_byte(out + n, (unsigned char)in[pos++]);
+	}
+
+	*in_pos = pos;
+	return n;
+}
@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_UTIL_JSON_H
+#define CDT_UTIL_JSON_H
+
+/** Longest output for one input byte, e.g. `\u001f`. */
+#define JSON_ESCAPE_MAX 6
+
+/**
+ * Escape text for use inside a JSON string.
+ *
+ * Quotes, backslashes and control characters are escaped. Other bytes,
+ * including UTF-8 sequences, are copied as they are, so the input can be
+ * split anywhere and escaped a piece at a time.
+ *
+ * Escaping stops before the output would overflow, so the input may not
+ * all be consumed.
+ *
+ * \param[out]    out       Buffer to write the escaped text to.
+ * \param[in]     out_size  Size of the output buffer in bytes.
+ * \param[in]     in        Text to escape.
+ * \param[in,out] in_pos    Position in the input to start at. Updated to
+ *                          the first byte not escaped.
+ * \param[in]     in_len    Length of the input in bytes.
+ * \return the number of bytes written to the output.
+ */
+size_t json_escape(char *out, size_t out_size,
+		const char *in, size_t *in_pos, size_t in_len);
+
+#endif
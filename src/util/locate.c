@@ -0,0 +1,241 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util/log.h"
+#include "util/locate.h"
+
+/** Most selectors to keep. The least recently added is dropped first. */
+#define LOCATE_CACHE_MAX 64
+
+struct locate_entry {
+	struct locate_entry *next;
+	char *selector;
+	bool all;
+
+	int *node_ids;
+	unsigned count;
+};
+
+struct locate_cache {
+	int document; /**< Document nodeId, or 0 if not known. */
+
+	/** Selectors, most recently added first. */
+	struct locate_entry *entry;
+	unsigned count;
+};
+
+static void locate_entry__free(struct locate_entry *entry)
+{
+	free(entry->node_ids);
+	free(entry->selector);
+	free(entry);
+}
+
+/**
+ * Find the link to a selector's entry.
+ *
+ * \param[in] cache     The locate cache.
+ * \param[in] selector  The JSON escaped CSS selector.
+ * \param[in] all       Whether every match was wanted, or just the first.
+ * \return the link to the entry, which points to NULL if there is none.
+ */
+static struct locate_entry **locate_cache__find(
+		const struct locate_cache *cache,
+		const char *selector, bool all)
+{
+	struct locate_entry **link;
+
+	link = (struct locate_entry **)&cache->entry;
+	while (*link != NULL) {
+		if ((*link)->all == all &&
+		    strcmp((*link)->selector, selector) == 0) {
+			break;
+		}
+		link = &(*link)->next;
+	}
+
+	return link;
+}
+
+struct locate_cache *locate_cache_create(void)
+{
+	struct locate_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void locate_cache_destroy(struct locate_cache *cache)
+{
+	locate_cache_clear(cache);
+	free(cache);
+}
+
+void locate_cache_clear(struct locate_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	locate_cache_forget_matches(cache);
+	cache->document = 0;
+}
+
+void locate_cache_forget_matches(struct locate_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	while (cache->entry != NULL) {
+		struct locate_entry *entry = cache->entry;
+
+		cache->entry = entry->next;
+		locate_entry__free(entry);
+	}
+
+	cache->count = 0;
+}
+
+int locate_cache_get_document(const struct locate_cache *cache)
+{
+	return (cache != NULL) ? cache->document : 0;
+}
+
+void locate_cache_set_document(struct locate_cache *cache, int node_id)
+{
+	if (cache != NULL) {
+		cache->document = node_id;
+	}
+}
+
+const int *locate_cache_get(const struct locate_cache *cache,
+		const char *selector, bool all, unsigned *count_out)
+{
+	const struct locate_entry *entry;
+
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	entry = *locate_cache__find(cache, selector, all);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	*count_out = entry->count;
+	return entry->node_ids;
+}
+
+bool locate_cache_set(struct locate_cache *cache, const char *selector,
+		bool all, const int *node_ids, unsigned count)
+{
+	struct locate_entry **link;
+	struct locate_entry *entry;
+
+	if (cache == NULL) {
+		return true;
+	}
+
+	locate_cache_remove(cache, selector, all);
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	entry->all = all;
+	entry->count = count;
+	entry->selector = strdup(selector);
+	entry->node_ids = malloc(count * sizeof(*node_ids));
+	if (entry->selector == NULL || entry->node_ids == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		locate_entry__free(entry);
+		return false;
+	}
+	memcpy(entry->node_ids, node_ids, count * sizeof(*node_ids));
+
+	entry->next = cache->entry;
+	cache->entry = entry;
+	cache->count++;
+
+	if (cache->count > LOCATE_CACHE_MAX) {
+		link = &cache->entry;
+		while ((*link)->next != NULL) {
+			link = &(*link)->next;
+		}
+
+		locate_entry__free(*link);
+		*link = NULL;
+		cache->count--;
+	}
+
+	return true;
+}
+
+void locate_cache_remove(struct locate_cache *cache,
+		const char *selector, bool all)
+{
+	struct locate_entry **link;
+	struct locate_entry *entry;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	link = locate_cache__find(cache, selector, all);
+	entry = *link;
+	if (entry != NULL) {
+		*link = entry->next;
+		locate_entry__free(entry);
+		cache->count--;
+	}
+}
+
+void locate_cache_remove_node(struct locate_cache *cache, int node_id)
+{
+	struct locate_entry **link;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	if (node_id == cache->document) {
+		locate_cache_clear(cache);
+		return;
+	}
+
+	link = &cache->entry;
+	while (*link != NULL) {
+		struct locate_entry *entry = *link;
+		bool found = false;
+
+		for (unsigned i = 0; i < entry->count; i++) {
+			if (entry->node_ids[i] == node_id) {
+				found = true;
+				break;
+			}
+		}
+
+		if (found) {
+			*link = entry->next;
+			locate_entry__free(entry);
+			cache->count--;
+		} else {
+			link = &entry->next;
+		}
+	}
+}
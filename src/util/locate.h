@@ -0,0 +1,120 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_UTIL_LOCATE_H
+#define CDT_UTIL_LOCATE_H
+
+/**
+ * \file
+ * \brief Cache of elements located in a page.
+ *
+ * Keeps the DevTools nodeId of the page's document, and the nodeIds that
+ * CSS selectors matched, so locating the same elements again only needs
+ * their box models.
+ *
+ * Node ids are only valid while the document they came from is loaded.
+ * The cache must be cleared on `DOM.documentUpdated` and when the page's
+ * connection is replaced, and nodes must be removed from it on
+ * `DOM.childNodeRemoved`. Selectors may match different nodes once nodes
+ * are added or their attributes change, so the matches must be forgotten
+ * on `DOM.childNodeInserted`, `DOM.attributeModified` and
+ * `DOM.attributeRemoved`. DevTools only reports changes to nodes it has
+ * given ids for, so cached ids can still go stale; users must be ready
+ * for DevTools to reject them.
+ *
+ * Every function accepts a NULL cache, which holds nothing.
+ */
+
+struct locate_cache;
+
+/**
+ * Create a locate cache.
+ *
+ * \return the locate cache, or NULL on error.
+ */
+struct locate_cache *locate_cache_create(void);
+
+/**
+ * Destroy a locate cache.
+ *
+ * \param[in] cache  The locate cache to destroy, or NULL.
+ */
+void locate_cache_destroy(struct locate_cache *cache);
+
+/**
+ * Forget the document and every selector in a locate cache.
+ *
+ * \param[in] cache  The locate cache, or NULL.
+ */
+void locate_cache_clear(struct locate_cache *cache);
+
+/**
+ * Get the nodeId of the document.
+ *
+ * \param[in] cache  The locate cache, or NULL.
+ * \return the document's nodeId, or 0 if it is not known.
+ */
+int locate_cache_get_document(const struct locate_cache *cache);
+
+/**
+ * Set the nodeId of the document.
+ *
+ * \param[in] cache    The locate cache, or NULL.
+ * \param[in] node_id  The document's nodeId.
+ */
+void locate_cache_set_document(struct locate_cache *cache, int node_id);
+
+/**
+ * Get the nodes a selector matched.
+ *
+ * \param[in]  cache      The locate cache, or NULL.
+ * \param[in]  selector   The JSON escaped CSS selector.
+ * \param[in]  all        Whether every match was wanted, or just the first.
+ * \param[out] count_out  Returns the number of nodeIds.
+ * \return the nodeIds, or NULL if the selector has not been cached.
+ */
+const int *locate_cache_get(const struct locate_cache *cache,
+		const char *selector, bool all, unsigned *count_out);
+
+/**
+ * Add the nodes a selector matched to a locate cache.
+ *
+ * \param[in] cache     The locate cache, or NULL.
+ * \param[in] selector  The JSON escaped CSS selector.
+ * \param[in] all       Whether every match was wanted, or just the first.
+ * \param[in] node_ids  The nodeIds the selector matched.
+ * \param[in] count     The number of nodeIds.
+ * \return true on success, false otherwise.
+ */
+bool locate_cache_set(struct locate_cache *cache, const char *selector,
+		bool all, const int *node_ids, unsigned count);
+
+/**
+ * Remove a selector from a locate cache, if it is there.
+ *
+ * \param[in] cache     The locate cache, or NULL.
+ * \param[in] selector  The JSON escaped CSS selector.
+ * \param[in] all       Whether every match was wanted, or just the first.
+ */
+void locate_cache_remove(struct locate_cache *cache,
+		const char *selector, bool all);
+
+/**
+ * Remove every selector that matched a node which has left the document.
+ *
+ * \param[in] cache    The locate cache, or NULL.
+ * \param[in] node_id  The nodeId of the removed node.
+ */
+void locate_cache_remove_node(struct locate_cache *cache, int node_id);
+
+/**
+ * Forget every selector's matches, keeping the document's nodeId.
+ *
+ * \param[in] cache  The locate cache, or NULL.
+ */
+void locate_cache_forget_matches(struct locate_cache *cache);
+
+#endif
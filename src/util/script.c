@@ -0,0 +1,176 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util/log.h"
+#include "util/script.h"
+
+/** Number of hash chains. Must be a power of two. */
+#define SCRIPT_CACHE_SIZE 64
+
+struct script_entry {
+	struct script_entry *next;
+	uint64_t hash; /**< Hash of the script text. */
+	size_t len;    /**< Length of the script text. */
+	char *script;  /**< The script text. */
+	char *id;      /**< DevTools script id. */
+};
+
+struct script_cache {
+	struct script_entry *entry[SCRIPT_CACHE_SIZE];
+};
+
+static void script_entry__free(struct script_entry *entry)
+{
+	free(entry->script);
+	free(entry->id);
+	free(entry);
+}
+
+/**
+ * Hash script text, with 64-bit FNV-1a.
+ *
+ * \param[in]  script   The script text.
+ * \param[out] len_out  Returns the length of the script text.
+ * \return the hash.
+ */
+static uint64_t script_cache__hash(const char *script, size_t *len_out)
+{
+	uint64_t hash = 14695981039346656037ull;
+	size_t len = 0;
+
+	for (; script[len] != '\0'; len++) {
+		hash ^= (uint8_t)script[len];
+		hash *= 1099511628211ull;
+	}
+
+	*len_out = len;
+	return hash;
+}
+
+/**
+ * Find the link to a script's entry.
+ *
+ * \param[in] cache   The script cache.
+ * \param[in] script  The script text.
+ * \return the link to the entry, which points to NULL if there is none.
+ */
+static struct script_entry **script_cache__find(
+		const struct script_cache *cache, const char *script)
+{
+	size_t len;
+	uint64_t hash = script_cache__hash(script, &len);
+	struct script_entry **link;
+
+	link = (struct script_entry **)
+			&cache->entry[hash & (SCRIPT_CACHE_SIZE - 1)];
+	while (*link != NULL) {
+		if ((*link)->hash == hash && (*link)->len == len &&
+		    memcmp((*link)->script, script, len) == 0) {
+			break;
+		}
+		link = &(*link)->next;
+	}
+
+	return link;
+}
+
+struct script_cache *script_cache_create(void)
+{
+	struct script_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void script_cache_destroy(struct script_cache *cache)
+{
+	script_cache_clear(cache);
+	free(cache);
+}
+
+void script_cache_clear(struct script_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	for (unsigned i = 0; i < SCRIPT_CACHE_SIZE; i++) {
+		while (cache->entry[i] != NULL) {
+			struct script_entry *entry = cache->entry[i];
+
+			cache->entry[i] = entry->next;
+			script_entry__free(entry);
+		}
+	}
+}
+
+const char *script_cache_get(const struct script_cache *cache,
+		const char *script)
+{
+	const struct script_entry *entry = *script_cache__find(cache, script);
+
+	return (entry != NULL) ? entry->id : NULL;
+}
+
+bool script_cache_set(struct script_cache *cache, const char *script,
+		const char *script_id, size_t len)
+{
+	struct script_entry **link = script_cache__find(cache, script);
+	struct script_entry *entry = *link;
+	char *id;
+
+	id = strndup(script_id, len);
+	if (id == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return false;
+	}
+
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(*entry));
+		if (entry == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			free(id);
+			return false;
+		}
+
+		entry->hash = script_cache__hash(script, &entry->len);
+		entry->script = strndup(script, entry->len);
+		if (entry->script == NULL) {
+			cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!",
+					__func__);
+			free(entry);
+			free(id);
+			return false;
+		}
+		*link = entry;
+	}
+
+	free(entry->id);
+	entry->id = id;
+	return true;
+}
+
+void script_cache_remove(struct script_cache *cache, const char *script)
+{
+	struct script_entry **link = script_cache__find(cache, script);
+	struct script_entry *entry = *link;
+
+	if (entry != NULL) {
+		*link = entry->next;
+		script_entry__free(entry);
+	}
+}
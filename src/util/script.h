@@ -0,0 +1,77 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_UTIL_SCRIPT_H
+#define CDT_UTIL_SCRIPT_H
+
+/**
+ * \file
+ * \brief Cache of scripts compiled in a page.
+ *
+ * Maps script text to the id DevTools gave the script when it was compiled
+ * with `Runtime.compileScript`, so it can be run again with
+ * `Runtime.runScript` without sending or parsing it again. Scripts are
+ * looked up by a hash of their content, and the text is kept to confirm
+ * a match, so scripts whose hashes collide are never confused.
+ *
+ * Script ids are only valid in the execution context that compiled them,
+ * so the cache must be cleared when the page's connection is replaced.
+ */
+
+struct script_cache;
+
+/**
+ * Create a script cache.
+ *
+ * \return the script cache, or NULL on error.
+ */
+struct script_cache *script_cache_create(void);
+
+/**
+ * Destroy a script cache.
+ *
+ * \param[in] cache  The script cache to destroy, or NULL.
+ */
+void script_cache_destroy(struct script_cache *cache);
+
+/**
+ * Forget every script in a script cache.
+ *
+ * \param[in] cache  The script cache, or NULL.
+ */
+void script_cache_clear(struct script_cache *cache);
+
+/**
+ * Get the id of a compiled script.
+ *
+ * \param[in] cache   The script cache.
+ * \param[in] script  The script text.
+ * \return the script's id, or NULL if it has not been compiled.
+ */
+const char *script_cache_get(const struct script_cache *cache,
+		const char *script);
+
+/**
+ * Add a compiled script to a script cache.
+ *
+ * \param[in] cache      The script cache.
+ * \param[in] script     The script text.
+ * \param[in] script_id  The script's id. Need not be NUL terminated.
+ * \param[in] len        Length of script_id in bytes.
+ * \return true on success, false otherwise.
+ */
+bool script_cache_set(struct script_cache *cache, const char *script,
+		const char *script_id, size_t len);
+
+/**
+ * Remove a script from a script cache, if it is there.
+ *
+ * \param[in] cache   The script cache.
+ * \param[in] script  The script text.
+ */
+void script_cache_remove(struct script_cache *cache, const char *script);
+
+#endif
@@ -15,4 +15,12 @@ static inline int64_t time_diff_ms(
 		(time_check->tv_nsec - time_start->tv_nsec) / 1000000);
 }
 
+static inline int64_t time_diff_us(
+		const struct timespec *time_start,
+		const struct timespec *time_check)
+{
+	return ((time_check->tv_sec  - time_start->tv_sec) * 1000000 +
+		(time_check->tv_nsec - time_start->tv_nsec) / 1000);
+}
+
 #endif
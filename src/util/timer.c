@@ -0,0 +1,286 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "util/log.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/** Each wheel has 2^TIMER_WHEEL_BITS slots. */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/** Number of wheels. With 1 ms slots, these span about 4.6 hours. */
+#define TIMER_WHEEL_LEVELS 4
+
+/** Furthest ahead a timer can be placed in the wheels, in ms. */
+#define TIMER_WHEEL_RANGE (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+struct timer_wheel {
+	struct timespec epoch; /**< Real time of wheel time zero. */
+	uint64_t now;          /**< Wheel time processed up to, in ms. */
+	unsigned count;        /**< Number of pending timers. */
+
+	struct timer *slot[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+static uint64_t timer_wheel__time(const struct timer_wheel *wheel)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		return wheel->now;
+	}
+
+	return (uint64_t)time_diff_ms(&wheel->epoch, &now);
+}
+
+static unsigned timer_wheel__index(uint64_t time, unsigned level)
+{
+	return (unsigned)(time >> (TIMER_WHEEL_BITS * level)) &
+			TIMER_WHEEL_MASK;
+}
+
+/**
+ * Add a timer to the slot for its expiry time.
+ *
+ * \param[in] wheel  The timer wheel.
+ * \param[in] timer  The timer to add, which must not be pending.
+ */
+static void timer_wheel__add(struct timer_wheel *wheel, struct timer *timer)
+{
+	uint64_t expiry = timer->expiry;
+	struct timer **head;
+	unsigned level = 0;
+
+	if (expiry < wheel->now) {
+		expiry = wheel->now;
+	} else if (expiry - wheel->now >= TIMER_WHEEL_RANGE) {
+		/* Park it as far ahead as possible. It will be placed
+		 * again when it is cascaded. */
+		expiry = wheel->now + TIMER_WHEEL_RANGE - 1;
+	}
+
+	while (level < TIMER_WHEEL_LEVELS - 1 && expiry - wheel->now >=
+			(1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+		level++;
+	}
+
+	head = &wheel->slot[level][timer_wheel__index(expiry, level)];
+
+	timer->next = *head;
+	if (timer->next != NULL) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+}
+
+static void timer__unlink(struct timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next != NULL) {
+		timer->next->pprev = timer->pprev;
+	}
+
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/**
+ * Take all the timers out of a slot.
+ *
+ * \param[in] head  The slot.
+ * \return the slot's list of timers, which are no longer linked in.
+ */
+static struct timer *timer_wheel__take(struct timer **head)
+{
+	struct timer *list = *head;
+
+	*head = NULL;
+
+	for (struct timer *t = list; t != NULL; t = t->next) {
+		t->pprev = NULL;
+	}
+
+	return list;
+}
+
+/**
+ * Move the timers in a coarse wheel's current slot down the wheels.
+ *
+ * \param[in] wheel  The timer wheel.
+ * \param[in] level  The wheel to cascade from.
+ */
+static void timer_wheel__cascade(struct timer_wheel *wheel, unsigned level)
+{
+	unsigned index = timer_wheel__index(wheel->now, level);
+	struct timer *list = timer_wheel__take(&wheel->slot[level][index]);
+
+	while (list != NULL) {
+		struct timer *timer = list;
+
+		list = timer->next;
+		timer->next = NULL;
+		timer_wheel__add(wheel, timer);
+	}
+}
+
+/**
+ * Call the timers in the finest wheel's current slot.
+ *
+ * \param[in] wheel  The timer wheel.
+ */
+static void timer_wheel__expire(struct timer_wheel *wheel)
+{
+	unsigned index = timer_wheel__index(wheel->now, 0);
+
+	/* Callbacks may schedule or cancel timers, so take one at a time. */
+	while (wheel->slot[0][index] != NULL) {
+		struct timer *timer = wheel->slot[0][index];
+
+		timer__unlink(timer);
+
+		if (timer->expiry > wheel->now) {
+			/* Parked for later; place it again. */
+			timer_wheel__add(wheel, timer);
+			continue;
+		}
+
+		wheel->count--;
+		timer->fn(timer->pw);
+	}
+}
+
+struct timer_wheel *timer_wheel_create(void)
+{
+	struct timer_wheel *wheel;
+
+	wheel = calloc(1, sizeof(*wheel));
+	if (wheel == NULL) {
+		cdt_log(CDT_LOG_ERROR, "%s: Allocation failed!", __func__);
+		return NULL;
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &wheel->epoch) == -1) {
+		free(wheel);
+		return NULL;
+	}
+
+	return wheel;
+}
+
+void timer_wheel_destroy(struct timer_wheel *wheel)
+{
+	if (wheel == NULL) {
+		return;
+	}
+
+	for (unsigned l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+		for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+			timer_wheel__take(&wheel->slot[l][i]);
+		}
+	}
+
+	free(wheel);
+}
+
+void timer_wheel_run(struct timer_wheel *wheel)
+{
+	uint64_t target = timer_wheel__time(wheel);
+
+	while (wheel->now < target) {
+		unsigned level = 1;
+
+		if (wheel->count == 0) {
+			/* Nothing to cascade or call; skip ahead. */
+			wheel->now = target;
+			break;
+		}
+
+		wheel->now++;
+
+		/* Cascade from the coarsest wheel that has come round to a
+		 * new slot, so its timers can drop through every level. */
+		while (level < TIMER_WHEEL_LEVELS && timer_wheel__index(
+				wheel->now, level - 1) == 0) {
+			level++;
+		}
+		while (--level > 0) {
+			timer_wheel__cascade(wheel, level);
+		}
+
+		timer_wheel__expire(wheel);
+	}
+}
+
+int timer_wheel_next_ms(const struct timer_wheel *wheel, int max)
+{
+	uint64_t time = timer_wheel__time(wheel);
+	uint64_t lag = (time > wheel->now) ? time - wheel->now : 0;
+	int next = max;
+
+	if (wheel->count == 0) {
+		return max;
+	}
+
+	/* Look ahead in the finest wheel, up to when it comes round. */
+	for (unsigned i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+		uint64_t at = wheel->now + i;
+
+		if (wheel->slot[0][timer_wheel__index(at, 0)] != NULL ||
+				timer_wheel__index(at, 0) == 0) {
+			next = (int)i;
+			break;
+		}
+	}
+
+	if (lag >= (uint64_t)next) {
+		return 0;
+	}
+
+	next -= (int)lag;
+	return (next < max) ? next : max;
+}
+
+void timer_init(struct timer *timer, timer_fn fn, void *pw)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->wheel = NULL;
+	timer->expiry = 0;
+	timer->fn = fn;
+	timer->pw = pw;
+}
+
+void timer_schedule(struct timer_wheel *wheel, struct timer *timer,
+		uint64_t delay_ms)
+{
+	timer_cancel(timer);
+
+	/* Never due in a slot that has already been processed. */
+	timer->expiry = timer_wheel__time(wheel) + delay_ms;
+	if (timer->expiry <= wheel->now) {
+		timer->expiry = wheel->now + 1;
+	}
+
+	timer->wheel = wheel;
+	timer_wheel__add(wheel, timer);
+	wheel->count++;
+}
+
+void timer_cancel(struct timer *timer)
+{
+	if (timer_pending(timer)) {
+		timer__unlink(timer);
+		timer->wheel->count--;
+	}
+}
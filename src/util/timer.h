@@ -0,0 +1,119 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2022 Codethink
+ */
+
+#ifndef CDT_UTIL_TIMER_H
+#define CDT_UTIL_TIMER_H
+
+/**
+ * \file
+ * \brief Hierarchical timer wheel.
+ *
+ * Timers are kept in a wheel of millisecond slots, with coarser wheels for
+ * timers further in the future, which are cascaded down as their time
+ * approaches. Scheduling and cancelling are O(1), so thousands of pending
+ * timers are cheap.
+ *
+ * Timers are embedded in their owner's structure, and don't allocate.
+ */
+
+struct timer_wheel;
+
+/**
+ * Timer callback.
+ *
+ * The timer is no longer pending when it is called, so it may be scheduled
+ * again from the callback.
+ *
+ * \param[in] pw  The timer's client data.
+ */
+typedef void (*timer_fn)(void *pw);
+
+/** A timer, embedded in its owner. */
+struct timer {
+	struct timer *next;
+	struct timer **pprev;      /**< Link to this timer, if pending. */
+	struct timer_wheel *wheel; /**< Wheel the timer was scheduled in. */
+	uint64_t expiry;           /**< Wheel time to fire at, in ms. */
+
+	timer_fn fn;
+	void *pw;
+};
+
+/**
+ * Create a timer wheel.
+ *
+ * \return the timer wheel, or NULL on error.
+ */
+struct timer_wheel *timer_wheel_create(void);
+
+/**
+ * Destroy a timer wheel.
+ *
+ * Any timers still pending are cancelled, without being called.
+ *
+ * \param[in] wheel  The timer wheel to destroy.
+ */
+void timer_wheel_destroy(struct timer_wheel *wheel);
+
+/**
+ * Call any timers that are due.
+ *
+ * \param[in] wheel  The timer wheel to run.
+ */
+void timer_wheel_run(struct timer_wheel *wheel);
+
+/**
+ * Get the time until the next timer may be due.
+ *
+ * This may be earlier than the next timer is actually due, when the wheel
+ * needs to cascade timers from its coarser wheels.
+ *
+ * \param[in] wheel  The timer wheel.
+ * \param[in] max    Maximum time to return, in ms.
+ * \return the time in ms, up to `max`.
+ */
+int timer_wheel_next_ms(const struct timer_wheel *wheel, int max);
+
+/**
+ * Initialise a timer.
+ *
+ * \param[in] timer  The timer to initialise.
+ * \param[in] fn     Function to call when the timer fires.
+ * \param[in] pw     Client data to pass to `fn`.
+ */
+void timer_init(struct timer *timer, timer_fn fn, void *pw);
+
+/**
+ * Schedule a timer.
+ *
+ * If the timer is already pending, it is rescheduled.
+ *
+ * \param[in] wheel     The timer wheel.
+ * \param[in] timer     The timer to schedule.
+ * \param[in] delay_ms  Time from now to fire at, in ms.
+ */
+void timer_schedule(struct timer_wheel *wheel, struct timer *timer,
+		uint64_t delay_ms);
+
+/**
+ * Cancel a timer, if it is pending.
+ *
+ * \param[in] timer  The timer to cancel.
+ */
+void timer_cancel(struct timer *timer);
+
+/**
+ * Get whether a timer is pending.
+ *
+ * \param[in] timer  The timer to check.
+ * \return true if the timer is scheduled and has not fired.
+ */
+static inline bool timer_pending(const struct timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+#endif